@@ -0,0 +1,175 @@
+#include <batch.h>
+
+#include <brace.h>
+#include <expand.h>
+#include <vars.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Room left for the auxiliary vector and alignment, like xargs does.
+#define LSH_BATCH_HEADROOM 2048
+
+typedef struct Batch {
+    char* const* prefix;
+    int prefix_size;
+    char* const* suffix;
+    int suffix_size;
+    // Space taken by the environment and the fixed arguments.
+    size_t fixed_size;
+    size_t limit;
+    Word_List words;
+    Arena arena;
+    size_t size;
+    int executions;
+    int status;
+} Batch;
+
+static size_t lsh_argument_size(char const* const argument) {
+    return strlen(argument) + 1 + sizeof(char*);
+}
+
+static void lsh_batch_execute(Batch* const batch) {
+    int const argc =
+        batch->prefix_size + batch->words.size + batch->suffix_size;
+    char** const argv = lsh_alloc_and_zero((argc + 1) * sizeof(char*));
+    memcpy(argv, batch->prefix, batch->prefix_size * sizeof(char*));
+    // The word list and the suffix are NULL while they are empty.
+    if(batch->words.size > 0) {
+        memcpy(argv + batch->prefix_size, batch->words.values,
+               batch->words.size * sizeof(char*));
+    }
+    if(batch->suffix_size > 0) {
+        memcpy(argv + batch->prefix_size + batch->words.size, batch->suffix,
+               batch->suffix_size * sizeof(char*));
+    }
+
+    pid_t const pid = fork();
+    if(pid == 0) {
+        execvp(argv[0], argv);
+        perror("execvp");
+        _exit(EXIT_FAILURE);
+    }
+
+    free(argv);
+    batch->executions += 1;
+    if(pid < 0) {
+        perror("batch: fork failed");
+        batch->status = 1;
+    } else {
+        int status = 0;
+        while(waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        if(WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+            batch->status = WEXITSTATUS(status);
+        } else if(WIFSIGNALED(status)) {
+            batch->status = 128 + WTERMSIG(status);
+        }
+    }
+
+    batch->words.size = 0;
+    batch->size = 0;
+    lsh_arena_free(&batch->arena);
+}
+
+static bool lsh_batch_push(Batch* const batch, char const* const word) {
+    size_t const size = lsh_argument_size(word);
+    if(batch->fixed_size + size > batch->limit) {
+        fprintf(stderr, "batch: argument too long\n");
+        return false;
+    }
+
+    if(batch->words.size > 0 &&
+       batch->fixed_size + batch->size + size > batch->limit) {
+        lsh_batch_execute(batch);
+    }
+
+    char* const copy =
+        lsh_arena_alloc_from_slice(&batch->arena, word, word + strlen(word));
+    lsh_word_list_push(&batch->words, copy);
+    batch->size += size;
+    return true;
+}
+
+static bool lsh_batch_push_expansion(Shell* const shell, Batch* const batch,
+                                     char const* const word) {
+    Brace_Expansion* const braces = lsh_brace_parse(word, word + strlen(word));
+    if(braces == NULL) {
+        return false;
+    }
+
+    bool result = true;
+    char const* begin = NULL;
+    char const* end = NULL;
+    while(result && lsh_brace_next(braces, &begin, &end)) {
+        Arena arena = {0};
+        Word_List fields = {0};
+        result = lsh_expand_word(shell, begin, end, &arena, &fields);
+        for(int i = 0; result && i < fields.size; ++i) {
+            result = lsh_batch_push(batch, fields.values[i]);
+        }
+        lsh_free_tagged(MEMORY_PARSER, fields.values);
+        lsh_arena_free(&arena);
+    }
+    lsh_brace_free(braces);
+    return result;
+}
+
+int lsh_run_batches(Shell* const shell, Process const* const process) {
+    long arg_max = sysconf(_SC_ARG_MAX);
+    if(arg_max <= 0) {
+        arg_max = _POSIX_ARG_MAX;
+    }
+
+    Batch batch = {
+        .prefix = process->args,
+        .prefix_size = process->batch_index,
+        .limit = arg_max - LSH_BATCH_HEADROOM,
+    };
+
+    int argc = 0;
+    while(process->args[argc] != NULL) {
+        argc += 1;
+    }
+
+    if(process->batch_word != NULL) {
+        batch.suffix = process->args + process->batch_index;
+        batch.suffix_size = argc - process->batch_index;
+    }
+
+    // Both argv and envp are null-terminated.
+    batch.fixed_size = 2 * sizeof(char*);
+    for(char** i = lsh_get_envp(); *i != NULL; ++i) {
+        batch.fixed_size += lsh_argument_size(*i);
+    }
+    for(int i = 0; i < batch.prefix_size; ++i) {
+        batch.fixed_size += lsh_argument_size(batch.prefix[i]);
+    }
+    for(int i = 0; i < batch.suffix_size; ++i) {
+        batch.fixed_size += lsh_argument_size(batch.suffix[i]);
+    }
+
+    bool result = true;
+    if(process->batch_word != NULL) {
+        result = lsh_batch_push_expansion(shell, &batch, process->batch_word);
+    } else {
+        for(int i = process->batch_index; result && i < argc; ++i) {
+            result = lsh_batch_push(&batch, process->args[i]);
+        }
+    }
+
+    if(!result) {
+        batch.status = 1;
+    } else if(batch.words.size > 0 || batch.executions == 0) {
+        lsh_batch_execute(&batch);
+    }
+
+    lsh_free_tagged(MEMORY_PARSER, batch.words.values);
+    lsh_arena_free(&batch.arena);
+    return batch.status;
+}
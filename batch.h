@@ -0,0 +1,16 @@
+#pragma once
+
+#include <jobs.h>
+#include <shell.h>
+
+// lsh_run_batches
+// Run a batched process xargs-style. The arguments of the process are split
+// into several executions that each fit within ARG_MAX. Lazily expanded words
+// are generated as the batches are filled, therefore at most one batch worth
+// of arguments is held in memory at a time. Called in the child process that
+// stands for the process in the job.
+//
+// Returns:
+// The exit status of the last failed execution or 0.
+//
+int lsh_run_batches(Shell* shell, Process const* process);
@@ -0,0 +1,419 @@
+#include <brace.h>
+
+#include <expand.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum Brace_Node_Kind {
+    BRACE_LITERAL,
+    BRACE_SEQUENCE,
+    BRACE_ALTERNATION,
+    BRACE_RANGE,
+} Brace_Node_Kind;
+
+typedef struct Brace_Node {
+    Brace_Node_Kind kind;
+    struct Brace_Node* next;
+    // BRACE_LITERAL
+    char const* begin;
+    char const* end;
+    // BRACE_SEQUENCE and BRACE_ALTERNATION
+    struct Brace_Node* first_child;
+    struct Brace_Node* current_child;
+    // BRACE_RANGE
+    long first;
+    long last;
+    long step;
+    long current;
+    int width;
+    bool letters;
+} Brace_Node;
+
+struct Brace_Expansion {
+    Arena arena;
+    Brace_Node* root;
+    char* buffer;
+    int size;
+    int capacity;
+    bool started;
+};
+
+// lsh_brace_skip_unit
+// Skip a quoted string, a substitution or a single character.
+//
+static char const* lsh_brace_skip_unit(char const* const begin,
+                                       char const* const end) {
+    char const* next = begin + 1;
+    if(*begin == '\'' || *begin == '"') {
+        next = memchr(begin + 1, *begin, end - begin - 1);
+        next = (next != NULL ? next + 1 : end);
+    } else if(*begin == '`' ||
+              (*begin == '$' && begin + 1 != end && begin[1] == '(')) {
+        next = lsh_skip_substitution(begin);
+    } else if(*begin == '$' && begin + 1 != end && begin[1] == '{') {
+        next = lsh_skip_parameter(begin);
+    }
+    return (next == NULL || next > end) ? end : next;
+}
+
+// lsh_brace_find_close
+// Find the brace closing the one at begin.
+//
+// Parameters:
+// has_comma - receives whether the braces contain a top-level comma.
+//
+// Returns:
+// Pointer to the closing brace or NULL.
+//
+static char const* lsh_brace_find_close(char const* begin,
+                                        char const* const end,
+                                        bool* const has_comma) {
+    int depth = 0;
+    *has_comma = false;
+    while(begin != end) {
+        if(*begin == '{') {
+            depth += 1;
+        } else if(*begin == '}') {
+            depth -= 1;
+            if(depth == 0) {
+                return begin;
+            }
+        } else if(*begin == ',' && depth == 1) {
+            *has_comma = true;
+        }
+        begin = lsh_brace_skip_unit(begin, end);
+    }
+    return NULL;
+}
+
+static Brace_Node* lsh_brace_node(Brace_Expansion* const expansion,
+                                  Brace_Node_Kind const kind) {
+    Brace_Node* const node = lsh_arena_alloc(&expansion->arena,
+                                             sizeof(Brace_Node));
+    memset(node, 0, sizeof(Brace_Node));
+    node->kind = kind;
+    return node;
+}
+
+static bool lsh_parse_long(char const* begin, char const* const end,
+                           long* const value, int* const width) {
+    char const* const start = begin;
+    bool negative = false;
+    if(begin != end && *begin == '-') {
+        negative = true;
+        ++begin;
+    }
+
+    if(begin == end) {
+        return false;
+    }
+
+    // A leading zero requests zero-padding to the width of the bound.
+    bool const padded = (*begin == '0' && begin + 1 != end);
+    long result = 0;
+    for(; begin != end; ++begin) {
+        if(*begin < '0' || *begin > '9') {
+            return false;
+        }
+        result = result * 10 + (*begin - '0');
+    }
+    *value = negative ? -result : result;
+    *width = padded ? (int)(end - start) : 0;
+    return true;
+}
+
+static bool lsh_is_letter(char const c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// lsh_parse_range
+// Parse x..y or x..y..step where x and y are both integers or both letters.
+//
+static Brace_Node* lsh_parse_range(Brace_Expansion* const expansion,
+                                   char const* const begin,
+                                   char const* const end) {
+    char const* const dots = strstr(begin, "..");
+    if(dots == NULL || dots >= end) {
+        return NULL;
+    }
+
+    char const* last_end = end;
+    char const* step_dots = strstr(dots + 2, "..");
+    if(step_dots != NULL && step_dots < end) {
+        last_end = step_dots;
+    } else {
+        step_dots = NULL;
+    }
+
+    long step = 1;
+    int step_width = 0;
+    if(step_dots != NULL &&
+       (!lsh_parse_long(step_dots + 2, end, &step, &step_width) ||
+        step == 0)) {
+        return NULL;
+    }
+    step = (step < 0 ? -step : step);
+
+    Brace_Node* const node = lsh_brace_node(expansion, BRACE_RANGE);
+    int first_width = 0;
+    int last_width = 0;
+    if(lsh_parse_long(begin, dots, &node->first, &first_width) &&
+       lsh_parse_long(dots + 2, last_end, &node->last, &last_width)) {
+        node->width = (first_width > last_width ? first_width : last_width);
+    } else if(dots - begin == 1 && last_end - dots == 3 &&
+              lsh_is_letter(*begin) && lsh_is_letter(dots[2])) {
+        node->first = *begin;
+        node->last = dots[2];
+        node->letters = true;
+    } else {
+        return NULL;
+    }
+
+    node->step = (node->first <= node->last ? step : -step);
+    node->current = node->first;
+    return node;
+}
+
+static Brace_Node* lsh_parse_sequence(Brace_Expansion* expansion,
+                                      char const* begin, char const* end,
+                                      bool* found);
+
+// lsh_parse_braces
+// Parse the braces at begin.
+//
+// Returns:
+// The alternation or range node or NULL if the braces are literal.
+//
+static Brace_Node* lsh_parse_braces(Brace_Expansion* const expansion,
+                                    char const* const begin,
+                                    char const* const close,
+                                    bool const has_comma) {
+    if(!has_comma) {
+        return lsh_parse_range(expansion, begin + 1, close);
+    }
+
+    Brace_Node* const node = lsh_brace_node(expansion, BRACE_ALTERNATION);
+    Brace_Node* last = NULL;
+    char const* alternative = begin + 1;
+    int depth = 0;
+    for(char const* i = begin + 1;; i = lsh_brace_skip_unit(i, close)) {
+        if(i == close || (*i == ',' && depth == 0)) {
+            bool found = false;
+            Brace_Node* const child =
+                lsh_parse_sequence(expansion, alternative, i, &found);
+            if(last == NULL) {
+                node->first_child = child;
+            } else {
+                last->next = child;
+            }
+            last = child;
+            alternative = i + 1;
+            if(i == close) {
+                break;
+            }
+        } else if(*i == '{') {
+            depth += 1;
+        } else if(*i == '}') {
+            depth -= 1;
+        }
+    }
+    node->current_child = node->first_child;
+    return node;
+}
+
+static Brace_Node* lsh_parse_sequence(Brace_Expansion* const expansion,
+                                      char const* begin,
+                                      char const* const end,
+                                      bool* const found) {
+    Brace_Node* const sequence = lsh_brace_node(expansion, BRACE_SEQUENCE);
+    Brace_Node* last = NULL;
+    char const* literal = begin;
+    while(true) {
+        Brace_Node* braces = NULL;
+        char const* close = NULL;
+        if(begin != end && *begin == '{') {
+            bool has_comma = false;
+            close = lsh_brace_find_close(begin, end, &has_comma);
+            if(close != NULL) {
+                braces = lsh_parse_braces(expansion, begin, close, has_comma);
+            }
+        }
+
+        if(begin == end || braces != NULL) {
+            if(literal != begin) {
+                Brace_Node* const node =
+                    lsh_brace_node(expansion, BRACE_LITERAL);
+                node->begin = literal;
+                node->end = begin;
+                if(last == NULL) {
+                    sequence->first_child = node;
+                } else {
+                    last->next = node;
+                }
+                last = node;
+            }
+
+            if(begin == end) {
+                break;
+            }
+
+            if(last == NULL) {
+                sequence->first_child = braces;
+            } else {
+                last->next = braces;
+            }
+            last = braces;
+            *found = true;
+            begin = close + 1;
+            literal = begin;
+        } else {
+            begin = lsh_brace_skip_unit(begin, end);
+        }
+    }
+    return sequence;
+}
+
+Brace_Expansion* lsh_brace_parse(char const* const begin,
+                                 char const* const end) {
+    if(memchr(begin, '{', end - begin) == NULL) {
+        return NULL;
+    }
+
+    Brace_Expansion* const expansion =
+        lsh_alloc_tagged(MEMORY_PARSER, sizeof(Brace_Expansion));
+    expansion->arena.tag = MEMORY_PARSER;
+    bool found = false;
+    expansion->root = lsh_parse_sequence(expansion, begin, end, &found);
+    if(!found) {
+        lsh_brace_free(expansion);
+        return NULL;
+    }
+    return expansion;
+}
+
+static bool lsh_advance_node(Brace_Node* node);
+
+// lsh_advance_list
+// Advance the nodes as an odometer with the last node changing fastest.
+//
+// Returns:
+// true if every node wrapped around.
+//
+static bool lsh_advance_list(Brace_Node* const node) {
+    if(node == NULL) {
+        return true;
+    }
+
+    if(!lsh_advance_list(node->next)) {
+        return false;
+    }
+    return lsh_advance_node(node);
+}
+
+// lsh_advance_node
+// Move the node to its next value. A node that runs out of values resets to
+// its first value.
+//
+// Returns:
+// true if the node wrapped around.
+//
+static bool lsh_advance_node(Brace_Node* const node) {
+    switch(node->kind) {
+        case BRACE_LITERAL:
+            return true;
+        case BRACE_SEQUENCE:
+            return lsh_advance_list(node->first_child);
+        case BRACE_ALTERNATION:
+            if(!lsh_advance_node(node->current_child)) {
+                return false;
+            }
+            node->current_child = node->current_child->next;
+            if(node->current_child == NULL) {
+                node->current_child = node->first_child;
+                return true;
+            }
+            return false;
+        case BRACE_RANGE:
+            node->current += node->step;
+            if((node->step > 0 && node->current > node->last) ||
+               (node->step < 0 && node->current < node->last)) {
+                node->current = node->first;
+                return true;
+            }
+            return false;
+    }
+    return true;
+}
+
+static void lsh_brace_append(Brace_Expansion* const expansion,
+                             char const* const begin, int const size) {
+    if(expansion->size + size >= expansion->capacity) {
+        while(expansion->size + size >= expansion->capacity) {
+            expansion->capacity =
+                (expansion->capacity == 0 ? 128 : expansion->capacity * 2);
+        }
+        expansion->buffer = lsh_realloc_tagged(MEMORY_PARSER, expansion->buffer,
+                                               expansion->capacity);
+        if(!expansion->buffer) {
+            fprintf(stderr, "brace_next: allocation failure");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memcpy(expansion->buffer + expansion->size, begin, size);
+    expansion->size += size;
+    expansion->buffer[expansion->size] = '\0';
+}
+
+static void lsh_render_node(Brace_Expansion* const expansion,
+                            Brace_Node const* const node) {
+    switch(node->kind) {
+        case BRACE_LITERAL:
+            lsh_brace_append(expansion, node->begin, node->end - node->begin);
+            break;
+        case BRACE_SEQUENCE:
+            for(Brace_Node const* child = node->first_child; child != NULL;
+                child = child->next) {
+                lsh_render_node(expansion, child);
+            }
+            break;
+        case BRACE_ALTERNATION:
+            lsh_render_node(expansion, node->current_child);
+            break;
+        case BRACE_RANGE: {
+            char value[32];
+            int size = 0;
+            if(node->letters) {
+                value[0] = (char)node->current;
+                size = 1;
+            } else {
+                size = snprintf(value, sizeof(value), "%0*ld", node->width,
+                                node->current);
+            }
+            lsh_brace_append(expansion, value, size);
+        } break;
+    }
+}
+
+bool lsh_brace_next(Brace_Expansion* const expansion,
+                    char const** const begin, char const** const end) {
+    if(expansion->started && lsh_advance_node(expansion->root)) {
+        return false;
+    }
+
+    expansion->started = true;
+    expansion->size = 0;
+    lsh_brace_append(expansion, "", 0);
+    lsh_render_node(expansion, expansion->root);
+    *begin = expansion->buffer;
+    *end = expansion->buffer + expansion->size;
+    return true;
+}
+
+void lsh_brace_free(Brace_Expansion* const expansion) {
+    lsh_arena_free(&expansion->arena);
+    lsh_free_tagged(MEMORY_PARSER, expansion->buffer);
+    lsh_free_tagged(MEMORY_PARSER, expansion);
+}
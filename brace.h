@@ -0,0 +1,31 @@
+#pragma once
+
+#include <common.h>
+
+typedef struct Brace_Expansion Brace_Expansion;
+
+// lsh_brace_parse
+// Parse the brace expansions ({a,b} alternatives and {1..10} or {a..z}
+// sequences) of a single word. Quoted braces and braces inside substitutions
+// are not expanded.
+//
+// Returns:
+// The expansion or NULL if the word does not contain any.
+//
+Brace_Expansion* lsh_brace_parse(char const* begin, char const* end);
+
+// lsh_brace_next
+// Produce the next word of the expansion. Words are generated lazily one at a
+// time, therefore memory use does not depend on the number of words.
+//
+// Parameters:
+// begin, end - receive the word. The word is null-terminated and valid until
+//              the next call.
+//
+// Returns:
+// false once the expansion is exhausted.
+//
+bool lsh_brace_next(Brace_Expansion* expansion, char const** begin,
+                    char const** end);
+
+void lsh_brace_free(Brace_Expansion* expansion);
@@ -1,18 +1,72 @@
 #include <builtin.h>
 
+#include <capture.h>
+#include <control.h>
+#include <history.h>
 #include <jobs.h>
+#include <placement.h>
+#include <plans.h>
+#include <vars.h>
+#include <zygote.h>
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+// lsh_builtin_exit
+// A subshell leaves with _exit like any forked child, because exit would
+// rewind the shared offset of a script that the shell is still reading.
+//
 static int lsh_builtin_exit(Shell* const shell, char** const args,
                             Descriptors const fd) {
-    UNUSED(args);
-    UNUSED(shell);
     UNUSED(fd);
-    exit(EXIT_SUCCESS);
+    int const status = (args[1] != NULL ? atoi(args[1]) : EXIT_SUCCESS);
+    if(getpid() != shell->pid) {
+        fflush(NULL);
+        _exit(status);
+    }
+    exit(status);
+}
+
+// lsh_builtin_exec
+// exec [COMMAND [ARGS...]]: replace the shell with the command. Without a
+// command the redirects apply to the shell itself and remain in effect for
+// the commands that follow. Should the command fail to execute, the standard
+// descriptors of the shell are restored.
+//
+static int lsh_builtin_exec(Shell* const shell, char** const args,
+                            Descriptors const fd) {
+    UNUSED(shell);
+    if(args[1] == NULL) {
+        return (lsh_redirect_shell(fd) ? 0 : 1);
+    }
+
+    int saved[3];
+    for(int std = STDIN_FILENO; std <= STDERR_FILENO; ++std) {
+        saved[std] = fcntl(std, F_DUPFD_CLOEXEC, LSH_USER_FD_LIMIT);
+    }
+
+    int error = 0;
+    if(lsh_redirect_shell(fd)) {
+        lsh_exec_program(args + 1);
+        error = errno;
+    }
+
+    for(int std = STDIN_FILENO; std <= STDERR_FILENO; ++std) {
+        if(saved[std] >= 0) {
+            dup2(saved[std], std);
+            close(saved[std]);
+        }
+    }
+
+    if(error == 0) {
+        return 1;
+    }
+    dprintf(fd.err, "exec: %s: %s\n", args[1], strerror(error));
+    return (error == ENOENT ? 127 : 126);
 }
 
 static int lsh_builtin_cd(Shell* const shell, char** const args,
@@ -34,13 +88,13 @@ static int lsh_builtin_jobs(Shell* const shell, char** const args,
                             Descriptors const fd) {
     UNUSED(args);
     UNUSED(shell);
-    Job* const current_job = lsh_get_current_job();
     Job_List* const job_list = lsh_get_primary_job_list();
     for(Job_List_Entry *b = lsh_job_list_begin(job_list),
                        *e = lsh_job_list_end(job_list);
         b != e; b = lsh_job_list_next(b)) {
         Job* job = lsh_job_list_value(b);
-        if(job == current_job) {
+        // Skip the jobs of builtins, among them this one.
+        if(job->pgid == 0) {
             continue;
         }
 
@@ -95,11 +149,458 @@ static int lsh_builtin_bg(Shell* const shell, char** const args,
     return 0;
 }
 
+static int lsh_builtin_export(Shell* const shell, char** const args,
+                              Descriptors const fd) {
+    UNUSED(shell);
+    if(args[1] == NULL) {
+        for(char** i = lsh_get_envp(); *i != NULL; ++i) {
+            dprintf(fd.out, "export %s\n", *i);
+        }
+        return 0;
+    }
+
+    int status = 0;
+    for(char** i = args + 1; *i != NULL; ++i) {
+        if(strchr(*i, '=') != NULL) {
+            if(!lsh_assign_variable(*i, true)) {
+                dprintf(fd.err, "export: invalid assignment %s\n", *i);
+                status = 1;
+            }
+        } else if(lsh_is_variable_name(*i, *i + strlen(*i))) {
+            lsh_export_variable(*i);
+        } else {
+            dprintf(fd.err, "export: invalid variable name %s\n", *i);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+static int lsh_builtin_unset(Shell* const shell, char** const args,
+                             Descriptors const fd) {
+    UNUSED(shell);
+    UNUSED(fd);
+    for(char** i = args + 1; *i != NULL; ++i) {
+        lsh_unset_variable(*i);
+    }
+    return 0;
+}
+
+static void lsh_print_history_entry(int const fd, int const index) {
+    int size = 0;
+    char const* const entry = lsh_history_entry(index, &size);
+    dprintf(fd, "%5d  %.*s\n", index + 1, size, entry);
+}
+
+static int lsh_builtin_history(Shell* const shell, char** const args,
+                               Descriptors const fd) {
+    UNUSED(shell);
+    int const size = lsh_history_size();
+    int first = 0;
+    if(args[1] != NULL) {
+        int const count = atoi(args[1]);
+        if(count < 0) {
+            dprintf(fd.err, "history: invalid count %s\n", args[1]);
+            return 1;
+        }
+        first = (count < size ? size - count : 0);
+    }
+
+    for(int i = first; i < size; ++i) {
+        lsh_print_history_entry(fd.out, i);
+    }
+    return 0;
+}
+
+static int lsh_builtin_hsearch(Shell* const shell, char** const args,
+                               Descriptors const fd) {
+    UNUSED(shell);
+    bool prefix = false;
+    char** text = args + 1;
+    if(*text != NULL && strcmp(*text, "-p") == 0) {
+        prefix = true;
+        ++text;
+    }
+
+    if(*text == NULL) {
+        dprintf(fd.err, "hsearch: expected argument\n");
+        return 1;
+    }
+
+    int count = 0;
+    int* const matches = lsh_history_search(*text, prefix, &count);
+    for(int i = 0; i < count; ++i) {
+        lsh_print_history_entry(fd.out, matches[i]);
+    }
+    free(matches);
+    return count > 0 ? 0 : 1;
+}
+
+// lsh_builtin_timeout
+// The job consumes a valid leading timeout and runs the command with a
+// deadline, therefore only a misused timeout reaches the builtin.
+//
+static int lsh_builtin_timeout(Shell* const shell, char** const args,
+                               Descriptors const fd) {
+    UNUSED(shell);
+    Job_Timeout timeout;
+    if(lsh_parse_timeout(args, &timeout, fd.err) < 0) {
+        return 1;
+    }
+
+    dprintf(fd.err, "timeout: expected command\n");
+    return 1;
+}
+
+// lsh_builtin_place
+// The job consumes a valid leading place and runs the command with the
+// placement, therefore a place without a command sets the placement of the
+// following jobs.
+//
+static int lsh_builtin_place(Shell* const shell, char** const args,
+                             Descriptors const fd) {
+    UNUSED(shell);
+    Placement* const defaults = lsh_get_default_placement();
+    if(args[1] == NULL) {
+        lsh_print_placement(defaults, fd.out);
+        return 0;
+    }
+
+    if(strcmp(args[1], "-u") == 0 && args[2] == NULL) {
+        *defaults = (Placement){0};
+        return 0;
+    }
+
+    Placement placement;
+    if(lsh_parse_placement(args, &placement, fd.err) < 0) {
+        return 1;
+    }
+
+    lsh_merge_placement(defaults, &placement);
+    return 0;
+}
+
+// lsh_builtin_capture
+// The job consumes a valid leading capture and captures the output of the
+// command, therefore only a misused capture reaches the builtin.
+//
+static int lsh_builtin_capture(Shell* const shell, char** const args,
+                               Descriptors const fd) {
+    UNUSED(shell);
+    size_t size;
+    if(lsh_parse_capture(args, &size, fd.err) < 0) {
+        return 1;
+    }
+
+    dprintf(fd.err, "capture: expected command\n");
+    return 1;
+}
+
+// lsh_builtin_coproc
+// The job consumes a leading coproc followed by a command, therefore only a
+// coproc without one reaches the builtin.
+//
+static int lsh_builtin_coproc(Shell* const shell, char** const args,
+                              Descriptors const fd) {
+    UNUSED(shell);
+    UNUSED(args);
+    dprintf(fd.err, "coproc: expected command\n");
+    return 1;
+}
+
+// lsh_builtin_read
+// read NAME: read a line of the standard input into the variable. The line is
+// read a byte at a time, so that the input after it is left to the next
+// reader, as the output of a coprocess that is read line by line must be.
+//
+// Returns:
+// 1 at the end of the input if no line was read.
+//
+static int lsh_builtin_read(Shell* const shell, char** const args,
+                            Descriptors const fd) {
+    UNUSED(shell);
+    if(args[1] == NULL ||
+       !lsh_is_variable_name(args[1], args[1] + strlen(args[1]))) {
+        dprintf(fd.err, "read: expected variable name\n");
+        return 1;
+    }
+
+    size_t size = 0;
+    size_t capacity = 64;
+    char* line = malloc(capacity);
+    if(!line) {
+        fprintf(stderr, "builtin_read: allocation failure");
+        exit(EXIT_FAILURE);
+    }
+
+    ssize_t result = 0;
+    char c = '\0';
+    while((result = read(fd.in, &c, 1)) > 0 || (result < 0 && errno == EINTR)) {
+        if(result < 0) {
+            continue;
+        }
+        if(c == '\n') {
+            break;
+        }
+
+        if(size + 1 == capacity) {
+            capacity *= 2;
+            line = realloc(line, capacity);
+            if(!line) {
+                fprintf(stderr, "builtin_read: allocation failure");
+                exit(EXIT_FAILURE);
+            }
+        }
+        line[size++] = c;
+    }
+    line[size] = '\0';
+
+    lsh_set_variable(args[1], line);
+    free(line);
+    return (result > 0 || size > 0 ? 0 : 1);
+}
+
+static int lsh_builtin_output(Shell* const shell, char** const args,
+                              Descriptors const fd) {
+    UNUSED(shell);
+    int lines = 0;
+    char** rest = args + 1;
+    if(rest[0] != NULL && strcmp(rest[0], "-n") == 0) {
+        if(rest[1] == NULL || (lines = atoi(rest[1])) <= 0) {
+            dprintf(fd.err, "output: invalid line count\n");
+            return 1;
+        }
+        rest += 2;
+    }
+
+    if(rest[0] == NULL) {
+        if(lines > 0) {
+            dprintf(fd.err, "output: expected job id\n");
+            return 1;
+        }
+        lsh_print_captures(fd.out);
+        return 0;
+    }
+
+    int const id = atoi(rest[0]);
+    Capture const* const capture = lsh_find_capture(id);
+    if(capture == NULL) {
+        dprintf(fd.err, "output: no output of job %d captured\n", id);
+        return 1;
+    }
+    return (lsh_capture_write(capture, lines, fd.out) ? 0 : 1);
+}
+
+static int lsh_builtin_save(Shell* const shell, char** const args,
+                            Descriptors const fd) {
+    UNUSED(shell);
+    if(args[1] == NULL || args[2] == NULL) {
+        dprintf(fd.err, "save: expected job id and file\n");
+        return 1;
+    }
+
+    int const id = atoi(args[1]);
+    Capture const* const capture = lsh_find_capture(id);
+    if(capture == NULL) {
+        dprintf(fd.err, "save: no output of job %d captured\n", id);
+        return 1;
+    }
+
+    int const file =
+        open(args[2], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(file < 0) {
+        dprintf(fd.err, "save: could not open %s\n", args[2]);
+        return 1;
+    }
+
+    bool const written = lsh_capture_write(capture, 0, file);
+    if(close(file) != 0 || !written) {
+        dprintf(fd.err, "save: could not write %s\n", args[2]);
+        return 1;
+    }
+    return 0;
+}
+
+static int lsh_builtin_affinity(Shell* const shell, char** const args,
+                                Descriptors const fd) {
+    UNUSED(shell);
+    if(args[1] == NULL) {
+        dprintf(fd.err, "affinity: expected job id\n");
+        return 1;
+    }
+
+    int const id = atoi(args[1]);
+    Job* const job = lsh_find_job_with_id(lsh_get_primary_job_list(), id);
+    if(job == NULL) {
+        dprintf(fd.err, "affinity: job with id %d not found\n", id);
+        return 1;
+    }
+
+    if(args[2] == NULL) {
+        for(int i = 0; i < job->process_count; ++i) {
+            Process const* const process = &job->processes[i];
+            cpu_set_t set;
+            if(process->pid == 0 || process->status == PROCESS_COMPLETED ||
+               process->status == PROCESS_TERMINATED ||
+               sched_getaffinity(process->pid, sizeof(set), &set) != 0) {
+                continue;
+            }
+
+            dprintf(fd.out, "%d %s: ", (int)process->pid,
+                    (process->group != NULL ? "(group)" : process->args[0]));
+            lsh_print_cpu_list(&set, fd.out);
+            dprintf(fd.out, "\n");
+        }
+        return 0;
+    }
+
+    cpu_set_t set;
+    if(!lsh_parse_cpu_list(args[2], &set) || CPU_COUNT(&set) == 0) {
+        dprintf(fd.err, "affinity: invalid cpu list %s\n", args[2]);
+        return 1;
+    }
+
+    int status = 0;
+    job->placement.has_affinity = true;
+    job->placement.affinity = set;
+    for(int i = 0; i < job->process_count; ++i) {
+        Process* const process = &job->processes[i];
+        process->placement.has_affinity = true;
+        process->placement.affinity = set;
+        if(process->pid == 0 || process->status == PROCESS_COMPLETED ||
+           process->status == PROCESS_TERMINATED) {
+            continue;
+        }
+
+        if(lsh_set_process_affinity(process->pid, &set) != 0) {
+            dprintf(fd.err, "affinity: could not set the affinity of %d\n",
+                    (int)process->pid);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+static int lsh_builtin_pools(Shell* const shell, char** const args,
+                             Descriptors const fd) {
+    UNUSED(shell);
+    UNUSED(args);
+    lsh_print_pool_statistics(fd.out);
+    return 0;
+}
+
+static int lsh_builtin_memstats(Shell* const shell, char** const args,
+                                Descriptors const fd) {
+    UNUSED(shell);
+    UNUSED(args);
+    lsh_print_memory_statistics(fd.out);
+    return 0;
+}
+
+static int lsh_builtin_plans(Shell* const shell, char** const args,
+                             Descriptors const fd) {
+    UNUSED(shell);
+    if(args[1] == NULL) {
+        lsh_print_plan_statistics(fd.out);
+        return 0;
+    }
+
+    if(strcmp(args[1], "-c") == 0) {
+        lsh_clear_plans();
+        return 0;
+    }
+
+    dprintf(fd.err, "plans: unknown option %s\n", args[1]);
+    return 1;
+}
+
+static int lsh_builtin_control(Shell* const shell, char** const args,
+                               Descriptors const fd) {
+    UNUSED(shell);
+    if(args[1] == NULL) {
+        char const* const path = lsh_control_path();
+        if(path == NULL) {
+            dprintf(fd.err, "control: not listening\n");
+            return 1;
+        }
+        dprintf(fd.out, "%s\n", path);
+        return 0;
+    }
+
+    if(strcmp(args[1], "-d") == 0) {
+        lsh_control_close();
+        return 0;
+    }
+
+    return (lsh_control_open(args[1], fd.err) ? 0 : 1);
+}
+
+static int lsh_builtin_zygote(Shell* const shell, char** const args,
+                              Descriptors const fd) {
+    UNUSED(shell);
+    if(args[1] == NULL) {
+        dprintf(fd.out, "zygote %s\n", (lsh_zygote_running() ? "on" : "off"));
+        return 0;
+    }
+
+    if(strcmp(args[1], "on") == 0) {
+        return (lsh_zygote_start(fd.err) ? 0 : 1);
+    } else if(strcmp(args[1], "off") == 0) {
+        lsh_zygote_stop();
+        return 0;
+    } else if(strcmp(args[1], "bench") == 0) {
+        int count = 200;
+        char** sizes = args + 2;
+        if(sizes[0] != NULL && strcmp(sizes[0], "-n") == 0 &&
+           sizes[1] != NULL) {
+            count = atoi(sizes[1]);
+            sizes += 2;
+        }
+
+        int heap_sizes[16] = {0, 64, 512};
+        int heap_count = 3;
+        if(sizes[0] != NULL) {
+            heap_count = 0;
+            for(; sizes[heap_count] != NULL && heap_count < 16; ++heap_count) {
+                heap_sizes[heap_count] = atoi(sizes[heap_count]);
+            }
+        }
+
+        if(count <= 0) {
+            dprintf(fd.err, "zygote: invalid count\n");
+            return 1;
+        }
+        lsh_zygote_benchmark(count, heap_sizes, heap_count, fd.out);
+        return 0;
+    }
+
+    dprintf(fd.err, "zygote: expected on, off or bench\n");
+    return 1;
+}
+
 static Builtin_Fn const builtin_fns[] = {{"exit", lsh_builtin_exit},
+                                         {"exec", lsh_builtin_exec},
                                          {"cd", lsh_builtin_cd},
                                          {"jobs", lsh_builtin_jobs},
                                          {"fg", lsh_builtin_fg},
-                                         {"bg", lsh_builtin_bg}};
+                                         {"bg", lsh_builtin_bg},
+                                         {"export", lsh_builtin_export},
+                                         {"unset", lsh_builtin_unset},
+                                         {"history", lsh_builtin_history},
+                                         {"hsearch", lsh_builtin_hsearch},
+                                         {"timeout", lsh_builtin_timeout},
+                                         {"place", lsh_builtin_place},
+                                         {"capture", lsh_builtin_capture},
+                                         {"coproc", lsh_builtin_coproc},
+                                         {"read", lsh_builtin_read},
+                                         {"output", lsh_builtin_output},
+                                         {"save", lsh_builtin_save},
+                                         {"affinity", lsh_builtin_affinity},
+                                         {"pools", lsh_builtin_pools},
+                                         {"plans", lsh_builtin_plans},
+                                         {"memstats", lsh_builtin_memstats},
+                                         {"control", lsh_builtin_control},
+                                         {"zygote", lsh_builtin_zygote}};
 
 Builtin_Fn const* lsh_find_builtin(char const* const name) {
     for(Builtin_Fn const *
@@ -113,3 +614,8 @@ Builtin_Fn const* lsh_find_builtin(char const* const name) {
 
     return NULL;
 }
+
+Builtin_Fn const* lsh_get_builtins(int* const count) {
+    *count = sizeof(builtin_fns) / sizeof(Builtin_Fn);
+    return builtin_fns;
+}
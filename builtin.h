@@ -11,3 +11,12 @@ typedef struct Builtin_Fn {
 } Builtin_Fn;
 
 Builtin_Fn const* lsh_find_builtin(char const* name);
+
+// lsh_get_builtins
+// Parameters:
+// count - receives the number of builtins.
+//
+// Returns:
+// All builtins.
+//
+Builtin_Fn const* lsh_get_builtins(int* count);
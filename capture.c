@@ -0,0 +1,285 @@
+#include <capture.h>
+
+#include <events.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+// Closed captures beyond this number are discarded, the oldest first.
+#define LSH_MAX_CAPTURES 64
+#define LSH_CAPTURE_MIN_SIZE 1024
+
+struct Capture {
+    // Older captures follow.
+    struct Capture* next;
+    int job_id;
+    char* command;
+    // Read end of the pipe or -1 once every writer has closed it.
+    int pipe_fd;
+    int memfd;
+    size_t size;
+    // Offset in the memfd at which the next output is written.
+    size_t head;
+    // Number of bytes captured, including those that have been overwritten.
+    uint64_t total;
+};
+
+static Capture* captures = NULL;
+
+int lsh_parse_capture(char** const args, size_t* const size,
+                      int const fd_err) {
+    *size = LSH_CAPTURE_DEFAULT_SIZE;
+    if(args[1] == NULL || strcmp(args[1], "-s") != 0) {
+        return 1;
+    }
+
+    if(args[2] == NULL) {
+        dprintf(fd_err, "capture: expected argument of -s\n");
+        return -1;
+    }
+
+    char* end = NULL;
+    errno = 0;
+    unsigned long long value = strtoull(args[2], &end, 10);
+    int shift = 0;
+    if(*end == 'K' || *end == 'k') {
+        shift = 10;
+    } else if(*end == 'M' || *end == 'm') {
+        shift = 20;
+    } else if(*end == 'G' || *end == 'g') {
+        shift = 30;
+    }
+    end += (shift != 0);
+
+    if(end == args[2] || *end != '\0' || errno != 0 ||
+       value > (SIZE_MAX >> shift) ||
+       (value << shift) < LSH_CAPTURE_MIN_SIZE) {
+        dprintf(fd_err, "capture: invalid size %s\n", args[2]);
+        return -1;
+    }
+
+    *size = value << shift;
+    return 3;
+}
+
+static void lsh_close_capture_pipe(Capture* const capture) {
+    lsh_remove_event_source(capture->pipe_fd);
+    close(capture->pipe_fd);
+    capture->pipe_fd = -1;
+}
+
+static void lsh_free_capture(Capture* const capture) {
+    if(capture->pipe_fd >= 0) {
+        lsh_close_capture_pipe(capture);
+    }
+    close(capture->memfd);
+    lsh_free_tagged(MEMORY_JOBS, capture->command);
+    lsh_free_tagged(MEMORY_JOBS, capture);
+}
+
+// lsh_drain_capture
+// Move the output in the pipe to the ring buffer without copying it through
+// the shell. At the end of the buffer the output wraps around and overwrites
+// the oldest output.
+//
+static void lsh_drain_capture(int const fd, uint32_t const events,
+                              void* const context) {
+    UNUSED(fd);
+    UNUSED(events);
+    Capture* const capture = context;
+    while(true) {
+        loff_t offset = capture->head;
+        ssize_t const moved =
+            splice(capture->pipe_fd, NULL, capture->memfd, &offset,
+                   capture->size - capture->head,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(moved > 0) {
+            capture->total += moved;
+            capture->head += moved;
+            if(capture->head == capture->size) {
+                capture->head = 0;
+            }
+        } else if(moved == 0) {
+            lsh_close_capture_pipe(capture);
+            return;
+        } else if(errno == EAGAIN) {
+            return;
+        } else if(errno != EINTR) {
+            perror("lsh_drain_capture: splice failed");
+            lsh_close_capture_pipe(capture);
+            return;
+        }
+    }
+}
+
+// lsh_discard_old_captures
+// Remove the capture of the job with the id and the oldest closed captures
+// beyond the limit.
+//
+static void lsh_discard_old_captures(int const job_id) {
+    int count = 0;
+    for(Capture** i = &captures; *i != NULL;) {
+        Capture* const capture = *i;
+        if(capture->job_id == job_id ||
+           (count >= LSH_MAX_CAPTURES - 1 && capture->pipe_fd < 0)) {
+            *i = capture->next;
+            lsh_free_capture(capture);
+        } else {
+            count += 1;
+            i = &capture->next;
+        }
+    }
+}
+
+int lsh_capture_open(int const job_id, char const* const command,
+                     size_t const size) {
+    int fd_pipe[2];
+    if(pipe2(fd_pipe, O_CLOEXEC) < 0) {
+        perror("lsh_capture_open: pipe failed");
+        return -1;
+    }
+
+    int const memfd = memfd_create("lsh-capture", MFD_CLOEXEC);
+    if(memfd < 0 || ftruncate(memfd, size) < 0 ||
+       fcntl(fd_pipe[0], F_SETFL, O_NONBLOCK) < 0) {
+        perror("lsh_capture_open: could not create the buffer");
+        if(memfd >= 0) {
+            close(memfd);
+        }
+        close(fd_pipe[0]);
+        close(fd_pipe[1]);
+        return -1;
+    }
+
+    lsh_discard_old_captures(job_id);
+    Capture* const capture = lsh_alloc_tagged(MEMORY_JOBS, sizeof(Capture));
+    *capture = (Capture){
+        .next = captures,
+        .job_id = job_id,
+        .command = lsh_allocate_from_slice(command,
+                                           command + strlen(command) + 1),
+        .pipe_fd = fd_pipe[0],
+        .memfd = memfd,
+        .size = size,
+    };
+    lsh_memory_track(MEMORY_JOBS, capture->command);
+    captures = capture;
+    lsh_add_event_source(capture->pipe_fd, EPOLLIN, lsh_drain_capture,
+                         capture);
+    return fd_pipe[1];
+}
+
+Capture* lsh_find_capture(int const job_id) {
+    for(Capture* capture = captures; capture != NULL;
+        capture = capture->next) {
+        if(capture->job_id == job_id) {
+            return capture;
+        }
+    }
+    return NULL;
+}
+
+void lsh_print_captures(int const fd_out) {
+    for(Capture const* capture = captures; capture != NULL;
+        capture = capture->next) {
+        uint64_t const dropped =
+            (capture->total > capture->size ? capture->total - capture->size
+                                            : 0);
+        dprintf(fd_out, "[%d] %-7s %llu bytes, %llu dropped, %zu buffer: %s\n",
+                capture->job_id,
+                (capture->pipe_fd >= 0 ? "open" : "closed"),
+                (unsigned long long)(capture->total - dropped),
+                (unsigned long long)dropped, capture->size, capture->command);
+    }
+}
+
+// lsh_send_range
+// Send a range of the memfd to the descriptor without copying it through the
+// shell. Descriptors that sendfile does not support, such as those opened for
+// appending, receive a copy.
+//
+static bool lsh_send_range(int const memfd, off_t offset, size_t length,
+                           int const fd_out) {
+    bool copy = false;
+    while(length > 0) {
+        ssize_t sent = -1;
+        if(!copy) {
+            sent = sendfile(fd_out, memfd, &offset, length);
+            if(sent < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                copy = true;
+                continue;
+            }
+        } else {
+            char buffer[BUFSIZ];
+            ssize_t const count = pread(
+                memfd, buffer, (length < BUFSIZ ? length : BUFSIZ), offset);
+            sent = (count > 0 ? write(fd_out, buffer, count) : count);
+            offset += (sent > 0 ? sent : 0);
+        }
+
+        if(sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if(sent <= 0) {
+            return false;
+        }
+        length -= sent;
+    }
+    return true;
+}
+
+// lsh_find_last_lines
+// Returns:
+// The offset from the oldest captured byte at which the last lines begin.
+//
+static size_t lsh_find_last_lines(Capture const* const capture,
+                                  size_t const start, size_t const length,
+                                  int const lines) {
+    char const* const buffer =
+        mmap(NULL, capture->size, PROT_READ, MAP_SHARED, capture->memfd, 0);
+    if(buffer == MAP_FAILED) {
+        return 0;
+    }
+
+    // A newline that ends the output does not begin another line.
+    int newlines = 0;
+    size_t i = length;
+    if(i > 0 && buffer[(start + i - 1) % capture->size] == '\n') {
+        i -= 1;
+    }
+    for(; i > 0; --i) {
+        if(buffer[(start + i - 1) % capture->size] == '\n') {
+            newlines += 1;
+            if(newlines == lines) {
+                break;
+            }
+        }
+    }
+    munmap((void*)buffer, capture->size);
+    return i;
+}
+
+bool lsh_capture_write(Capture const* const capture, int const lines,
+                       int const fd_out) {
+    // Once the buffer has wrapped around the oldest byte follows the newest.
+    bool const wrapped = capture->total >= capture->size;
+    size_t const start = (wrapped ? capture->head : 0);
+    size_t const length = (wrapped ? capture->size : capture->head);
+    size_t const skip =
+        (lines > 0 ? lsh_find_last_lines(capture, start, length, lines) : 0);
+
+    size_t const begin = (start + skip) % capture->size;
+    size_t const count = length - skip;
+    size_t const first = (begin + count > capture->size ? capture->size - begin
+                                                        : count);
+    return lsh_send_range(capture->memfd, begin, first, fd_out) &&
+           lsh_send_range(capture->memfd, 0, count - first, fd_out);
+}
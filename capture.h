@@ -0,0 +1,58 @@
+#pragma once
+
+#include <common.h>
+
+#define LSH_CAPTURE_DEFAULT_SIZE (1024 * 1024)
+
+typedef struct Capture Capture;
+
+// lsh_parse_capture
+// Parse the arguments of "capture [-s SIZE]". SIZE is in bytes and may carry
+// a K, M or G suffix.
+//
+// Parameters:
+// args - the arguments starting with "capture".
+// size - receives the size of the ring buffer.
+// fd_err - receives the error messages or -1 to discard them.
+//
+// Returns:
+// The number of arguments consumed or -1 if they are invalid.
+//
+int lsh_parse_capture(char** args, size_t* size, int fd_err);
+
+// lsh_capture_open
+// Capture the output of a job. The output is written to a pipe that the event
+// loop drains with splice into a memfd of size bytes, which is used as a ring
+// buffer and keeps the latest output. The capture outlives the job and
+// replaces an earlier capture of a job with the same id.
+//
+// Parameters:
+// command - copied to describe the capture.
+//
+// Returns:
+// The write end of the pipe, which the caller must close once the processes
+// of the job have been spawned, or -1 on failure.
+//
+int lsh_capture_open(int job_id, char const* command, size_t size);
+
+// lsh_find_capture
+// Returns:
+// The capture of the job with the id or NULL.
+//
+Capture* lsh_find_capture(int job_id);
+
+// lsh_print_captures
+// List the captures with their sizes and whether the job still writes.
+//
+void lsh_print_captures(int fd_out);
+
+// lsh_capture_write
+// Write the captured output in the order it was written.
+//
+// Parameters:
+// lines - the number of last lines to write or 0 to write everything.
+//
+// Returns:
+// Whether all of the output was written.
+//
+bool lsh_capture_write(Capture const* capture, int lines, int fd_out);
@@ -1,8 +1,13 @@
 #include <common.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 char* lsh_allocate_from_slice(char const* const begin, char const* const end) {
     char* memory = malloc(end - begin);
@@ -24,32 +29,442 @@ void* lsh_alloc_and_zero(unsigned int const size) {
     return memory;
 }
 
-int lsh_getline(char** out_buffer) {
-    int capacity = 0;
-    int size = 0;
-    char* buffer = NULL;
+#ifdef LSH_TRACK_MEMORY
+typedef struct Memory_Counters {
+    long allocations;
+    long frees;
+    // Live and highest live bytes.
+    long bytes;
+    long peak;
+} Memory_Counters;
+
+static Memory_Counters memory_counters[MEMORY_TAG_COUNT];
+// All tags together.
+static Memory_Counters memory_total;
+
+static void lsh_count_resize(Memory_Counters* const counters,
+                             long const change) {
+    counters->bytes += change;
+    if(counters->bytes > counters->peak) {
+        counters->peak = counters->bytes;
+    }
+}
+
+static void lsh_count_allocation(Memory_Counters* const counters,
+                                 size_t const size) {
+    counters->allocations += 1;
+    lsh_count_resize(counters, size);
+}
+
+static void lsh_count_free(Memory_Counters* const counters,
+                           size_t const size) {
+    counters->frees += 1;
+    counters->bytes -= size;
+}
+
+void lsh_memory_add(Memory_Tag const tag, size_t const size) {
+    lsh_count_allocation(&memory_counters[tag], size);
+    lsh_count_allocation(&memory_total, size);
+}
+
+void lsh_memory_remove(Memory_Tag const tag, size_t const size) {
+    lsh_count_free(&memory_counters[tag], size);
+    lsh_count_free(&memory_total, size);
+}
+
+void lsh_memory_track(Memory_Tag const tag, void* const memory) {
+    if(memory != NULL) {
+        lsh_memory_add(tag, malloc_usable_size(memory));
+    }
+}
+
+void lsh_memory_untrack(Memory_Tag const tag, void* const memory) {
+    if(memory != NULL) {
+        lsh_memory_remove(tag, malloc_usable_size(memory));
+    }
+}
+
+void* lsh_alloc_tagged(Memory_Tag const tag, size_t const size) {
+    void* const memory = calloc(1, size);
+    if(!memory) {
+        fprintf(stderr, "alloc_tagged: allocation failure");
+        exit(EXIT_FAILURE);
+    }
+    lsh_memory_track(tag, memory);
+    return memory;
+}
+
+void* lsh_realloc_tagged(Memory_Tag const tag, void* const memory,
+                         size_t const size) {
+    size_t const old_size = (memory != NULL ? malloc_usable_size(memory) : 0);
+    void* const result = realloc(memory, size);
+    if(result == NULL) {
+        return NULL;
+    }
+
+    if(memory == NULL) {
+        lsh_memory_track(tag, result);
+        return result;
+    }
+
+    // Growing a block is not another allocation.
+    long const change = (long)malloc_usable_size(result) - (long)old_size;
+    lsh_count_resize(&memory_counters[tag], change);
+    lsh_count_resize(&memory_total, change);
+    return result;
+}
+
+void lsh_free_tagged(Memory_Tag const tag, void* const memory) {
+    lsh_memory_untrack(tag, memory);
+    free(memory);
+}
+
+static void lsh_print_memory_counters(char const* const name,
+                                      Memory_Counters const* const counters,
+                                      int const fd_out) {
+    dprintf(fd_out, "%-10s %12ld %12ld %14ld %14ld\n", name,
+            counters->allocations, counters->frees, counters->bytes,
+            counters->peak);
+}
+#endif
+
+void lsh_print_memory_statistics(int const fd_out) {
+#ifdef LSH_TRACK_MEMORY
+    static char const* const names[MEMORY_TAG_COUNT] = {
+        [MEMORY_OTHER] = "other",     [MEMORY_PARSER] = "parser",
+        [MEMORY_JOBS] = "jobs",       [MEMORY_EDITOR] = "editor",
+        [MEMORY_HISTORY] = "history",
+    };
+    dprintf(fd_out, "%-10s %12s %12s %14s %14s\n", "tag", "allocations",
+            "frees", "bytes", "peak bytes");
+    for(int i = 0; i < MEMORY_TAG_COUNT; ++i) {
+        lsh_print_memory_counters(names[i], &memory_counters[i], fd_out);
+    }
+    lsh_print_memory_counters("total", &memory_total, fd_out);
+#else
+    dprintf(fd_out, "memory accounting not compiled in\n");
+#endif
+    // Everything else that the shell and libc hold.
+    struct mallinfo2 const info = mallinfo2();
+    dprintf(fd_out, "heap: %zu bytes in use, %zu bytes mapped\n",
+            info.uordblks + info.hblkhd, info.arena + info.hblkhd);
+}
+
+struct Arena_Block {
+    struct Arena_Block* next;
+    char* top;
+    char* end;
+    // Adopted mappings are released with munmap instead of free.
+    char* mapping;
+    size_t mapping_size;
+};
+
+#define LSH_ARENA_BLOCK_SIZE 4096
+#define LSH_ARENA_ALIGNMENT sizeof(void*)
+// Output larger than this is spilled into a memfd by lsh_arena_read_fd.
+#define LSH_ARENA_READ_INLINE_SIZE (64 * 1024)
+
+// lsh_arena_reserve
+// Obtain at least size bytes of contiguous free space at the top of the arena
+// without allocating them. The space is claimed with lsh_arena_commit.
+//
+static char* lsh_arena_reserve(Arena* const arena, size_t const size) {
+    Arena_Block* block = arena->blocks;
+    if(block == NULL || block->mapping != NULL ||
+       (size_t)(block->end - block->top) < size) {
+        size_t const capacity =
+            size > LSH_ARENA_BLOCK_SIZE ? size : LSH_ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(Arena_Block) + capacity);
+        if(!block) {
+            fprintf(stderr, "arena_reserve: allocation failure");
+            exit(EXIT_FAILURE);
+        }
+        lsh_memory_track(arena->tag, block);
+        block->top = (char*)(block + 1);
+        block->end = block->top + capacity;
+        block->mapping = NULL;
+        block->mapping_size = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    return block->top;
+}
+
+static void lsh_arena_commit(Arena* const arena, size_t const size) {
+    arena->blocks->top += size;
+}
+
+void* lsh_arena_alloc(Arena* const arena, size_t const size) {
+    size_t const aligned_size =
+        (size + LSH_ARENA_ALIGNMENT - 1) & ~(LSH_ARENA_ALIGNMENT - 1);
+    char* const memory = lsh_arena_reserve(arena, aligned_size);
+    lsh_arena_commit(arena, aligned_size);
+    return memory;
+}
+
+char* lsh_arena_alloc_from_slice(Arena* const arena, char const* const begin,
+                                 char const* const end) {
+    char* const memory = lsh_arena_reserve(arena, end - begin + 1);
+    memcpy(memory, begin, end - begin);
+    memory[end - begin] = '\0';
+    lsh_arena_commit(arena, end - begin + 1);
+    return memory;
+}
+
+static void lsh_arena_adopt_mapping(Arena* const arena, char* const mapping,
+                                    size_t const size) {
+    Arena_Block* const block = malloc(sizeof(Arena_Block));
+    if(!block) {
+        fprintf(stderr, "arena_adopt_mapping: allocation failure");
+        exit(EXIT_FAILURE);
+    }
+    lsh_memory_track(arena->tag, block);
+    lsh_memory_add(arena->tag, size);
+    // The mapping is never allocated from, therefore we keep it behind the
+    // block that is currently being filled.
+    block->top = mapping + size;
+    block->end = mapping + size;
+    block->mapping = mapping;
+    block->mapping_size = size;
+    if(arena->blocks != NULL) {
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+    } else {
+        block->next = NULL;
+        arena->blocks = block;
+    }
+}
+
+void lsh_arena_free(Arena* const arena) {
+    for(Arena_Block* block = arena->blocks; block != NULL;) {
+        Arena_Block* const next = block->next;
+        if(block->mapping != NULL) {
+            munmap(block->mapping, block->mapping_size);
+            lsh_memory_remove(arena->tag, block->mapping_size);
+        }
+        lsh_free_tagged(arena->tag, block);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
+
+struct Pool_Slab {
+    struct Pool_Slab* next;
+};
+
+// Slabs hold as many objects as fit in LSH_POOL_SLAB_SIZE but at least
+// LSH_POOL_MIN_OBJECTS.
+#define LSH_POOL_SLAB_SIZE (16 * 1024)
+#define LSH_POOL_MIN_OBJECTS 4
+
+void lsh_pool_initialise(Pool* const pool, char const* const name,
+                         Memory_Tag const tag, size_t const object_size) {
+    size_t const alignment = _Alignof(max_align_t);
+    // Free objects hold the link of the free list.
+    size_t size = object_size > sizeof(void*) ? object_size : sizeof(void*);
+    size = (size + alignment - 1) & ~(alignment - 1);
+    int const objects = LSH_POOL_SLAB_SIZE / size;
+    *pool = (Pool){
+        .name = name,
+        .tag = tag,
+        .object_size = size,
+        .objects_per_slab =
+            objects > LSH_POOL_MIN_OBJECTS ? objects : LSH_POOL_MIN_OBJECTS,
+    };
+}
+
+// lsh_pool_grow
+// Allocate a slab whose objects are then handed out in address order.
+//
+static void lsh_pool_grow(Pool* const pool) {
+    size_t const header =
+        (sizeof(Pool_Slab) + _Alignof(max_align_t) - 1) &
+        ~(_Alignof(max_align_t) - 1);
+    size_t const size = pool->object_size * pool->objects_per_slab;
+    char* const memory = malloc(header + size);
+    if(!memory) {
+        fprintf(stderr, "pool_grow: allocation failure");
+        exit(EXIT_FAILURE);
+    }
+    lsh_memory_track(pool->tag, memory);
+
+    Pool_Slab* const slab = (Pool_Slab*)memory;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->slab_count += 1;
+    pool->fresh = memory + header;
+    pool->fresh_end = memory + header + size;
+}
+
+void* lsh_pool_alloc(Pool* const pool) {
+    void* object = NULL;
+    if(pool->free_list != NULL) {
+        object = pool->free_list;
+        pool->free_list = *(void**)object;
+        pool->reuses += 1;
+    } else {
+        if(pool->fresh == pool->fresh_end) {
+            lsh_pool_grow(pool);
+        }
+        object = pool->fresh;
+        pool->fresh += pool->object_size;
+    }
+
+    pool->in_use += 1;
+    pool->allocations += 1;
+    memset(object, 0, pool->object_size);
+    return object;
+}
+
+void lsh_pool_free(Pool* const pool, void* const object) {
+    if(object == NULL) {
+        return;
+    }
+
+    *(void**)object = pool->free_list;
+    pool->free_list = object;
+    pool->in_use -= 1;
+}
+
+void lsh_pool_print_statistics(Pool const* const pool, int const fd_out) {
+    dprintf(fd_out,
+            "%-12s object %zu slabs %d capacity %d in use %d allocations %ld "
+            "reused %ld\n",
+            pool->name, pool->object_size, pool->slab_count,
+            pool->slab_count * pool->objects_per_slab, pool->in_use,
+            pool->allocations, pool->reuses);
+}
+
+static bool lsh_write_all(int const fd, char const* buffer, size_t size) {
+    while(size > 0) {
+        ssize_t const result = write(fd, buffer, size);
+        if(result < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buffer += result;
+        size -= result;
+    }
+    return true;
+}
+
+// lsh_spill_to_memfd
+// Move the remaining contents of fd into a memfd, preceded by the size bytes
+// that have already been read into buffer.
+//
+// Returns:
+// The memfd or -1 on failure.
+//
+static int lsh_spill_to_memfd(int const fd, char const* const buffer,
+                              size_t const size, size_t* const total) {
+    int const memfd = memfd_create("lsh-capture", MFD_CLOEXEC);
+    if(memfd < 0) {
+        perror("arena_read_fd: memfd_create");
+        return -1;
+    }
+
+    if(!lsh_write_all(memfd, buffer, size)) {
+        perror("arena_read_fd: write");
+        close(memfd);
+        return -1;
+    }
+
+    *total = size;
+    bool use_splice = true;
+    char* bounce = NULL;
     while(true) {
-        char const c = getchar();
-        if(c == EOF) {
-            return size == 0 ? -1 : size;
+        ssize_t result;
+        if(use_splice) {
+            // Zero-copy when fd is a pipe.
+            result = splice(fd, NULL, memfd, NULL, 1 << 20,
+                            SPLICE_F_MOVE | SPLICE_F_MORE);
+            if(result < 0 && errno == EINVAL) {
+                use_splice = false;
+                continue;
+            }
+        } else {
+            if(bounce == NULL) {
+                bounce = malloc(LSH_ARENA_READ_INLINE_SIZE);
+                if(!bounce) {
+                    fprintf(stderr, "arena_read_fd: allocation failure");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            result = read(fd, bounce, LSH_ARENA_READ_INLINE_SIZE);
+            if(result > 0 && !lsh_write_all(memfd, bounce, result)) {
+                result = -1;
+            }
         }
 
-        if(c == '\n') {
-            return size;
+        if(result < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("arena_read_fd");
+            free(bounce);
+            close(memfd);
+            return -1;
         }
 
-        if(size + 2 >= capacity) {
-            capacity = (capacity == 0 ? 128 : capacity * 2);
-            buffer = realloc(buffer, capacity);
-            *out_buffer = buffer;
-            if(!buffer) {
-                fprintf(stderr, "getline: allocation failure");
-                exit(EXIT_FAILURE);
+        if(result == 0) {
+            break;
+        }
+        *total += result;
+    }
+    free(bounce);
+    return memfd;
+}
+
+char* lsh_arena_read_fd(Arena* const arena, int const fd,
+                        size_t* const out_size) {
+    // One byte extra for the null terminator.
+    char* const buffer =
+        lsh_arena_reserve(arena, LSH_ARENA_READ_INLINE_SIZE + 1);
+    size_t size = 0;
+    while(size < LSH_ARENA_READ_INLINE_SIZE) {
+        ssize_t const result =
+            read(fd, buffer + size, LSH_ARENA_READ_INLINE_SIZE - size);
+        if(result < 0) {
+            if(errno == EINTR) {
+                continue;
             }
+            perror("arena_read_fd");
+            return NULL;
         }
 
-        buffer[size] = c;
-        buffer[size + 1] = '\0';
-        size += 1;
+        if(result == 0) {
+            buffer[size] = '\0';
+            lsh_arena_commit(arena, size + 1);
+            *out_size = size;
+            return buffer;
+        }
+        size += result;
     }
+
+    // The output does not fit the inline buffer. The reservation has not been
+    // committed, therefore the arena reuses the space.
+    size_t total = 0;
+    int const memfd = lsh_spill_to_memfd(fd, buffer, size, &total);
+    if(memfd < 0) {
+        return NULL;
+    }
+
+    // Extend the file by the null terminator so that mapping it never touches
+    // a page past the end of the file.
+    char* mapping = MAP_FAILED;
+    if(ftruncate(memfd, total + 1) == 0) {
+        mapping = mmap(NULL, total + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                       memfd, 0);
+    }
+    close(memfd);
+    if(mapping == MAP_FAILED) {
+        perror("arena_read_fd: mmap");
+        return NULL;
+    }
+
+    lsh_arena_adopt_mapping(arena, mapping, total + 1);
+    *out_size = total;
+    return mapping;
 }
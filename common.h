@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdlib.h>
+
 #define bool int
 #define true 1
 #define false 0
@@ -7,22 +10,151 @@
 #define UNUSED(x) ((void)x)
 
 typedef struct Descriptors {
+    // -1 if the descriptor is closed.
     int in;
     int out;
     int err;
+    // Redirects of descriptors above the standard ones, which the process
+    // applies itself (see lsh_apply_redirect).
+    struct Redirect const* redirects;
+    int redirect_count;
 } Descriptors;
 
 char* lsh_allocate_from_slice(char const* begin, char const* end);
 void* lsh_alloc_and_zero(unsigned int size);
 
-// lsh_getline
-// Read a single line of input from stdin.
+// Memory_Tag
+// Subsystem that tracked memory is accounted to.
+//
+typedef enum Memory_Tag {
+    MEMORY_OTHER,
+    MEMORY_PARSER,
+    MEMORY_JOBS,
+    MEMORY_EDITOR,
+    MEMORY_HISTORY,
+    MEMORY_TAG_COUNT,
+} Memory_Tag;
+
+// Memory accounting is compiled in with LSH_TRACK_MEMORY. Without it the
+// tagged functions are plain allocations.
+#ifdef LSH_TRACK_MEMORY
+// lsh_alloc_tagged
+// Returns:
+// Zeroed memory accounted to the tag.
+//
+void* lsh_alloc_tagged(Memory_Tag tag, size_t size);
+
+// lsh_realloc_tagged
+// Returns:
+// The reallocated memory or NULL on failure, in which case memory is left
+// untouched.
+//
+void* lsh_realloc_tagged(Memory_Tag tag, void* memory, size_t size);
+void lsh_free_tagged(Memory_Tag tag, void* memory);
+
+// lsh_memory_track
+// Account memory obtained from malloc to the tag. lsh_memory_untrack hands
+// the memory back, so that ownership may move between subsystems.
+//
+void lsh_memory_track(Memory_Tag tag, void* memory);
+void lsh_memory_untrack(Memory_Tag tag, void* memory);
+
+// lsh_memory_add
+// Account size bytes that do not come from malloc, such as mappings, to the
+// tag. lsh_memory_remove releases them.
+//
+void lsh_memory_add(Memory_Tag tag, size_t size);
+void lsh_memory_remove(Memory_Tag tag, size_t size);
+#else
+#define lsh_alloc_tagged(tag, size) lsh_alloc_and_zero(size)
+#define lsh_realloc_tagged(tag, memory, size) realloc(memory, size)
+#define lsh_free_tagged(tag, memory) free(memory)
+#define lsh_memory_track(tag, memory) ((void)0)
+#define lsh_memory_untrack(tag, memory) ((void)0)
+#define lsh_memory_add(tag, size) ((void)0)
+#define lsh_memory_remove(tag, size) ((void)0)
+#endif
+
+// lsh_print_memory_statistics
+// Print the allocations, frees, live and peak bytes of every tag and the heap
+// as a whole.
+//
+void lsh_print_memory_statistics(int fd_out);
+
+typedef struct Arena_Block Arena_Block;
+
+// Arena
+// Bump allocator that owns all of its allocations and releases them at once.
+// Blocks may also be adopted file mappings (see lsh_arena_read_fd).
+//
+typedef struct Arena {
+    Arena_Block* blocks;
+    // Blocks and mappings are accounted to the tag.
+    Memory_Tag tag;
+} Arena;
+
+void* lsh_arena_alloc(Arena* arena, size_t size);
+// lsh_arena_alloc_from_slice
+// Copy the slice into the arena and null-terminate it.
+//
+char* lsh_arena_alloc_from_slice(Arena* arena, char const* begin,
+                                 char const* end);
+void lsh_arena_free(Arena* arena);
+
+typedef struct Pool_Slab Pool_Slab;
+
+// Pool
+// Allocator of objects of a single size. Objects are carved out of slabs that
+// are never released while the pool lives, therefore their addresses are
+// stable, and freed objects are kept on a free list for reuse.
+//
+typedef struct Pool {
+    char const* name;
+    Memory_Tag tag;
+    size_t object_size;
+    int objects_per_slab;
+    Pool_Slab* slabs;
+    // Objects of the newest slab that have never been allocated.
+    char* fresh;
+    char* fresh_end;
+    void* free_list;
+    int slab_count;
+    int in_use;
+    // Total number of allocations and how many of them reused a freed object.
+    long allocations;
+    long reuses;
+} Pool;
+
+// lsh_pool_initialise
+// Parameters:
+// name - shown in the statistics.
+// tag - accounts the slabs.
+//
+void lsh_pool_initialise(Pool* pool, char const* name, Memory_Tag tag,
+                         size_t object_size);
+
+// lsh_pool_alloc
+// Returns:
+// A zeroed object.
+//
+void* lsh_pool_alloc(Pool* pool);
+void lsh_pool_free(Pool* pool, void* object);
+
+// lsh_pool_print_statistics
+// Print a line of statistics of the pool.
+//
+void lsh_pool_print_statistics(Pool const* pool, int fd_out);
+
+// lsh_arena_read_fd
+// Read fd until EOF into the arena. Input is read with large reads directly
+// into a contiguous arena block. Should it not fit, the remainder is spliced
+// into a memfd which is then privately mapped and adopted by the arena, so
+// the data is never reallocated or copied between buffers.
 //
 // Parameters:
-// buffer - the buffer that will be created by getline. *buffer will be
-//          overwritten by lsh_getline with the address of a new buffer.
+// size - receives the number of bytes read.
 //
 // Returns:
-// The number of characters read or -1 on EOF.
+// A writable, null-terminated buffer owned by the arena or NULL on failure.
 //
-int lsh_getline(char** buffer);
+char* lsh_arena_read_fd(Arena* arena, int fd, size_t* size);
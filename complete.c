@@ -0,0 +1,397 @@
+#include <complete.h>
+
+#include <builtin.h>
+#include <globbing.h>
+#include <vars.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Directories of PATH beyond this are not indexed.
+#define LSH_MAX_PATH_DIRECTORIES 64
+
+typedef struct Command_Name {
+    char* name;
+    // Bit i is set if directory i of PATH provides the executable.
+    uint64_t directories;
+    bool builtin;
+} Command_Name;
+
+// Command_Index
+// Names sorted bytewise so that completing a prefix is a binary search.
+//
+typedef struct Command_Index {
+    Command_Name* names;
+    int size;
+    int capacity;
+    // The PATH the index was built for.
+    char* path;
+    char* directories[LSH_MAX_PATH_DIRECTORIES];
+    int watches[LSH_MAX_PATH_DIRECTORIES];
+    int directory_count;
+    int inotify;
+    bool valid;
+} Command_Index;
+
+static Command_Index command_index = {.inotify = -1};
+
+// lsh_lower_bound
+// Returns:
+// Index of the first name not less than the given one.
+//
+static int lsh_lower_bound(char const* const name, int const size) {
+    int begin = 0;
+    int end = command_index.size;
+    while(begin < end) {
+        int const middle = begin + (end - begin) / 2;
+        // A name shorter than size compares less on its terminator.
+        if(strncmp(command_index.names[middle].name, name, size) < 0) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    return begin;
+}
+
+// lsh_append_name
+// Add a name at the end of the index, leaving it unsorted.
+//
+static Command_Name* lsh_append_name(char const* const name, int const size) {
+    if(command_index.size == command_index.capacity) {
+        command_index.capacity =
+            (command_index.capacity == 0 ? 1024 : command_index.capacity * 2);
+        command_index.names = lsh_realloc_tagged(
+            MEMORY_EDITOR, command_index.names,
+            command_index.capacity * sizeof(Command_Name));
+        if(!command_index.names) {
+            fprintf(stderr, "complete: allocation failure");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    Command_Name* const entry = &command_index.names[command_index.size];
+    command_index.size += 1;
+    entry->name = lsh_allocate_from_slice(name, name + size + 1);
+    lsh_memory_track(MEMORY_EDITOR, entry->name);
+    entry->name[size] = '\0';
+    entry->directories = 0;
+    entry->builtin = false;
+    return entry;
+}
+
+// lsh_insert_name
+// Find the name in the sorted index or insert it at its place.
+//
+static Command_Name* lsh_insert_name(char const* const name, int const size) {
+    int const index = lsh_lower_bound(name, size);
+    if(index < command_index.size) {
+        Command_Name* const existing = &command_index.names[index];
+        if(strncmp(existing->name, name, size) == 0 &&
+           existing->name[size] == '\0') {
+            return existing;
+        }
+    }
+
+    Command_Name const appended = *lsh_append_name(name, size);
+    Command_Name* const entry = &command_index.names[index];
+    memmove(entry + 1, entry,
+            (command_index.size - 1 - index) * sizeof(Command_Name));
+    *entry = appended;
+    return entry;
+}
+
+static int lsh_compare_names(void const* const left, void const* const right) {
+    return strcmp(((Command_Name const*)left)->name,
+                  ((Command_Name const*)right)->name);
+}
+
+// lsh_sort_index
+// Sort the appended names and merge the entries of a name provided by
+// several directories.
+//
+static void lsh_sort_index(void) {
+    qsort(command_index.names, command_index.size, sizeof(Command_Name),
+          lsh_compare_names);
+    int size = 0;
+    for(int i = 0; i < command_index.size; ++i) {
+        Command_Name* const entry = &command_index.names[i];
+        if(size > 0 &&
+           strcmp(command_index.names[size - 1].name, entry->name) == 0) {
+            Command_Name* const merged = &command_index.names[size - 1];
+            merged->directories |= entry->directories;
+            merged->builtin = merged->builtin || entry->builtin;
+            lsh_free_tagged(MEMORY_EDITOR, entry->name);
+            continue;
+        }
+        command_index.names[size] = *entry;
+        size += 1;
+    }
+    command_index.size = size;
+}
+
+static void lsh_remove_name(Command_Name* const entry) {
+    int const index = entry - command_index.names;
+    lsh_free_tagged(MEMORY_EDITOR, entry->name);
+    memmove(entry, entry + 1,
+            (command_index.size - index - 1) * sizeof(Command_Name));
+    command_index.size -= 1;
+}
+
+static bool lsh_is_executable(int const directory, char const* const name) {
+    struct stat info;
+    return fstatat(directory, name, &info, 0) == 0 && S_ISREG(info.st_mode) &&
+           faccessat(directory, name, X_OK, 0) == 0;
+}
+
+// lsh_update_entry
+// Re-examine a single file of directory i of PATH.
+//
+static void lsh_update_entry(int const i, int const directory,
+                             char const* const name) {
+    int const size = strlen(name);
+    uint64_t const bit = (uint64_t)1 << i;
+    if(lsh_is_executable(directory, name)) {
+        lsh_insert_name(name, size)->directories |= bit;
+        return;
+    }
+
+    int const index = lsh_lower_bound(name, size);
+    if(index < command_index.size) {
+        Command_Name* const entry = &command_index.names[index];
+        if(strcmp(entry->name, name) == 0) {
+            entry->directories &= ~bit;
+            if(entry->directories == 0 && !entry->builtin) {
+                lsh_remove_name(entry);
+            }
+        }
+    }
+}
+
+static void lsh_clear_index(void) {
+    for(int i = 0; i < command_index.size; ++i) {
+        lsh_free_tagged(MEMORY_EDITOR, command_index.names[i].name);
+    }
+    command_index.size = 0;
+    for(int i = 0; i < command_index.directory_count; ++i) {
+        lsh_free_tagged(MEMORY_EDITOR, command_index.directories[i]);
+    }
+    command_index.directory_count = 0;
+    if(command_index.inotify >= 0) {
+        close(command_index.inotify);
+        command_index.inotify = -1;
+    }
+    lsh_free_tagged(MEMORY_EDITOR, command_index.path);
+    command_index.path = NULL;
+    command_index.valid = false;
+}
+
+static void lsh_build_index(char const* const path) {
+    lsh_clear_index();
+    command_index.path = lsh_allocate_from_slice(path, path + strlen(path) + 1);
+    lsh_memory_track(MEMORY_EDITOR, command_index.path);
+    command_index.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    int count = 0;
+    Builtin_Fn const* const builtins = lsh_get_builtins(&count);
+    for(int i = 0; i < count; ++i) {
+        lsh_append_name(builtins[i].name, strlen(builtins[i].name))->builtin =
+            true;
+    }
+
+    for(char const* begin = path;
+        command_index.directory_count < LSH_MAX_PATH_DIRECTORIES;) {
+        char const* end = strchr(begin, ':');
+        if(end == NULL) {
+            end = begin + strlen(begin);
+        }
+
+        // An empty PATH entry stands for the current directory, which we do
+        // not index.
+        if(end != begin) {
+            int const i = command_index.directory_count;
+            char* const directory = lsh_allocate_from_slice(begin, end + 1);
+            directory[end - begin] = '\0';
+            lsh_memory_track(MEMORY_EDITOR, directory);
+            command_index.directories[i] = directory;
+            command_index.watches[i] = -1;
+            command_index.directory_count += 1;
+            if(command_index.inotify >= 0) {
+                command_index.watches[i] = inotify_add_watch(
+                    command_index.inotify, directory,
+                    IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                        IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF |
+                        IN_MOVE_SELF | IN_ONLYDIR);
+            }
+
+            DIR* const stream = opendir(directory);
+            if(stream != NULL) {
+                int const fd = dirfd(stream);
+                for(struct dirent* entry = readdir(stream); entry != NULL;
+                    entry = readdir(stream)) {
+                    if(entry->d_name[0] == '.' || entry->d_type == DT_DIR) {
+                        continue;
+                    }
+
+                    if(lsh_is_executable(fd, entry->d_name)) {
+                        lsh_append_name(entry->d_name, strlen(entry->d_name))
+                            ->directories |= (uint64_t)1 << i;
+                    }
+                }
+                closedir(stream);
+            }
+        }
+
+        if(*end == '\0') {
+            break;
+        }
+        begin = end + 1;
+    }
+    lsh_sort_index();
+    command_index.valid = true;
+}
+
+// lsh_apply_index_events
+// Update the index with the changes reported by inotify since the last
+// completion.
+//
+static void lsh_apply_index_events(void) {
+    if(command_index.inotify < 0) {
+        return;
+    }
+
+    char buffer[16 * 1024]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    while(command_index.valid) {
+        ssize_t const size =
+            read(command_index.inotify, buffer, sizeof(buffer));
+        if(size <= 0) {
+            break;
+        }
+
+        for(char* i = buffer; i < buffer + size;) {
+            struct inotify_event const* const event =
+                (struct inotify_event const*)i;
+            i += sizeof(struct inotify_event) + event->len;
+            if(event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF |
+                              IN_IGNORED)) {
+                // Lost track of a directory. Rebuild on next use.
+                command_index.valid = false;
+                break;
+            }
+
+            if(event->len == 0 || event->name[0] == '.') {
+                continue;
+            }
+
+            for(int d = 0; d < command_index.directory_count; ++d) {
+                if(command_index.watches[d] != event->wd) {
+                    continue;
+                }
+
+                int const directory = open(command_index.directories[d],
+                                           O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if(directory >= 0) {
+                    lsh_update_entry(d, directory, event->name);
+                    close(directory);
+                }
+            }
+        }
+    }
+}
+
+static int lsh_complete_command(char const* const word, int const size,
+                                Arena* const arena, Word_List* const list) {
+    char const name[] = "PATH";
+    char const* path = lsh_get_variable(name, name + sizeof(name) - 1);
+    if(path == NULL) {
+        path = "";
+    }
+
+    lsh_apply_index_events();
+    if(!command_index.valid || strcmp(command_index.path, path) != 0) {
+        lsh_build_index(path);
+    }
+
+    int count = 0;
+    for(int i = lsh_lower_bound(word, size);
+        i < command_index.size &&
+        strncmp(command_index.names[i].name, word, size) == 0;
+        ++i) {
+        char const* const match = command_index.names[i].name;
+        lsh_word_list_push(
+            list, lsh_arena_alloc_from_slice(arena, match,
+                                             match + strlen(match)));
+        count += 1;
+    }
+    return count;
+}
+
+static int lsh_complete_file(char const* const word, int const size,
+                             Arena* const arena, Word_List* const list) {
+    // Complete through the globbing engine with the word escaped and a star
+    // appended.
+    char* const pattern = lsh_alloc_and_zero(2 * size + 2);
+    char* o = pattern;
+    for(int i = 0; i < size; ++i) {
+        if(word[i] == '\\' || lsh_is_glob_character(word[i])) {
+            *o = '\\';
+            ++o;
+        }
+        *o = word[i];
+        ++o;
+    }
+    *o = '*';
+
+    int const first = list->size;
+    int const count = lsh_glob(pattern, arena, list);
+    free(pattern);
+    for(int i = first; i < list->size; ++i) {
+        struct stat info;
+        if(stat(list->values[i], &info) == 0 && S_ISDIR(info.st_mode)) {
+            char const* const match = list->values[i];
+            int const length = strlen(match);
+            char* const directory = lsh_arena_alloc(arena, length + 2);
+            memcpy(directory, match, length);
+            directory[length] = '/';
+            directory[length + 1] = '\0';
+            list->values[i] = directory;
+        }
+    }
+    return count;
+}
+
+int lsh_complete(char const* const line, int const cursor,
+                 int* const word_begin, Arena* const arena,
+                 Word_List* const list) {
+    int begin = cursor;
+    while(begin > 0 && line[begin - 1] != ' ' && line[begin - 1] != '|' &&
+          line[begin - 1] != '&' && line[begin - 1] != '<' &&
+          line[begin - 1] != '>') {
+        begin -= 1;
+    }
+    *word_begin = begin;
+
+    // The word is a command name if only whitespace separates it from the
+    // start of the line or a pipe.
+    int previous = begin;
+    while(previous > 0 && line[previous - 1] == ' ') {
+        previous -= 1;
+    }
+    bool const command = (previous == 0 || line[previous - 1] == '|' ||
+                          line[previous - 1] == '&');
+
+    char const* const word = line + begin;
+    int const size = cursor - begin;
+    if(command && memchr(word, '/', size) == NULL) {
+        return lsh_complete_command(word, size, arena, list);
+    }
+    return lsh_complete_file(word, size, arena, list);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <common.h>
+#include <expand.h>
+
+// lsh_complete
+// Find the completions of the word that ends at the cursor. The first word of
+// a command is completed from an index of builtins and the executables on
+// PATH. The index is built on first use and kept up to date through inotify
+// watches on the PATH directories. Other words are completed as file names
+// through the cached directory listings of the globbing engine.
+//
+// Parameters:
+// word_begin - receives the index of the first character of the word.
+// arena - owns the completions.
+//
+// Returns:
+// The sorted completions appended to the list. Directories end with a slash.
+//
+int lsh_complete(char const* line, int cursor, int* word_begin, Arena* arena,
+                 Word_List* list);
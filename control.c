@@ -0,0 +1,442 @@
+#include <control.h>
+
+#include <events.h>
+#include <jobs.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LSH_CONTROL_MAX_CLIENTS 16
+#define LSH_CONTROL_MAX_REQUEST 1024
+// A client that does not read its responses is disconnected once this much
+// output is pending.
+#define LSH_CONTROL_MAX_OUTPUT (1024 * 1024)
+
+typedef struct Control_Buffer {
+    char* data;
+    int size;
+    int capacity;
+} Control_Buffer;
+
+typedef struct Control_Client {
+    int fd;
+    char input[LSH_CONTROL_MAX_REQUEST];
+    int input_size;
+    Control_Buffer output;
+    // Bytes of output already sent.
+    int sent;
+    // The client has shut down its side of the connection. It is disconnected
+    // once the responses to the requests it sent have been delivered.
+    bool closed;
+} Control_Client;
+
+static int listen_fd = -1;
+static char* socket_path = NULL;
+// Children that exit without executing a program inherit the exit handler,
+// but only the shell that opened the socket may remove it.
+static pid_t owner = 0;
+static Control_Client* clients[LSH_CONTROL_MAX_CLIENTS];
+
+static void lsh_control_buffer_reserve(Control_Buffer* const buffer,
+                                       int const size) {
+    if(size <= buffer->capacity) {
+        return;
+    }
+
+    int capacity = (buffer->capacity > 0 ? buffer->capacity : 256);
+    while(capacity < size) {
+        capacity *= 2;
+    }
+
+    char* const data = lsh_realloc_tagged(MEMORY_OTHER, buffer->data, capacity);
+    if(!data) {
+        fprintf(stderr, "control_buffer_reserve: allocation failure");
+        exit(EXIT_FAILURE);
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+}
+
+static void lsh_control_printf(Control_Buffer* const buffer,
+                               char const* const format, ...) {
+    va_list args;
+    va_start(args, format);
+    int const size = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    lsh_control_buffer_reserve(buffer, buffer->size + size + 1);
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->size, size + 1, format, args);
+    va_end(args);
+    buffer->size += size;
+}
+
+static void lsh_control_json_string(Control_Buffer* const buffer,
+                                    char const* string) {
+    lsh_control_printf(buffer, "\"");
+    for(; *string != '\0'; ++string) {
+        unsigned char const c = *string;
+        if(c == '"' || c == '\\') {
+            lsh_control_printf(buffer, "\\%c", c);
+        } else if(c < 0x20) {
+            lsh_control_printf(buffer, "\\u%04x", c);
+        } else {
+            lsh_control_buffer_reserve(buffer, buffer->size + 1);
+            buffer->data[buffer->size] = c;
+            buffer->size += 1;
+        }
+    }
+    lsh_control_printf(buffer, "\"");
+}
+
+static double lsh_seconds_between(struct timespec const from,
+                                  struct timespec const to) {
+    return (to.tv_sec - from.tv_sec) + (to.tv_nsec - from.tv_nsec) / 1e9;
+}
+
+static void lsh_control_write_job(Control_Buffer* const buffer,
+                                  Job* const job) {
+    static char const* const job_statuses[] = {
+        [JOB_RUNNING] = "running",       [JOB_STOPPED] = "stopped",
+        [JOB_COMPLETED] = "completed",   [JOB_TERMINATED] = "terminated",
+        [JOB_TIMED_OUT] = "timed out",
+    };
+    static char const* const process_statuses[] = {
+        [PROCESS_RUNNING] = "running",
+        [PROCESS_STOPPED] = "stopped",
+        [PROCESS_COMPLETED] = "completed",
+        [PROCESS_TERMINATED] = "terminated",
+    };
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    lsh_control_printf(buffer, "{\"id\":%d,\"pgid\":%d,\"command\":", job->id,
+                       (int)job->pgid);
+    lsh_control_json_string(buffer, job->command);
+    lsh_control_printf(
+        buffer, ",\"status\":\"%s\",\"started\":%.3f,\"elapsed\":%.3f,",
+        job_statuses[lsh_get_job_status(job)],
+        job->started_at.tv_sec + job->started_at.tv_nsec / 1e9,
+        lsh_seconds_between(job->started, now));
+    lsh_control_printf(buffer, "\"processes\":[");
+    for(int i = 0; i < job->process_count; ++i) {
+        Process const* const process = &job->processes[i];
+        bool const exited = process->status == PROCESS_COMPLETED ||
+                            process->status == PROCESS_TERMINATED;
+        lsh_control_printf(buffer, "%s{\"pid\":%d,\"name\":",
+                           (i > 0 ? "," : ""), (int)process->pid);
+        char const* const name =
+            (process->args != NULL && process->args[0] != NULL
+                 ? process->args[0]
+                 : "");
+        lsh_control_json_string(buffer, name);
+        lsh_control_printf(buffer, ",\"status\":\"%s\"",
+                           process_statuses[process->status]);
+        if(exited && process->pid != 0) {
+            char const* const key =
+                (process->status == PROCESS_TERMINATED ? "signal"
+                                                       : "exit_code");
+            lsh_control_printf(
+                buffer, ",\"%s\":%d,\"elapsed\":%.3f", key,
+                process->exit_code,
+                lsh_seconds_between(job->started, process->finished));
+        }
+        lsh_control_printf(buffer, "}");
+    }
+    lsh_control_printf(buffer, "]}");
+}
+
+static void lsh_control_error(Control_Buffer* const buffer,
+                              char const* const message) {
+    lsh_control_printf(buffer, "{\"error\":");
+    lsh_control_json_string(buffer, message);
+    lsh_control_printf(buffer, "}\n");
+}
+
+static Job* lsh_control_find_job(char const* const id) {
+    if(id == NULL) {
+        return NULL;
+    }
+    return lsh_find_job_with_id(lsh_get_primary_job_list(), atoi(id));
+}
+
+// lsh_control_respond
+// Append the response to the request to the output of the client.
+//
+static void lsh_control_respond(Control_Buffer* const buffer,
+                                char* const request) {
+    char* save = NULL;
+    char const* const verb = strtok_r(request, " \t", &save);
+    char const* const first = strtok_r(NULL, " \t", &save);
+    char const* const second = strtok_r(NULL, " \t", &save);
+    if(verb == NULL) {
+        lsh_control_error(buffer, "empty request");
+    } else if(strcmp(verb, "jobs") == 0) {
+        Job_List* const list = lsh_get_primary_job_list();
+        lsh_control_printf(buffer, "{\"jobs\":[");
+        for(Job_List_Entry *b = lsh_job_list_begin(list),
+                           *e = lsh_job_list_end(list);
+            b != e; b = lsh_job_list_next(b)) {
+            if(b != lsh_job_list_begin(list)) {
+                lsh_control_printf(buffer, ",");
+            }
+            lsh_control_write_job(buffer, lsh_job_list_value(b));
+        }
+        lsh_control_printf(buffer, "]}\n");
+    } else if(strcmp(verb, "job") == 0) {
+        Job* const job = lsh_control_find_job(first);
+        if(job == NULL) {
+            lsh_control_error(buffer, "no such job");
+        } else {
+            lsh_control_write_job(buffer, job);
+            lsh_control_printf(buffer, "\n");
+        }
+    } else if(strcmp(verb, "signal") == 0) {
+        Job* const job = lsh_control_find_job(first);
+        int const signal = (second != NULL ? lsh_parse_signal(second) : 0);
+        if(job == NULL) {
+            lsh_control_error(buffer, "no such job");
+        } else if(signal == 0) {
+            lsh_control_error(buffer, "invalid signal");
+        } else if(job->pgid == 0 || lsh_is_job_completed(job)) {
+            lsh_control_error(buffer, "job is not running");
+        } else if(lsh_signal_job(job, signal) != 0) {
+            lsh_control_error(buffer, strerror(errno));
+        } else {
+            lsh_control_printf(buffer, "{\"ok\":true}\n");
+        }
+    } else {
+        lsh_control_error(buffer, "unknown request");
+    }
+}
+
+static void lsh_control_disconnect(Control_Client* const client) {
+    for(int i = 0; i < LSH_CONTROL_MAX_CLIENTS; ++i) {
+        if(clients[i] == client) {
+            clients[i] = NULL;
+        }
+    }
+
+    lsh_remove_event_source(client->fd);
+    close(client->fd);
+    lsh_free_tagged(MEMORY_OTHER, client->output.data);
+    lsh_free_tagged(MEMORY_OTHER, client);
+}
+
+// lsh_control_flush
+// Send as much of the pending output as the socket accepts and watch for
+// writability while output remains. A closed client is disconnected once its
+// output has been sent.
+//
+// Returns:
+// false if the client has been disconnected.
+//
+static bool lsh_control_flush(Control_Client* const client) {
+    while(client->sent < client->output.size) {
+        ssize_t const result =
+            send(client->fd, client->output.data + client->sent,
+                 client->output.size - client->sent, MSG_NOSIGNAL);
+        if(result < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            lsh_control_disconnect(client);
+            return false;
+        }
+        client->sent += result;
+    }
+
+    if(client->sent == client->output.size) {
+        if(client->closed) {
+            lsh_control_disconnect(client);
+            return false;
+        }
+
+        client->sent = 0;
+        client->output.size = 0;
+        lsh_modify_event_source(client->fd, EPOLLIN);
+    } else if(client->output.size - client->sent > LSH_CONTROL_MAX_OUTPUT) {
+        lsh_control_disconnect(client);
+        return false;
+    } else {
+        uint32_t const events =
+            (client->closed ? EPOLLOUT : EPOLLIN | EPOLLOUT);
+        lsh_modify_event_source(client->fd, events);
+    }
+    return true;
+}
+
+static void lsh_control_handle_client(int const fd, uint32_t const events,
+                                      void* const context) {
+    Control_Client* const client = context;
+    if(events & EPOLLOUT) {
+        if(!lsh_control_flush(client)) {
+            return;
+        }
+    }
+
+    if(client->closed || !(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        return;
+    }
+
+    while(true) {
+        ssize_t const size =
+            read(fd, client->input + client->input_size,
+                 LSH_CONTROL_MAX_REQUEST - client->input_size);
+        if(size < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if(size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        if(size < 0) {
+            lsh_control_disconnect(client);
+            return;
+        }
+
+        if(size == 0) {
+            client->closed = true;
+            break;
+        }
+
+        client->input_size += size;
+        char* begin = client->input;
+        char* const end = client->input + client->input_size;
+        char* newline = NULL;
+        while((newline = memchr(begin, '\n', end - begin)) != NULL) {
+            *newline = '\0';
+            if(newline > begin && newline[-1] == '\r') {
+                newline[-1] = '\0';
+            }
+            lsh_control_respond(&client->output, begin);
+            begin = newline + 1;
+        }
+
+        client->input_size = end - begin;
+        memmove(client->input, begin, client->input_size);
+        if(client->input_size == LSH_CONTROL_MAX_REQUEST) {
+            lsh_control_error(&client->output, "request too long");
+            client->closed = true;
+            break;
+        }
+    }
+
+    lsh_control_flush(client);
+}
+
+static void lsh_control_handle_listen(int const fd, uint32_t const events,
+                                      void* const context) {
+    UNUSED(events);
+    UNUSED(context);
+    while(true) {
+        int const client_fd =
+            accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(client_fd < 0) {
+            return;
+        }
+
+        int slot = 0;
+        while(slot < LSH_CONTROL_MAX_CLIENTS && clients[slot] != NULL) {
+            slot += 1;
+        }
+
+        if(slot == LSH_CONTROL_MAX_CLIENTS) {
+            close(client_fd);
+            continue;
+        }
+
+        Control_Client* const client =
+            lsh_alloc_tagged(MEMORY_OTHER, sizeof(Control_Client));
+        client->fd = client_fd;
+        clients[slot] = client;
+        lsh_add_event_source(client_fd, EPOLLIN, lsh_control_handle_client,
+                             client);
+    }
+}
+
+bool lsh_control_open(char const* const path, int const fd_err) {
+    lsh_control_close();
+
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if(strlen(path) >= sizeof(address.sun_path)) {
+        dprintf(fd_err, "control: path too long\n");
+        return false;
+    }
+    strcpy(address.sun_path, path);
+
+    int const fd =
+        socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        dprintf(fd_err, "control: socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    // A socket left behind by a shell that did not exit cleanly is replaced,
+    // anything else at the path makes bind fail.
+    struct stat info;
+    if(lstat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        unlink(path);
+    }
+
+    // Only the owner may control the shell.
+    mode_t const mask = umask(0077);
+    int const bound = bind(fd, (struct sockaddr*)&address, sizeof(address));
+    umask(mask);
+    if(bound != 0 || listen(fd, LSH_CONTROL_MAX_CLIENTS) != 0) {
+        dprintf(fd_err, "control: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    listen_fd = fd;
+    owner = getpid();
+    socket_path = lsh_allocate_from_slice(path, path + strlen(path) + 1);
+    lsh_memory_track(MEMORY_OTHER, socket_path);
+    lsh_add_event_source(listen_fd, EPOLLIN, lsh_control_handle_listen, NULL);
+
+    static bool registered = false;
+    if(!registered) {
+        atexit(lsh_control_close);
+        registered = true;
+    }
+    return true;
+}
+
+void lsh_control_close(void) {
+    if(listen_fd < 0 || owner != getpid()) {
+        return;
+    }
+
+    for(int i = 0; i < LSH_CONTROL_MAX_CLIENTS; ++i) {
+        if(clients[i] != NULL) {
+            lsh_control_disconnect(clients[i]);
+        }
+    }
+
+    lsh_remove_event_source(listen_fd);
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path);
+    lsh_free_tagged(MEMORY_OTHER, socket_path);
+    socket_path = NULL;
+}
+
+char const* lsh_control_path(void) {
+    return (owner == getpid() ? socket_path : NULL);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <common.h>
+
+// lsh_control_open
+// Listen for control requests on a Unix domain socket at path. A socket that
+// is already open is closed first. The socket is served from the event loop,
+// one request per line and one line of JSON per response:
+//
+//   jobs                  the job table
+//   job ID                a single job
+//   signal ID SIGNAL      send the signal to the process group of the job
+//
+// Parameters:
+// fd_err - receives the error messages.
+//
+// Returns:
+// Whether the socket is listening.
+//
+bool lsh_control_open(char const* path, int fd_err);
+
+// lsh_control_close
+// Disconnect all clients and remove the socket.
+//
+void lsh_control_close(void);
+
+// lsh_control_path
+// Returns:
+// The path of the open socket or NULL. A forked child never serves the socket
+// of its parent and receives NULL.
+//
+char const* lsh_control_path(void);
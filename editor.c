@@ -0,0 +1,689 @@
+#include <editor.h>
+
+#include <complete.h>
+#include <events.h>
+#include <history.h>
+#include <jobs.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+typedef struct Buffer {
+    char* data;
+    int size;
+    int capacity;
+} Buffer;
+
+static void lsh_buffer_reserve(Buffer* const buffer, int const size) {
+    if(size > buffer->capacity) {
+        while(size > buffer->capacity) {
+            buffer->capacity =
+                (buffer->capacity == 0 ? 256 : buffer->capacity * 2);
+        }
+        buffer->data =
+            lsh_realloc_tagged(MEMORY_EDITOR, buffer->data, buffer->capacity);
+        if(!buffer->data) {
+            fprintf(stderr, "read_line: allocation failure");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void lsh_buffer_insert(Buffer* const buffer, int const position,
+                              char const* const data, int const size) {
+    // The data of an empty buffer may still be NULL.
+    if(size == 0) {
+        return;
+    }
+
+    lsh_buffer_reserve(buffer, buffer->size + size);
+    memmove(buffer->data + position + size, buffer->data + position,
+            buffer->size - position);
+    memcpy(buffer->data + position, data, size);
+    buffer->size += size;
+}
+
+static void lsh_buffer_erase(Buffer* const buffer, int const begin,
+                             int const end) {
+    if(begin == end) {
+        return;
+    }
+
+    memmove(buffer->data + begin, buffer->data + end, buffer->size - end);
+    buffer->size -= end - begin;
+}
+
+static void lsh_buffer_assign(Buffer* const buffer, char const* const data,
+                              int const size) {
+    buffer->size = 0;
+    lsh_buffer_insert(buffer, 0, data, size);
+}
+
+static void lsh_buffer_printf(Buffer* const buffer, char const* const format,
+                              int const value) {
+    lsh_buffer_reserve(buffer, buffer->size + 16);
+    buffer->size += snprintf(buffer->data + buffer->size, 16, format, value);
+}
+
+typedef struct Line_Editor {
+    Buffer line;
+    int cursor;
+    // The line as currently shown on the terminal and the terminal cursor.
+    Buffer shown;
+    int shown_cursor;
+    // Escape sequences to be written with the next flush.
+    Buffer output;
+    char const* prompt;
+    int prompt_width;
+    int columns;
+    // Number of entries recalled back from the most recent, 0 while the
+    // line being edited is shown.
+    int history_back;
+    // The line being edited while browsing the history.
+    Buffer saved;
+    // Consecutive completions. The second one lists the candidates.
+    int completions;
+} Line_Editor;
+
+// Input that has been read but not consumed by the previous line, e.g. the
+// rest of a paste.
+static char pending[1024];
+static int pending_size = 0;
+static Buffer kill_buffer;
+
+static bool lsh_is_continuation_byte(char const c) {
+    return (c & 0xC0) == 0x80;
+}
+
+// lsh_width
+// Number of columns taken by the text. Every UTF-8 sequence takes a single
+// column.
+//
+static int lsh_width(char const* begin, char const* const end) {
+    int width = 0;
+    for(; begin != end; ++begin) {
+        width += !lsh_is_continuation_byte(*begin);
+    }
+    return width;
+}
+
+static int lsh_prompt_width(char const* prompt) {
+    int width = 0;
+    while(*prompt != '\0') {
+        if(*prompt == '\033' && prompt[1] == '[') {
+            prompt += 2;
+            while(*prompt != '\0' && !(*prompt >= '@' && *prompt <= '~')) {
+                ++prompt;
+            }
+            if(*prompt != '\0') {
+                ++prompt;
+            }
+            continue;
+        }
+        width += !lsh_is_continuation_byte(*prompt);
+        ++prompt;
+    }
+    return width;
+}
+
+static int lsh_position(Line_Editor const* const editor, Buffer const* buffer,
+                        int const index) {
+    return editor->prompt_width +
+           lsh_width(buffer->data, buffer->data + index);
+}
+
+static void lsh_move_cursor(Line_Editor* const editor, int const from,
+                            int const to) {
+    int const columns = editor->columns;
+    int const from_row = from / columns;
+    int const to_row = to / columns;
+    if(to_row < from_row) {
+        lsh_buffer_printf(&editor->output, "\033[%dA", from_row - to_row);
+    } else if(to_row > from_row) {
+        lsh_buffer_printf(&editor->output, "\033[%dB", to_row - from_row);
+    }
+
+    int const from_column = from % columns;
+    int const to_column = to % columns;
+    if(to_column < from_column) {
+        lsh_buffer_printf(&editor->output, "\033[%dD", from_column - to_column);
+    } else if(to_column > from_column) {
+        lsh_buffer_printf(&editor->output, "\033[%dC", to_column - from_column);
+    }
+}
+
+static void lsh_flush(Line_Editor* const editor) {
+    char const* data = editor->output.data;
+    int size = editor->output.size;
+    while(size > 0) {
+        ssize_t const result = write(STDOUT_FILENO, data, size);
+        if(result < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        data += result;
+        size -= result;
+    }
+    editor->output.size = 0;
+}
+
+// lsh_refresh
+// Bring the terminal up to date with the line. Only the text after the
+// longest common prefix of the shown and the edited line is rewritten.
+//
+static void lsh_refresh(Line_Editor* const editor) {
+    struct winsize size;
+    editor->columns = 80;
+    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) {
+        editor->columns = size.ws_col;
+    }
+
+    Buffer const* const line = &editor->line;
+    Buffer* const shown = &editor->shown;
+    int common = 0;
+    int const limit = (line->size < shown->size ? line->size : shown->size);
+    while(common < limit && line->data[common] == shown->data[common]) {
+        common += 1;
+    }
+    while(common > 0 && common < line->size &&
+          lsh_is_continuation_byte(line->data[common])) {
+        common -= 1;
+    }
+
+    int terminal = lsh_position(editor, shown, editor->shown_cursor);
+    if(common != line->size || common != shown->size) {
+        int const common_position = lsh_position(editor, line, common);
+        lsh_move_cursor(editor, terminal, common_position);
+        terminal = common_position;
+
+        if(common != line->size) {
+            int const end = lsh_position(editor, line, line->size);
+            lsh_buffer_insert(&editor->output, editor->output.size,
+                              line->data + common, line->size - common);
+            if(end % editor->columns == 0) {
+                // Leave the pending wrap state of the last column.
+                lsh_buffer_insert(&editor->output, editor->output.size,
+                                  "\r\n", 2);
+            }
+            terminal = end;
+        }
+
+        if(lsh_position(editor, shown, shown->size) >
+           lsh_position(editor, line, line->size)) {
+            lsh_buffer_insert(&editor->output, editor->output.size, "\033[J",
+                              3);
+        }
+    }
+
+    lsh_move_cursor(editor, terminal,
+                    lsh_position(editor, line, editor->cursor));
+    lsh_buffer_assign(shown, line->data, line->size);
+    editor->shown_cursor = editor->cursor;
+    lsh_flush(editor);
+}
+
+static void lsh_redraw(Line_Editor* const editor) {
+    int const prompt_size = strlen(editor->prompt);
+    lsh_buffer_insert(&editor->output, editor->output.size, editor->prompt,
+                      prompt_size);
+    editor->shown.size = 0;
+    editor->shown_cursor = 0;
+    lsh_refresh(editor);
+}
+
+static int lsh_previous_character(Line_Editor const* const editor, int index) {
+    if(index > 0) {
+        index -= 1;
+        while(index > 0 &&
+              lsh_is_continuation_byte(editor->line.data[index])) {
+            index -= 1;
+        }
+    }
+    return index;
+}
+
+static int lsh_next_character(Line_Editor const* const editor, int index) {
+    if(index < editor->line.size) {
+        index += 1;
+        while(index < editor->line.size &&
+              lsh_is_continuation_byte(editor->line.data[index])) {
+            index += 1;
+        }
+    }
+    return index;
+}
+
+static void lsh_kill(Line_Editor* const editor, int const begin,
+                     int const end) {
+    if(begin == end) {
+        return;
+    }
+
+    lsh_buffer_assign(&kill_buffer, editor->line.data + begin, end - begin);
+    lsh_buffer_erase(&editor->line, begin, end);
+    editor->cursor = begin;
+}
+
+static void lsh_recall_history(Line_Editor* const editor, int const back) {
+    if(back < 0 || back == editor->history_back) {
+        return;
+    }
+
+    int size = 0;
+    char const* const entry =
+        (back > 0 ? lsh_history_recent(back - 1, &size) : NULL);
+    if(back > 0 && entry == NULL) {
+        return;
+    }
+
+    if(editor->history_back == 0) {
+        lsh_buffer_assign(&editor->saved, editor->line.data,
+                          editor->line.size);
+    }
+
+    editor->history_back = back;
+    if(back == 0) {
+        lsh_buffer_assign(&editor->line, editor->saved.data,
+                          editor->saved.size);
+    } else {
+        lsh_buffer_assign(&editor->line, entry, size);
+    }
+    editor->cursor = editor->line.size;
+}
+
+static void lsh_list_completions(Line_Editor* const editor,
+                                 Word_List const* const matches) {
+    int width = 0;
+    for(int i = 0; i < matches->size; ++i) {
+        int const length = strlen(matches->values[i]);
+        width = (length > width ? length : width);
+    }
+    width += 2;
+
+    int per_row = editor->columns / width;
+    per_row = (per_row < 1 ? 1 : per_row);
+    editor->cursor = editor->line.size;
+    lsh_refresh(editor);
+    lsh_buffer_insert(&editor->output, editor->output.size, "\r\n", 2);
+    for(int i = 0; i < matches->size; ++i) {
+        char const* const match = matches->values[i];
+        int const length = strlen(match);
+        lsh_buffer_insert(&editor->output, editor->output.size, match, length);
+        if((i + 1) % per_row == 0 || i + 1 == matches->size) {
+            lsh_buffer_insert(&editor->output, editor->output.size, "\r\n", 2);
+        } else {
+            lsh_buffer_reserve(&editor->output,
+                               editor->output.size + width - length);
+            memset(editor->output.data + editor->output.size, ' ',
+                   width - length);
+            editor->output.size += width - length;
+        }
+    }
+    lsh_redraw(editor);
+}
+
+// lsh_complete_word
+// Complete the word before the cursor up to the longest common prefix of the
+// candidates. A repeated request lists the candidates.
+//
+static void lsh_complete_word(Line_Editor* const editor) {
+    Arena arena = {0};
+    Word_List matches = {0};
+    int begin = 0;
+    lsh_complete(editor->line.data, editor->cursor, &begin, &arena, &matches);
+    if(matches.size == 0) {
+        lsh_buffer_insert(&editor->output, editor->output.size, "\a", 1);
+    } else {
+        char const* const first = matches.values[0];
+        int common = strlen(first);
+        for(int i = 1; i < matches.size; ++i) {
+            int length = 0;
+            while(length < common &&
+                  first[length] == matches.values[i][length]) {
+                length += 1;
+            }
+            common = length;
+        }
+
+        int const typed = editor->cursor - begin;
+        if(common > typed) {
+            lsh_buffer_insert(&editor->line, editor->cursor, first + typed,
+                              common - typed);
+            editor->cursor += common - typed;
+        }
+
+        if(matches.size == 1 && first[common - 1] != '/') {
+            lsh_buffer_insert(&editor->line, editor->cursor, " ", 1);
+            editor->cursor += 1;
+        } else if(matches.size > 1 && common <= typed &&
+                  editor->completions > 0) {
+            lsh_list_completions(editor, &matches);
+        }
+    }
+    lsh_free_tagged(MEMORY_PARSER, matches.values);
+    lsh_arena_free(&arena);
+}
+
+typedef enum Key_Result {
+    KEY_CONTINUE,
+    KEY_INCOMPLETE,
+    KEY_ACCEPT,
+    KEY_CANCEL,
+    KEY_EOF,
+} Key_Result;
+
+// lsh_handle_escape
+// Handle the escape sequence at input.
+//
+// Parameters:
+// consumed - receives the length of the sequence.
+//
+static Key_Result lsh_handle_escape(Line_Editor* const editor,
+                                    char const* const input, int const size,
+                                    int* const consumed) {
+    if(size < 3) {
+        if(size == 2 && input[1] != '[' && input[1] != 'O') {
+            *consumed = 2;
+            return KEY_CONTINUE;
+        }
+        return KEY_INCOMPLETE;
+    }
+
+    int length = 3;
+    char final = input[2];
+    if(input[1] == '[' && input[2] >= '0' && input[2] <= '9') {
+        while(length < size &&
+              !(input[length] >= '@' && input[length] <= '~')) {
+            length += 1;
+        }
+        if(length == size) {
+            return KEY_INCOMPLETE;
+        }
+        final = input[length];
+        length += 1;
+    }
+    *consumed = length;
+
+    switch(final) {
+        case 'A':
+            lsh_recall_history(editor, editor->history_back + 1);
+            break;
+        case 'B':
+            lsh_recall_history(editor, editor->history_back - 1);
+            break;
+        case 'C':
+            editor->cursor = lsh_next_character(editor, editor->cursor);
+            break;
+        case 'D':
+            editor->cursor = lsh_previous_character(editor, editor->cursor);
+            break;
+        case 'H':
+            editor->cursor = 0;
+            break;
+        case 'F':
+            editor->cursor = editor->line.size;
+            break;
+        case '~':
+            if(input[2] == '1' || input[2] == '7') {
+                editor->cursor = 0;
+            } else if(input[2] == '4' || input[2] == '8') {
+                editor->cursor = editor->line.size;
+            } else if(input[2] == '3') {
+                int const next = lsh_next_character(editor, editor->cursor);
+                lsh_buffer_erase(&editor->line, editor->cursor, next);
+            }
+            break;
+        default:
+            break;
+    }
+    return KEY_CONTINUE;
+}
+
+// lsh_handle_key
+// Apply the key at the start of input to the line.
+//
+// Parameters:
+// consumed - receives the number of bytes of input that the key took.
+//
+static Key_Result lsh_handle_key(Line_Editor* const editor,
+                                 char const* const input, int const size,
+                                 int* const consumed) {
+    *consumed = 1;
+    char const c = input[0];
+    if(c != '\t') {
+        editor->completions = 0;
+    }
+
+    switch(c) {
+        case '\t':
+            lsh_complete_word(editor);
+            editor->completions += 1;
+            break;
+        case '\r':
+        case '\n':
+            return KEY_ACCEPT;
+        case 3: // Ctrl-C
+            return KEY_CANCEL;
+        case 4: // Ctrl-D
+            if(editor->line.size == 0) {
+                return KEY_EOF;
+            }
+            lsh_buffer_erase(&editor->line, editor->cursor,
+                             lsh_next_character(editor, editor->cursor));
+            break;
+        case 1: // Ctrl-A
+            editor->cursor = 0;
+            break;
+        case 5: // Ctrl-E
+            editor->cursor = editor->line.size;
+            break;
+        case 2: // Ctrl-B
+            editor->cursor = lsh_previous_character(editor, editor->cursor);
+            break;
+        case 6: // Ctrl-F
+            editor->cursor = lsh_next_character(editor, editor->cursor);
+            break;
+        case 8: // Ctrl-H
+        case 127: {
+            int const previous =
+                lsh_previous_character(editor, editor->cursor);
+            lsh_buffer_erase(&editor->line, previous, editor->cursor);
+            editor->cursor = previous;
+        } break;
+        case 11: // Ctrl-K
+            lsh_kill(editor, editor->cursor, editor->line.size);
+            break;
+        case 21: // Ctrl-U
+            lsh_kill(editor, 0, editor->cursor);
+            break;
+        case 23: { // Ctrl-W
+            int begin = editor->cursor;
+            while(begin > 0 && editor->line.data[begin - 1] == ' ') {
+                begin -= 1;
+            }
+            while(begin > 0 && editor->line.data[begin - 1] != ' ') {
+                begin -= 1;
+            }
+            lsh_kill(editor, begin, editor->cursor);
+        } break;
+        case 25: // Ctrl-Y
+            lsh_buffer_insert(&editor->line, editor->cursor, kill_buffer.data,
+                              kill_buffer.size);
+            editor->cursor += kill_buffer.size;
+            break;
+        case 16: // Ctrl-P
+            lsh_recall_history(editor, editor->history_back + 1);
+            break;
+        case 14: // Ctrl-N
+            lsh_recall_history(editor, editor->history_back - 1);
+            break;
+        case 12: // Ctrl-L
+            lsh_buffer_insert(&editor->output, editor->output.size,
+                              "\033[H\033[2J", 7);
+            lsh_redraw(editor);
+            break;
+        case '\033':
+            return lsh_handle_escape(editor, input, size, consumed);
+        default:
+            if((unsigned char)c >= 32) {
+                // Insert whole UTF-8 sequences at once.
+                int length = 1;
+                while(length < size &&
+                      lsh_is_continuation_byte(input[length])) {
+                    length += 1;
+                }
+                lsh_buffer_insert(&editor->line, editor->cursor, input,
+                                  length);
+                editor->cursor += length;
+                *consumed = length;
+            }
+            break;
+    }
+    return KEY_CONTINUE;
+}
+
+// lsh_notify_jobs
+// Report the completed jobs below the line and draw the line again.
+//
+static void lsh_notify_jobs(Line_Editor* const editor) {
+    int const cursor = editor->cursor;
+    editor->cursor = editor->line.size;
+    lsh_refresh(editor);
+    editor->cursor = cursor;
+    lsh_buffer_insert(&editor->output, editor->output.size, "\r\n", 2);
+    lsh_flush(editor);
+    lsh_cleanup_jobs();
+    lsh_redraw(editor);
+}
+
+// lsh_wait_for_input
+// Block until the terminal is readable. Events that arrive in the meantime
+// are dispatched and completed jobs are reported immediately.
+//
+static void lsh_wait_for_input(Line_Editor* const editor,
+                               Shell const* const shell) {
+    struct pollfd fds[2] = {
+        {.fd = shell->terminal, .events = POLLIN},
+        {.fd = lsh_get_event_fd(), .events = POLLIN},
+    };
+    while(true) {
+        int const count = poll(fds, 2, -1);
+        if(count < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            // Let the read report the failure.
+            return;
+        }
+
+        if(fds[1].revents & POLLIN) {
+            lsh_dispatch_events();
+            if(lsh_has_job_notifications()) {
+                lsh_notify_jobs(editor);
+            }
+        }
+
+        if(fds[0].revents != 0) {
+            return;
+        }
+    }
+}
+
+int lsh_read_line(Shell const* const shell, char const* const prompt,
+                  char** const out_line) {
+    struct termios raw = shell->attributes;
+    raw.c_iflag &= ~(ICRNL | IXON | INLCR);
+    raw.c_lflag &= ~(ICANON | ECHO | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(shell->terminal, TCSADRAIN, &raw);
+
+    Line_Editor editor = {
+        .prompt = prompt,
+        .prompt_width = lsh_prompt_width(prompt),
+    };
+    lsh_history_sync();
+    lsh_redraw(&editor);
+
+    Key_Result result = KEY_CONTINUE;
+    while(result == KEY_CONTINUE || result == KEY_INCOMPLETE) {
+        if(pending_size == 0 || result == KEY_INCOMPLETE) {
+            if(pending_size == (int)sizeof(pending)) {
+                // Discard an overlong escape sequence.
+                pending_size = 0;
+            }
+
+            lsh_wait_for_input(&editor, shell);
+            ssize_t const size = read(shell->terminal, pending + pending_size,
+                                      sizeof(pending) - pending_size);
+            if(size < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if(size <= 0) {
+                result = KEY_EOF;
+                break;
+            }
+            pending_size += size;
+        }
+
+        // Apply everything that has arrived before redrawing once.
+        int offset = 0;
+        result = KEY_CONTINUE;
+        while(offset < pending_size && result == KEY_CONTINUE) {
+            int consumed = 0;
+            result = lsh_handle_key(&editor, pending + offset,
+                                    pending_size - offset, &consumed);
+            if(result != KEY_INCOMPLETE) {
+                offset += consumed;
+            }
+        }
+        memmove(pending, pending + offset, pending_size - offset);
+        pending_size -= offset;
+        lsh_refresh(&editor);
+    }
+
+    if(result == KEY_ACCEPT || result == KEY_CANCEL) {
+        if(result == KEY_CANCEL) {
+            lsh_buffer_insert(&editor.output, editor.output.size, "^C", 2);
+            editor.line.size = 0;
+        } else {
+            editor.cursor = editor.line.size;
+            lsh_refresh(&editor);
+        }
+        lsh_buffer_insert(&editor.output, editor.output.size, "\r\n", 2);
+        lsh_flush(&editor);
+    }
+    tcsetattr(shell->terminal, TCSADRAIN, &shell->attributes);
+
+    lsh_free_tagged(MEMORY_EDITOR, editor.shown.data);
+    lsh_free_tagged(MEMORY_EDITOR, editor.output.data);
+    lsh_free_tagged(MEMORY_EDITOR, editor.saved.data);
+    if(result == KEY_EOF && editor.line.size == 0) {
+        lsh_free_tagged(MEMORY_EDITOR, editor.line.data);
+        *out_line = NULL;
+        return -1;
+    }
+
+    int const size = editor.line.size;
+    if(size == 0) {
+        lsh_free_tagged(MEMORY_EDITOR, editor.line.data);
+        *out_line = NULL;
+        return 0;
+    }
+
+    lsh_buffer_reserve(&editor.line, size + 1);
+    editor.line.data[size] = '\0';
+    // The line belongs to the caller from now on.
+    lsh_memory_untrack(MEMORY_EDITOR, editor.line.data);
+    *out_line = editor.line.data;
+    return size;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <common.h>
+#include <shell.h>
+
+// lsh_read_line
+// Read a line from the terminal with line editing. The terminal is put in
+// raw mode derived from the attributes saved in the shell and restored before
+// returning. Every batch of input is answered with a single write that only
+// redraws the part of the line that changed.
+//
+// Supported keys: arrows, Home/End, Ctrl-A/E/B/F to move, Backspace, Delete,
+// Ctrl-D to delete (or end input on an empty line), Ctrl-K/U/W to kill,
+// Ctrl-Y to yank, Up/Down and Ctrl-P/N to recall history, Ctrl-L to clear
+// the screen and Ctrl-C to discard the line.
+//
+// Parameters:
+// prompt - the prompt. May contain SGR escape sequences.
+// line - receives the line or NULL if the line is empty. Caller must free it.
+//
+// Returns:
+// The length of the line or -1 on EOF.
+//
+int lsh_read_line(Shell const* shell, char const* prompt, char** line);
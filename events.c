@@ -0,0 +1,97 @@
+#include <events.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+typedef struct Event_Source {
+    Event_Handler handler;
+    void* context;
+} Event_Source;
+
+#define LSH_EVENTS_PER_DISPATCH 16
+
+static int event_fd = -1;
+// Indexed by the descriptor. A ready event whose source has been removed in
+// the meantime finds no handler and is dropped.
+static Event_Source* sources = NULL;
+static int source_capacity = 0;
+
+void lsh_events_initialise(void) {
+    // A forked child shares the epoll instance of its parent, therefore it
+    // starts over with an instance of its own.
+    if(event_fd >= 0) {
+        close(event_fd);
+        memset(sources, 0, source_capacity * sizeof(Event_Source));
+    }
+
+    event_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(event_fd < 0) {
+        perror("lsh_events_initialise: epoll_create1 failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int lsh_get_event_fd(void) {
+    return event_fd;
+}
+
+void lsh_add_event_source(int const fd, uint32_t const events,
+                          Event_Handler const handler, void* const context) {
+    if(fd >= source_capacity) {
+        int capacity = (source_capacity > 0 ? source_capacity : 16);
+        while(capacity <= fd) {
+            capacity *= 2;
+        }
+
+        Event_Source* const new_sources = lsh_realloc_tagged(
+            MEMORY_OTHER, sources, capacity * sizeof(Event_Source));
+        if(!new_sources) {
+            fprintf(stderr, "add_event_source: allocation failure");
+            exit(EXIT_FAILURE);
+        }
+        memset(new_sources + source_capacity, 0,
+               (capacity - source_capacity) * sizeof(Event_Source));
+        sources = new_sources;
+        source_capacity = capacity;
+    }
+
+    struct epoll_event event = {.events = events, .data.fd = fd};
+    if(epoll_ctl(event_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        perror("lsh_add_event_source: epoll_ctl failed");
+        return;
+    }
+    sources[fd] = (Event_Source){.handler = handler, .context = context};
+}
+
+void lsh_modify_event_source(int const fd, uint32_t const events) {
+    struct epoll_event event = {.events = events, .data.fd = fd};
+    epoll_ctl(event_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void lsh_remove_event_source(int const fd) {
+    if(fd < 0 || fd >= source_capacity || sources[fd].handler == NULL) {
+        return;
+    }
+
+    epoll_ctl(event_fd, EPOLL_CTL_DEL, fd, NULL);
+    sources[fd] = (Event_Source){0};
+}
+
+void lsh_dispatch_events(void) {
+    struct epoll_event events[LSH_EVENTS_PER_DISPATCH];
+    int count = 0;
+    do {
+        count = epoll_wait(event_fd, events, LSH_EVENTS_PER_DISPATCH, 0);
+    } while(count < 0 && errno == EINTR);
+
+    for(int i = 0; i < count; ++i) {
+        int const fd = events[i].data.fd;
+        if(fd < source_capacity && sources[fd].handler != NULL) {
+            sources[fd].handler(fd, events[i].events, sources[fd].context);
+        }
+    }
+}
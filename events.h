@@ -0,0 +1,45 @@
+#pragma once
+
+#include <common.h>
+
+#include <stdint.h>
+
+// lsh_events_initialise
+// Create the event loop. Must be called before sources are added. Called
+// again in a forked child, it gives the child a loop of its own without the
+// sources of the parent.
+//
+void lsh_events_initialise(void);
+
+// lsh_get_event_fd
+// File descriptor that becomes readable when any source is ready. The loop
+// blocks on it with poll and then calls lsh_dispatch_events.
+//
+int lsh_get_event_fd(void);
+
+// Event_Handler
+// Called with the ready events (EPOLLIN, EPOLLOUT, ...) of the source.
+//
+typedef void (*Event_Handler)(int fd, uint32_t events, void* context);
+
+// lsh_add_event_source
+// Watch fd for the events. A source may be added or removed from within any
+// handler.
+//
+void lsh_add_event_source(int fd, uint32_t events, Event_Handler handler,
+                          void* context);
+
+// lsh_modify_event_source
+// Change the events that the source is watched for.
+//
+void lsh_modify_event_source(int fd, uint32_t events);
+
+// lsh_remove_event_source
+// Stop watching fd. The descriptor is not closed.
+//
+void lsh_remove_event_source(int fd);
+
+// lsh_dispatch_events
+// Call the handlers of all the ready sources without blocking.
+//
+void lsh_dispatch_events(void);
@@ -0,0 +1,595 @@
+#include <expand.h>
+
+#include <globbing.h>
+#include <jobs.h>
+#include <parser.h>
+#include <vars.h>
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Expansion_Dependency flags accumulated since they were last taken.
+static int dependencies = 0;
+// Descriptors of process substitutions opened since they were last taken,
+// terminated by -1.
+static int* substitution_fds = NULL;
+static int substitution_fd_count = 0;
+
+int lsh_take_expansion_dependencies(void) {
+    int const result = dependencies;
+    dependencies = 0;
+    return result;
+}
+
+int* lsh_take_substitution_fds(void) {
+    int* const result = substitution_fds;
+    substitution_fds = NULL;
+    substitution_fd_count = 0;
+    return result;
+}
+
+void lsh_close_substitution_fds(int* const fds) {
+    if(fds == NULL) {
+        return;
+    }
+
+    for(int const* i = fds; *i >= 0; ++i) {
+        close(*i);
+    }
+    lsh_free_tagged(MEMORY_PARSER, fds);
+}
+
+static void lsh_push_substitution_fd(int const fd) {
+    substitution_fds =
+        lsh_realloc_tagged(MEMORY_PARSER, substitution_fds,
+                           (substitution_fd_count + 2) * sizeof(int));
+    if(!substitution_fds) {
+        fprintf(stderr, "push_substitution_fd: allocation failure");
+        exit(EXIT_FAILURE);
+    }
+
+    substitution_fds[substitution_fd_count] = fd;
+    substitution_fds[substitution_fd_count + 1] = -1;
+    substitution_fd_count += 1;
+}
+
+void lsh_word_list_push(Word_List* const list, char* const word) {
+    if(list->size + 2 >= list->capacity) {
+        list->capacity = (list->capacity == 0 ? 64 : list->capacity * 2);
+        list->values = lsh_realloc_tagged(MEMORY_PARSER, list->values,
+                                          list->capacity * sizeof(char*));
+        if(!list->values) {
+            fprintf(stderr, "word_list_push: allocation failure");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    list->values[list->size] = word;
+    list->values[list->size + 1] = NULL;
+    list->size += 1;
+}
+
+static char const* lsh_skip_quoted(char const* begin) {
+    char const quote = *begin;
+    for(++begin; *begin != '\0'; ++begin) {
+        if(*begin == quote) {
+            return begin + 1;
+        }
+
+        if(quote == '"' && *begin == '\\' && begin[1] != '\0') {
+            ++begin;
+        }
+    }
+    return NULL;
+}
+
+char const* lsh_skip_substitution(char const* begin) {
+    if(*begin == '`') {
+        for(++begin; *begin != '\0'; ++begin) {
+            if(*begin == '`') {
+                return begin + 1;
+            }
+
+            if(*begin == '\\' && begin[1] != '\0') {
+                ++begin;
+            }
+        }
+        return NULL;
+    }
+
+    int depth = 1;
+    for(begin += 2; *begin != '\0';) {
+        if(*begin == '\'' || *begin == '"') {
+            begin = lsh_skip_quoted(begin);
+            if(begin == NULL) {
+                return NULL;
+            }
+        } else if(*begin == '`') {
+            begin = lsh_skip_substitution(begin);
+            if(begin == NULL) {
+                return NULL;
+            }
+        } else if(*begin == '\\' && begin[1] != '\0') {
+            begin += 2;
+        } else if(*begin == '(') {
+            depth += 1;
+            ++begin;
+        } else if(*begin == ')') {
+            depth -= 1;
+            ++begin;
+            if(depth == 0) {
+                return begin;
+            }
+        } else {
+            ++begin;
+        }
+    }
+    return NULL;
+}
+
+typedef struct Word_Builder {
+    char* data;
+    int size;
+    int capacity;
+    // A substitution field that makes up the whole word so far. It already
+    // lives in the arena and is null-terminated, therefore we push it as is
+    // unless something else is appended to the word.
+    char* borrowed;
+    bool borrowed_quoted;
+    bool started;
+    // The word contains unquoted pattern characters and is globbed.
+    bool glob;
+    // Quoted pattern characters and backslashes are escaped with a backslash
+    // in data so that the word can be used as a pattern.
+    int escapes;
+} Word_Builder;
+
+static void lsh_builder_append(Word_Builder* const builder,
+                               char const* const begin, char const* const end,
+                               bool const quoted) {
+    if(builder->borrowed != NULL) {
+        char* const borrowed = builder->borrowed;
+        builder->borrowed = NULL;
+        lsh_builder_append(builder, borrowed, borrowed + strlen(borrowed),
+                           builder->borrowed_quoted);
+    }
+
+    // Every character might need escaping.
+    int const size = 2 * (end - begin);
+    if(builder->size + size >= builder->capacity) {
+        while(builder->size + size >= builder->capacity) {
+            builder->capacity =
+                (builder->capacity == 0 ? 128 : builder->capacity * 2);
+        }
+        builder->data =
+            lsh_realloc_tagged(MEMORY_PARSER, builder->data, builder->capacity);
+        if(!builder->data) {
+            fprintf(stderr, "expand_word: allocation failure");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for(char const* i = begin; i != end; ++i) {
+        if(*i == '\\' || (quoted && lsh_is_glob_character(*i))) {
+            builder->data[builder->size] = '\\';
+            builder->size += 1;
+            builder->escapes += 1;
+        } else if(lsh_is_glob_character(*i)) {
+            builder->glob = true;
+        }
+        builder->data[builder->size] = *i;
+        builder->size += 1;
+    }
+    builder->started = true;
+}
+
+static void lsh_builder_add_field(Word_Builder* const builder,
+                                  char* const begin, char* const end,
+                                  bool const quoted) {
+    if(!builder->started) {
+        builder->borrowed = begin;
+        builder->borrowed_quoted = quoted;
+        builder->started = true;
+        if(!quoted) {
+            for(char const* i = begin; i != end; ++i) {
+                builder->glob |= lsh_is_glob_character(*i);
+            }
+        }
+    } else {
+        lsh_builder_append(builder, begin, end, quoted);
+    }
+}
+
+// lsh_builder_literal
+// Copy the word into the arena removing the escapes.
+//
+static char* lsh_builder_literal(Word_Builder const* const builder,
+                                 Arena* const arena) {
+    char const* const begin = builder->data;
+    char const* const end = builder->data + builder->size;
+    if(builder->escapes == 0) {
+        return lsh_arena_alloc_from_slice(arena, begin, end);
+    }
+
+    char* const word = lsh_arena_alloc(arena, builder->size + 1);
+    char* o = word;
+    for(char const* i = begin; i != end; ++i) {
+        if(*i == '\\') {
+            ++i;
+        }
+        *o = *i;
+        ++o;
+    }
+    *o = '\0';
+    return word;
+}
+
+static void lsh_builder_finish(Word_Builder* const builder, Arena* const arena,
+                               Word_List* const list) {
+    if(builder->glob) {
+        char* pattern = builder->borrowed;
+        if(pattern == NULL) {
+            // append reserves room for escapes, therefore there is space for
+            // the terminator.
+            builder->data[builder->size] = '\0';
+            pattern = builder->data;
+        }
+
+        // A pattern that matches nothing is left as is.
+        dependencies |= EXPANSION_GLOBS;
+        if(lsh_glob(pattern, arena, list) == 0) {
+            lsh_word_list_push(list, builder->borrowed != NULL
+                                         ? builder->borrowed
+                                         : lsh_builder_literal(builder, arena));
+        }
+    } else if(builder->borrowed != NULL) {
+        lsh_word_list_push(list, builder->borrowed);
+    } else if(builder->started) {
+        lsh_word_list_push(list, lsh_builder_literal(builder, arena));
+    }
+
+    builder->size = 0;
+    builder->borrowed = NULL;
+    builder->started = false;
+    builder->glob = false;
+    builder->escapes = 0;
+}
+
+static bool lsh_is_field_separator(char const c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+// lsh_split_fields
+// Split the output of an unquoted substitution into fields. Separators are
+// overwritten with null terminators so that fields need not be copied.
+//
+static void lsh_split_fields(Word_Builder* const builder, char* output,
+                             Arena* const arena, Word_List* const list) {
+    while(*output != '\0') {
+        if(lsh_is_field_separator(*output)) {
+            lsh_builder_finish(builder, arena, list);
+            ++output;
+            continue;
+        }
+
+        char* const field = output;
+        while(*output != '\0' && !lsh_is_field_separator(*output)) {
+            ++output;
+        }
+
+        if(*output != '\0') {
+            *output = '\0';
+            lsh_builder_add_field(builder, field, output, false);
+            lsh_builder_finish(builder, arena, list);
+            ++output;
+        } else {
+            // The last field may be continued by the rest of the word.
+            lsh_builder_add_field(builder, field, output, false);
+        }
+    }
+}
+
+// lsh_create_substitution_job
+// Parse the command of a substitution into a job. The descriptors of process
+// substitutions of the enclosing word are set aside while the command is
+// parsed, so that its own substitutions go to its processes.
+//
+// Returns:
+// The job or NULL if the command is malformed.
+//
+static Job* lsh_create_substitution_job(Shell* const shell, char const* begin,
+                                        char const* const end,
+                                        bool const backquoted) {
+    dependencies |= EXPANSION_SUBSTITUTIONS;
+    char* const command_string = lsh_alloc_and_zero(end - begin + 1);
+    char* i = command_string;
+    for(; begin != end; ++begin) {
+        // Within backquotes a backslash escapes `, \ and $.
+        if(backquoted && *begin == '\\' && begin + 1 != end &&
+           (begin[1] == '`' || begin[1] == '\\' || begin[1] == '$')) {
+            ++begin;
+        }
+        *i = *begin;
+        ++i;
+    }
+
+    int* const outer_fds = substitution_fds;
+    int const outer_fd_count = substitution_fd_count;
+    substitution_fds = NULL;
+    substitution_fd_count = 0;
+    Parse_Result parse_result = lsh_parse(shell, command_string);
+    substitution_fds = outer_fds;
+    substitution_fd_count = outer_fd_count;
+    if(parse_result.kind == PARSE_ERROR) {
+        fprintf(stderr, "lsh: %s\n", parse_result.error);
+        free(parse_result.error);
+        free(command_string);
+        return NULL;
+    }
+
+    Command command = parse_result.value;
+    Job* const job = lsh_create_job(command_string);
+    lsh_create_processes_from_command(job, command);
+    lsh_free_command(command);
+    return job;
+}
+
+// lsh_command_substitute
+// Run the command as a job with its output captured into the arena.
+//
+// Returns:
+// The captured output or NULL on failure.
+//
+static char* lsh_command_substitute(Shell* const shell, char const* begin,
+                                    char const* const end,
+                                    bool const backquoted, Arena* const arena,
+                                    size_t* const size) {
+    Job* const job = lsh_create_substitution_job(shell, begin, end, backquoted);
+    if(job == NULL) {
+        return NULL;
+    }
+
+    char* const output = lsh_run_job_captured(shell, job, arena, size);
+    lsh_remove_job(job);
+    return output;
+}
+
+// lsh_process_substitute
+// Start the command in the background with its standard output, or its
+// standard input if output is set, connected to a pipe. The process
+// substitution is not a job of the shell, its processes are reaped without
+// notice.
+//
+// Returns:
+// The /dev/fd path of the other end of the pipe allocated in the arena or
+// NULL on failure.
+//
+static char* lsh_process_substitute(Shell* const shell, char const* const begin,
+                                    char const* const end, bool const output,
+                                    Arena* const arena) {
+    Job* const job = lsh_create_substitution_job(shell, begin, end, false);
+    if(job == NULL) {
+        return NULL;
+    }
+
+    int fd_pipe[2];
+    if(pipe2(fd_pipe, O_CLOEXEC) < 0) {
+        perror("lsh_process_substitute: pipe failed");
+        lsh_remove_job(job);
+        return NULL;
+    }
+
+    // The launch closes the end given to the job once it has been spawned.
+    int const kept = (output ? fd_pipe[1] : fd_pipe[0]);
+    int const given = (output ? fd_pipe[0] : fd_pipe[1]);
+    Process* const process =
+        (job->process_count == 0
+             ? NULL
+             : &job->processes[output ? 0 : job->process_count - 1]);
+    int* const target = (process == NULL ? NULL
+                         : output        ? &process->fd.in
+                                         : &process->fd.out);
+    if(target != NULL && *target == (output ? STDIN_FILENO : STDOUT_FILENO)) {
+        *target = given;
+    } else {
+        close(given);
+    }
+
+    lsh_start_job(shell, job, false);
+    lsh_remove_job(job);
+    lsh_push_substitution_fd(kept);
+
+    char path[32];
+    int const length = snprintf(path, sizeof(path), "/dev/fd/%d", kept);
+    return lsh_arena_alloc_from_slice(arena, path, path + length);
+}
+
+static bool lsh_is_name_character(char const c) {
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+           (c >= 'a' && c <= 'z') || c == '_';
+}
+
+char const* lsh_skip_parameter(char const* begin) {
+    if(begin[1] == '{') {
+        char const* const close = strchr(begin, '}');
+        return close != NULL ? close + 1 : NULL;
+    }
+
+    for(++begin; lsh_is_name_character(*begin); ++begin) {}
+    return begin;
+}
+
+// lsh_expand_parameter
+// Expand $NAME or ${NAME}.
+//
+// Returns:
+// Pointer past the parameter or NULL if the parameter is malformed.
+//
+static char const* lsh_expand_parameter(char const* const begin,
+                                        char const* const end,
+                                        bool const split,
+                                        Word_Builder* const builder,
+                                        Arena* const arena,
+                                        Word_List* const list) {
+    char const* const next = lsh_skip_parameter(begin);
+    if(next == NULL || next > end) {
+        return NULL;
+    }
+
+    bool const braced = (begin[1] == '{');
+    char const* const name_begin = begin + (braced ? 2 : 1);
+    char const* const name_end = next - (braced ? 1 : 0);
+    if(!lsh_is_variable_name(name_begin, name_end)) {
+        return NULL;
+    }
+
+    dependencies |= EXPANSION_VARIABLES;
+    char const* const value = lsh_get_variable(name_begin, name_end);
+    if(value == NULL) {
+        return next;
+    }
+
+    char const* const value_end = value + strlen(value);
+    if(split) {
+        // The store owns the value, therefore we copy it once to split it in
+        // place.
+        char* const copy = lsh_arena_alloc_from_slice(arena, value, value_end);
+        lsh_split_fields(builder, copy, arena, list);
+    } else {
+        lsh_builder_append(builder, value, value_end, true);
+    }
+    return next;
+}
+
+// lsh_expand
+// Parameters:
+// split - whether unquoted expansions are split into fields.
+//
+static bool lsh_expand(Shell* const shell, char const* const begin,
+                       char const* const end, bool const split,
+                       Arena* const arena, Word_List* const list) {
+    Word_Builder builder = {0};
+    char quote = '\0';
+    bool result = true;
+    for(char const* i = begin; i != end;) {
+        char const c = *i;
+        if(quote == '\'') {
+            if(c == '\'') {
+                quote = '\0';
+            } else {
+                lsh_builder_append(&builder, i, i + 1, true);
+            }
+            ++i;
+            continue;
+        }
+
+        if(c == '$' && i + 1 != end &&
+           (i[1] == '{' || (lsh_is_name_character(i[1]) &&
+                            !(i[1] >= '0' && i[1] <= '9')))) {
+            i = lsh_expand_parameter(i, end, split && quote != '"', &builder,
+                                     arena, list);
+            if(i == NULL) {
+                result = false;
+                break;
+            }
+            continue;
+        }
+
+        if((c == '$' && i + 1 != end && i[1] == '(') || c == '`') {
+            char const* const next = lsh_skip_substitution(i);
+            if(next == NULL || next > end) {
+                result = false;
+                break;
+            }
+
+            bool const backquoted = (c == '`');
+            size_t size = 0;
+            char* const output = lsh_command_substitute(
+                shell, i + (backquoted ? 1 : 2), next - 1, backquoted, arena,
+                &size);
+            if(output == NULL) {
+                result = false;
+                break;
+            }
+
+            while(size > 0 && output[size - 1] == '\n') {
+                size -= 1;
+                output[size] = '\0';
+            }
+
+            if(quote == '"' || !split) {
+                lsh_builder_add_field(&builder, output, output + size, true);
+            } else {
+                lsh_split_fields(&builder, output, arena, list);
+            }
+            i = next;
+            continue;
+        }
+
+        if((c == '<' || c == '>') && quote == '\0' && i + 1 != end &&
+           i[1] == '(') {
+            char const* const next = lsh_skip_substitution(i);
+            if(next == NULL || next > end) {
+                result = false;
+                break;
+            }
+
+            char* const path =
+                lsh_process_substitute(shell, i + 2, next - 1, c == '>', arena);
+            if(path == NULL) {
+                result = false;
+                break;
+            }
+
+            lsh_builder_add_field(&builder, path, path + strlen(path), true);
+            i = next;
+            continue;
+        }
+
+        if(quote == '"') {
+            if(c == '"') {
+                quote = '\0';
+            } else {
+                lsh_builder_append(&builder, i, i + 1, true);
+            }
+            ++i;
+            continue;
+        }
+
+        if(c == '"' || c == '\'') {
+            quote = c;
+            builder.started = true;
+        } else {
+            // Assignments are never globbed.
+            lsh_builder_append(&builder, i, i + 1, !split);
+        }
+        ++i;
+    }
+
+    if(result) {
+        lsh_builder_finish(&builder, arena, list);
+    }
+    lsh_free_tagged(MEMORY_PARSER, builder.data);
+    return result;
+}
+
+bool lsh_expand_word(Shell* const shell, char const* const begin,
+                     char const* const end, Arena* const arena,
+                     Word_List* const list) {
+    return lsh_expand(shell, begin, end, true, arena, list);
+}
+
+char* lsh_expand_assignment(Shell* const shell, char const* const begin,
+                            char const* const end, Arena* const arena) {
+    Word_List words = {0};
+    char* assignment = NULL;
+    if(lsh_expand(shell, begin, end, false, arena, &words)) {
+        assignment = words.values[0];
+    }
+    lsh_free_tagged(MEMORY_PARSER, words.values);
+    return assignment;
+}
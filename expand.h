@@ -0,0 +1,99 @@
+#pragma once
+
+#include <common.h>
+#include <shell.h>
+
+typedef struct Word_List {
+    char** values;
+    int size;
+    int capacity;
+} Word_List;
+
+// lsh_word_list_push
+// Append a word to the list keeping the list null-terminated.
+//
+void lsh_word_list_push(Word_List* list, char* word);
+
+// lsh_skip_substitution
+// Find the end of a command or process substitution.
+//
+// Parameters:
+// begin - pointer to the "$(", "`", "<(" or ">(" that opens the substitution
+//         within a null-terminated string.
+//
+// Returns:
+// Pointer one past the closing delimiter or NULL if the substitution is not
+// terminated.
+//
+char const* lsh_skip_substitution(char const* begin);
+
+// lsh_skip_parameter
+// Find the end of a parameter expansion.
+//
+// Parameters:
+// begin - pointer to the "$" of $NAME or ${NAME} within a null-terminated
+//         string.
+//
+// Returns:
+// Pointer past the parameter or NULL if the closing brace is missing.
+//
+char const* lsh_skip_parameter(char const* begin);
+
+typedef enum Expansion_Dependency {
+    // A variable was substituted.
+    EXPANSION_VARIABLES = 1,
+    // A pattern was matched against the file system.
+    EXPANSION_GLOBS = 2,
+    // A command or process substitution was run.
+    EXPANSION_SUBSTITUTIONS = 4,
+} Expansion_Dependency;
+
+// lsh_take_expansion_dependencies
+// Obtain the state that expansions depended on since the last call.
+//
+// Returns:
+// A combination of Expansion_Dependency flags.
+//
+int lsh_take_expansion_dependencies(void);
+
+// lsh_take_substitution_fds
+// Obtain the descriptors that process substitutions opened since the last
+// call. They are closed on exec and must be inherited by the process that
+// receives their /dev/fd paths only.
+//
+// Returns:
+// The descriptors terminated by -1 or NULL if there are none.
+//
+int* lsh_take_substitution_fds(void);
+
+// lsh_close_substitution_fds
+// Close and free descriptors obtained from lsh_take_substitution_fds.
+//
+void lsh_close_substitution_fds(int* fds);
+
+// lsh_expand_word
+// Expand a single word of the command line and append the resulting fields to
+// the list. Quotes are removed, variables ($NAME and ${NAME}) are substituted
+// and command substitutions ($(...) and `...`) are run. Unquoted substitution
+// output is split on whitespace in place, therefore fields that form whole
+// words point directly into the captured output instead of being copied.
+// Process substitutions (<(...) and >(...)) start their command in the
+// background and expand to a /dev/fd path of a pipe connected to it.
+//
+// Parameters:
+// arena - owns the resulting words.
+//
+// Returns:
+// false if the word is malformed or a substitution failed.
+//
+bool lsh_expand_word(Shell* shell, char const* begin, char const* end,
+                     Arena* arena, Word_List* list);
+
+// lsh_expand_assignment
+// Expand a NAME=value word. The result is never split into fields.
+//
+// Returns:
+// The expanded assignment owned by the arena or NULL on error.
+//
+char* lsh_expand_assignment(Shell* shell, char const* begin, char const* end,
+                            Arena* arena);
@@ -0,0 +1,575 @@
+#include <globbing.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+bool lsh_is_glob_character(char const c) {
+    return c == '*' || c == '?' || c == '[';
+}
+
+typedef enum Glob_Token_Kind {
+    GLOB_CHARACTER,
+    GLOB_ANY,
+    GLOB_CLASS,
+    GLOB_STAR,
+} Glob_Token_Kind;
+
+typedef struct Glob_Token {
+    Glob_Token_Kind kind;
+    unsigned char character;
+    // Bitmap of the bytes matched by GLOB_CLASS.
+    uint8_t class[32];
+} Glob_Token;
+
+// Glob_Pattern
+// A single path component compiled into tokens. Stars split the tokens into
+// fixed-width segments. The first segment is anchored at the start of the
+// name, the last at the end and the middle segments are placed at their
+// leftmost match, which is always sufficient for glob patterns, so a name is
+// matched without backtracking.
+//
+typedef struct Glob_Pattern {
+    Glob_Token* tokens;
+    int size;
+    int capacity;
+    int* segments;
+    int segment_count;
+    bool has_star;
+    // Names beginning with a dot only match a literal dot.
+    bool matches_hidden;
+} Glob_Pattern;
+
+static Glob_Token* lsh_pattern_push(Glob_Pattern* const pattern,
+                                    Glob_Token_Kind const kind) {
+    if(pattern->size == pattern->capacity) {
+        pattern->capacity =
+            (pattern->capacity == 0 ? 16 : pattern->capacity * 2);
+        pattern->tokens =
+            realloc(pattern->tokens, pattern->capacity * sizeof(Glob_Token));
+        if(!pattern->tokens) {
+            fprintf(stderr, "glob: allocation failure");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    Glob_Token* const token = &pattern->tokens[pattern->size];
+    pattern->size += 1;
+    token->kind = kind;
+    return token;
+}
+
+// lsh_compile_class
+// Compile the bracket expression at begin.
+//
+// Returns:
+// Pointer past the closing bracket or NULL if the bracket is not closed.
+//
+static char const* lsh_compile_class(char const* begin, char const* const end,
+                                     uint8_t* const class) {
+    memset(class, 0, 32);
+    ++begin;
+    bool negated = false;
+    if(begin != end && (*begin == '!' || *begin == '^')) {
+        negated = true;
+        ++begin;
+    }
+
+    bool first = true;
+    while(begin != end && (*begin != ']' || first)) {
+        first = false;
+        unsigned char low = *begin;
+        if(low == '\\' && begin + 1 != end) {
+            ++begin;
+            low = *begin;
+        }
+        ++begin;
+
+        unsigned char high = low;
+        if(begin + 1 < end && *begin == '-' && begin[1] != ']') {
+            ++begin;
+            if(*begin == '\\' && begin + 1 != end) {
+                ++begin;
+            }
+            high = *begin;
+            ++begin;
+        }
+
+        for(unsigned int c = low; c <= high; ++c) {
+            class[c / 8] |= 1 << (c % 8);
+        }
+    }
+
+    if(begin == end) {
+        return NULL;
+    }
+
+    if(negated) {
+        for(int i = 0; i < 32; ++i) {
+            class[i] = ~class[i];
+        }
+    }
+    return begin + 1;
+}
+
+static void lsh_compile_pattern(Glob_Pattern* const pattern,
+                                char const* begin, char const* const end) {
+    pattern->size = 0;
+    pattern->has_star = false;
+    pattern->matches_hidden = (begin != end && *begin == '.');
+    while(begin != end) {
+        char const c = *begin;
+        if(c == '*') {
+            if(pattern->size == 0 ||
+               pattern->tokens[pattern->size - 1].kind != GLOB_STAR) {
+                lsh_pattern_push(pattern, GLOB_STAR);
+            }
+            pattern->has_star = true;
+            ++begin;
+        } else if(c == '?') {
+            lsh_pattern_push(pattern, GLOB_ANY);
+            ++begin;
+        } else if(c == '[') {
+            Glob_Token* const token = lsh_pattern_push(pattern, GLOB_CLASS);
+            char const* const next =
+                lsh_compile_class(begin, end, token->class);
+            if(next == NULL) {
+                token->kind = GLOB_CHARACTER;
+                token->character = '[';
+                ++begin;
+            } else {
+                begin = next;
+            }
+        } else {
+            if(c == '\\' && begin + 1 != end) {
+                ++begin;
+            }
+            Glob_Token* const token =
+                lsh_pattern_push(pattern, GLOB_CHARACTER);
+            token->character = *begin;
+            ++begin;
+        }
+    }
+
+    // Segment i spans the tokens [segments[i], segments[i + 1]) minus the
+    // star that terminates it.
+    free(pattern->segments);
+    pattern->segments = lsh_alloc_and_zero((pattern->size + 2) * sizeof(int));
+    pattern->segment_count = 0;
+    pattern->segments[0] = 0;
+    for(int i = 0; i < pattern->size; ++i) {
+        if(pattern->tokens[i].kind == GLOB_STAR) {
+            pattern->segment_count += 1;
+            pattern->segments[pattern->segment_count] = i + 1;
+        }
+    }
+    pattern->segment_count += 1;
+    pattern->segments[pattern->segment_count] = pattern->size + 1;
+}
+
+static bool lsh_match_token(Glob_Token const* const token,
+                            unsigned char const c) {
+    switch(token->kind) {
+        case GLOB_CHARACTER:
+            return token->character == c;
+        case GLOB_ANY:
+            return true;
+        case GLOB_CLASS:
+            return (token->class[c / 8] >> (c % 8)) & 1;
+        case GLOB_STAR:
+            break;
+    }
+    return false;
+}
+
+static bool lsh_match_segment(Glob_Token const* const tokens, int const size,
+                              char const* const name) {
+    for(int i = 0; i < size; ++i) {
+        if(!lsh_match_token(&tokens[i], name[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool lsh_match_pattern(Glob_Pattern const* const pattern,
+                              char const* const name, int const length) {
+    if(name[0] == '.' && !pattern->matches_hidden) {
+        return false;
+    }
+
+    Glob_Token const* const tokens = pattern->tokens;
+    if(!pattern->has_star) {
+        return length == pattern->size &&
+               lsh_match_segment(tokens, length, name);
+    }
+
+    int const last = pattern->segment_count - 1;
+    int const head_size = pattern->segments[1] - 1;
+    int const tail_begin = pattern->segments[last];
+    int const tail_size = pattern->size - tail_begin;
+    if(head_size + tail_size > length ||
+       !lsh_match_segment(tokens, head_size, name) ||
+       !lsh_match_segment(tokens + tail_begin, tail_size,
+                          name + length - tail_size)) {
+        return false;
+    }
+
+    int position = head_size;
+    int const limit = length - tail_size;
+    for(int segment = 1; segment < last; ++segment) {
+        int const begin = pattern->segments[segment];
+        int const size = pattern->segments[segment + 1] - 1 - begin;
+        while(true) {
+            if(position + size > limit) {
+                return false;
+            }
+
+            if(lsh_match_segment(tokens + begin, size, name + position)) {
+                break;
+            }
+            position += 1;
+        }
+        position += size;
+    }
+    return true;
+}
+
+typedef struct Directory_Listing {
+    char* path;
+    dev_t device;
+    ino_t inode;
+    struct timespec modified;
+    time_t loaded;
+    unsigned long last_used;
+    // Names packed one after another, each null-terminated.
+    char* names;
+    int names_size;
+    int names_capacity;
+    int* offsets;
+    unsigned short* lengths;
+    unsigned char* types;
+    int count;
+    int capacity;
+} Directory_Listing;
+
+#define LSH_GLOB_CACHE_SIZE 16
+// Listings older than this many seconds are read again.
+#define LSH_GLOB_CACHE_TTL 10
+#define LSH_GETDENTS_BUFFER_SIZE (256 * 1024)
+
+static Directory_Listing listing_cache[LSH_GLOB_CACHE_SIZE];
+static unsigned long listing_clock = 0;
+static char* getdents_buffer = NULL;
+
+typedef struct Linux_Dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} Linux_Dirent64;
+
+static void lsh_listing_push(Directory_Listing* const listing,
+                             char const* const name, int const length,
+                             unsigned char const type) {
+    if(listing->count == listing->capacity) {
+        listing->capacity =
+            (listing->capacity == 0 ? 64 : listing->capacity * 2);
+        listing->offsets =
+            lsh_realloc_tagged(MEMORY_PARSER, listing->offsets,
+                               listing->capacity * sizeof(int));
+        listing->lengths =
+            lsh_realloc_tagged(MEMORY_PARSER, listing->lengths,
+                               listing->capacity * sizeof(unsigned short));
+        listing->types = lsh_realloc_tagged(MEMORY_PARSER, listing->types,
+                                            listing->capacity);
+        if(!listing->offsets || !listing->lengths || !listing->types) {
+            fprintf(stderr, "glob: allocation failure");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(listing->names_size + length + 1 > listing->names_capacity) {
+        while(listing->names_size + length + 1 > listing->names_capacity) {
+            listing->names_capacity = (listing->names_capacity == 0
+                                           ? 4096
+                                           : listing->names_capacity * 2);
+        }
+        listing->names = lsh_realloc_tagged(MEMORY_PARSER, listing->names,
+                                            listing->names_capacity);
+        if(!listing->names) {
+            fprintf(stderr, "glob: allocation failure");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    listing->offsets[listing->count] = listing->names_size;
+    listing->lengths[listing->count] = length;
+    listing->types[listing->count] = type;
+    memcpy(listing->names + listing->names_size, name, length + 1);
+    listing->names_size += length + 1;
+    listing->count += 1;
+}
+
+static bool lsh_read_listing(Directory_Listing* const listing,
+                             char const* const path) {
+    int const fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+
+    if(getdents_buffer == NULL) {
+        getdents_buffer =
+            lsh_alloc_tagged(MEMORY_PARSER, LSH_GETDENTS_BUFFER_SIZE);
+    }
+
+    listing->count = 0;
+    listing->names_size = 0;
+    while(true) {
+        ssize_t const size =
+            getdents64(fd, getdents_buffer, LSH_GETDENTS_BUFFER_SIZE);
+        if(size <= 0) {
+            break;
+        }
+
+        for(ssize_t offset = 0; offset < size;) {
+            Linux_Dirent64 const* const entry =
+                (Linux_Dirent64 const*)(getdents_buffer + offset);
+            offset += entry->d_reclen;
+            char const* const name = entry->d_name;
+            if(name[0] == '.' &&
+               (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            lsh_listing_push(listing, name, strlen(name), entry->d_type);
+        }
+    }
+    close(fd);
+    return true;
+}
+
+// lsh_get_listing
+// Obtain the entries of a directory, reusing the cached listing while the
+// directory has not been modified.
+//
+static Directory_Listing* lsh_get_listing(char const* const path) {
+    struct stat info;
+    if(stat(path, &info) != 0 || !S_ISDIR(info.st_mode)) {
+        return NULL;
+    }
+
+    time_t const now = time(NULL);
+    listing_clock += 1;
+    Directory_Listing* victim = &listing_cache[0];
+    for(int i = 0; i < LSH_GLOB_CACHE_SIZE; ++i) {
+        Directory_Listing* const listing = &listing_cache[i];
+        if(listing->path != NULL && strcmp(listing->path, path) == 0) {
+            // A modification within the second the listing was read might
+            // share its timestamp, therefore such listings are not trusted.
+            if(listing->device == info.st_dev &&
+               listing->inode == info.st_ino &&
+               listing->modified.tv_sec == info.st_mtim.tv_sec &&
+               listing->modified.tv_nsec == info.st_mtim.tv_nsec &&
+               info.st_mtim.tv_sec < listing->loaded &&
+               now - listing->loaded < LSH_GLOB_CACHE_TTL) {
+                listing->last_used = listing_clock;
+                return listing;
+            }
+            victim = listing;
+            break;
+        }
+
+        if(listing->last_used < victim->last_used) {
+            victim = listing;
+        }
+    }
+
+    if(victim->path == NULL || strcmp(victim->path, path) != 0) {
+        lsh_free_tagged(MEMORY_PARSER, victim->path);
+        victim->path = lsh_allocate_from_slice(path, path + strlen(path) + 1);
+        lsh_memory_track(MEMORY_PARSER, victim->path);
+    }
+
+    victim->device = info.st_dev;
+    victim->inode = info.st_ino;
+    victim->modified = info.st_mtim;
+    victim->loaded = now;
+    victim->last_used = listing_clock;
+    if(!lsh_read_listing(victim, path)) {
+        lsh_free_tagged(MEMORY_PARSER, victim->path);
+        victim->path = NULL;
+        victim->last_used = 0;
+        return NULL;
+    }
+    return victim;
+}
+
+typedef struct Glob_State {
+    Arena* arena;
+    Word_List* list;
+    char* path;
+    int path_capacity;
+    Glob_Pattern pattern;
+    int matches;
+} Glob_State;
+
+static void lsh_path_reserve(Glob_State* const state, int const size) {
+    if(size + 1 > state->path_capacity) {
+        while(size + 1 > state->path_capacity) {
+            state->path_capacity =
+                (state->path_capacity == 0 ? 256 : state->path_capacity * 2);
+        }
+        state->path = realloc(state->path, state->path_capacity);
+        if(!state->path) {
+            fprintf(stderr, "glob: allocation failure");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static bool lsh_has_glob_characters(char const* begin, char const* const end) {
+    for(; begin != end; ++begin) {
+        if(*begin == '\\' && begin + 1 != end) {
+            ++begin;
+        } else if(lsh_is_glob_character(*begin)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void lsh_glob_match_path(Glob_State* const state, int const path_size) {
+    lsh_word_list_push(state->list,
+                       lsh_arena_alloc_from_slice(state->arena, state->path,
+                                                  state->path + path_size));
+    state->matches += 1;
+}
+
+static bool lsh_is_directory(char const* const path, unsigned char const type) {
+    if(type == DT_DIR) {
+        return true;
+    }
+
+    if(type != DT_LNK && type != DT_UNKNOWN) {
+        return false;
+    }
+
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+// lsh_glob_walk
+// Match the remaining components of the pattern below the path built so far.
+//
+static void lsh_glob_walk(Glob_State* const state, int path_size,
+                          char const* pattern) {
+    while(*pattern == '/') {
+        lsh_path_reserve(state, path_size + 1);
+        state->path[path_size] = '/';
+        path_size += 1;
+        ++pattern;
+    }
+
+    if(*pattern == '\0') {
+        lsh_glob_match_path(state, path_size);
+        return;
+    }
+
+    char const* component_end = strchr(pattern, '/');
+    if(component_end == NULL) {
+        component_end = pattern + strlen(pattern);
+    }
+
+    if(!lsh_has_glob_characters(pattern, component_end)) {
+        // Literal components are appended without reading the directory.
+        for(char const* i = pattern; i != component_end; ++i) {
+            if(*i == '\\' && i + 1 != component_end) {
+                ++i;
+            }
+            lsh_path_reserve(state, path_size + 1);
+            state->path[path_size] = *i;
+            path_size += 1;
+        }
+
+        if(*component_end == '\0') {
+            struct stat info;
+            state->path[path_size] = '\0';
+            if(lstat(state->path, &info) == 0) {
+                lsh_glob_match_path(state, path_size);
+            }
+        } else {
+            lsh_glob_walk(state, path_size, component_end);
+        }
+        return;
+    }
+
+    lsh_path_reserve(state, path_size);
+    state->path[path_size] = '\0';
+    Directory_Listing* const listing =
+        lsh_get_listing(path_size == 0 ? "." : state->path);
+    if(listing == NULL) {
+        return;
+    }
+
+    // The listing may be evicted by nested walks, therefore we take a copy
+    // of the matching entries first.
+    lsh_compile_pattern(&state->pattern, pattern, component_end);
+    bool const last = (*component_end == '\0');
+    Word_List names = {0};
+    Arena arena = {0};
+    for(int i = 0; i < listing->count; ++i) {
+        char const* const name = listing->names + listing->offsets[i];
+        int const length = listing->lengths[i];
+        if(!lsh_match_pattern(&state->pattern, name, length)) {
+            continue;
+        }
+
+        if(last) {
+            lsh_path_reserve(state, path_size + length);
+            memcpy(state->path + path_size, name, length);
+            lsh_glob_match_path(state, path_size + length);
+        } else {
+            char* const entry =
+                lsh_arena_alloc(&arena, length + 2);
+            entry[0] = listing->types[i];
+            memcpy(entry + 1, name, length + 1);
+            lsh_word_list_push(&names, entry);
+        }
+    }
+
+    for(int i = 0; i < names.size; ++i) {
+        char const* const name = names.values[i] + 1;
+        int const length = strlen(name);
+        lsh_path_reserve(state, path_size + length);
+        memcpy(state->path + path_size, name, length + 1);
+        if(lsh_is_directory(state->path, names.values[i][0])) {
+            lsh_glob_walk(state, path_size + length, component_end);
+        }
+    }
+    lsh_free_tagged(MEMORY_PARSER, names.values);
+    lsh_arena_free(&arena);
+}
+
+static int lsh_compare_strings(void const* const lhs, void const* const rhs) {
+    return strcmp(*(char* const*)lhs, *(char* const*)rhs);
+}
+
+int lsh_glob(char const* const pattern, Arena* const arena,
+             Word_List* const list) {
+    Glob_State state = {.arena = arena, .list = list};
+    int const first = list->size;
+    lsh_glob_walk(&state, 0, pattern);
+    qsort(list->values + first, state.matches, sizeof(char*),
+          lsh_compare_strings);
+    free(state.path);
+    free(state.pattern.tokens);
+    free(state.pattern.segments);
+    return state.matches;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <common.h>
+#include <expand.h>
+
+// lsh_is_glob_character
+// Check whether c is a pattern character (*, ? or [).
+//
+bool lsh_is_glob_character(char c);
+
+// lsh_glob
+// Expand a pathname pattern. Only directories named by the pattern are read.
+// Listings are read with getdents64 and cached for a short time, keyed by
+// the modification time of the directory, so repeated globs over the same
+// directory do not read it again.
+//
+// Parameters:
+// pattern - the pattern. A backslash makes the following character literal.
+// arena - owns the matched paths.
+//
+// Returns:
+// The number of sorted matches appended to the list.
+//
+int lsh_glob(char const* pattern, Arena* arena, Word_List* list);
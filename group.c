@@ -0,0 +1,54 @@
+#include <group.h>
+
+#include <jobs.h>
+#include <parser.h>
+#include <plans.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// lsh_skip_empty_commands
+// Returns:
+// Pointer to the first command that consists of more than whitespace.
+//
+static char const* lsh_skip_empty_commands(char const* begin) {
+    while(*begin != '\0' && (*begin <= 32 || *begin == ';')) {
+        ++begin;
+    }
+    return begin;
+}
+
+int lsh_run_group(Shell* const shell, char const* const body,
+                  bool const exec_last) {
+    int status = EXIT_SUCCESS;
+    char const* begin = lsh_skip_empty_commands(body);
+    while(*begin != '\0') {
+        char const* const end = lsh_find_command_end(begin);
+        char* const line = lsh_alloc_and_zero(end - begin + 1);
+        memcpy(line, begin, end - begin);
+        begin = lsh_skip_empty_commands(end);
+
+        Parse_Result parse_result = lsh_parse_cached(shell, line);
+        if(parse_result.kind == PARSE_ERROR) {
+            fprintf(stderr, "lsh: %s\n", parse_result.error);
+            free(parse_result.error);
+            free(line);
+            return 2;
+        }
+
+        Command command = parse_result.value;
+        Job* const job = lsh_create_job(line);
+        lsh_create_processes_from_command(job, command);
+        if(exec_last && *begin == '\0' && command.foreground) {
+            lsh_exec_job(shell, job);
+        }
+
+        lsh_start_job(shell, job, command.foreground);
+        lsh_free_command(command);
+        lsh_update_job_statuses();
+        status = (command.foreground ? lsh_get_job_exit_status(job) : 0);
+        lsh_cleanup_jobs();
+    }
+    return status;
+}
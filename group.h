@@ -0,0 +1,18 @@
+#pragma once
+
+#include <shell.h>
+
+// lsh_run_group
+// Run the commands of a brace group or subshell one after another, each as a
+// job of the calling shell. The commands are parsed and expanded as they run,
+// so that each one sees the effects of those before it.
+//
+// Parameters:
+// body - the commands separated by ";".
+// exec_last - whether the last command may replace the calling process,
+//             which a forked subshell allows.
+//
+// Returns:
+// The exit status of the last command or 2 if a command fails to parse.
+//
+int lsh_run_group(Shell* shell, char const* body, bool exec_last);
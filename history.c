@@ -0,0 +1,398 @@
+#include <history.h>
+
+#include <vars.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Posting_List
+// The entries containing a trigram, in ascending order.
+//
+typedef struct Posting_List {
+    // Trigram + 1, so that 0 marks an empty slot.
+    uint32_t key;
+    int size;
+    int capacity;
+    int* entries;
+} Posting_List;
+
+typedef struct History {
+    int fd;
+    // The path is kept to follow the file when another session replaces it.
+    char* path;
+    // Identity of the indexed file.
+    dev_t device;
+    ino_t inode;
+    // The file is mapped read-only. Entries are separated by newlines.
+    char const* mapping;
+    size_t mapping_size;
+    // Offset past the newline of the last complete entry.
+    size_t end;
+    // Start offsets of the entries located backwards from the end, the most
+    // recent first. Recall walks up the history without reading the rest.
+    size_t* recent;
+    int recent_size;
+    int recent_capacity;
+    // Number of bytes of the file that have been indexed from the start.
+    size_t indexed_size;
+    // Start offsets of the indexed entries, the oldest first.
+    size_t* offsets;
+    int size;
+    int capacity;
+    // Trigrams of the first trigram_entries indexed entries. Built on the
+    // first search only.
+    Posting_List* trigrams;
+    int trigrams_size;
+    int trigrams_capacity;
+    int trigram_entries;
+} History;
+
+static History history = {.fd = -1};
+
+void lsh_history_initialise(void) {
+    char const* name = "HISTFILE";
+    char const* path = lsh_get_variable(name, name + strlen(name));
+    char* buffer = NULL;
+    if(path == NULL || *path == '\0') {
+        name = "HOME";
+        char const* const home = lsh_get_variable(name, name + strlen(name));
+        if(home == NULL) {
+            return;
+        }
+
+        char const file[] = "/.lsh_history";
+        int const home_size = strlen(home);
+        buffer = lsh_alloc_and_zero(home_size + sizeof(file));
+        memcpy(buffer, home, home_size);
+        memcpy(buffer + home_size, file, sizeof(file));
+        path = buffer;
+    }
+
+    history.fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if(history.fd < 0) {
+        perror("history");
+        free(buffer);
+        return;
+    }
+
+    if(buffer == NULL) {
+        int const path_size = strlen(path);
+        buffer = lsh_alloc_and_zero(path_size + 1);
+        memcpy(buffer, path, path_size);
+    }
+    history.path = buffer;
+}
+
+// lsh_history_follow
+// Reopen the file if another session has renamed or removed it, as log
+// rotation does, so that entries go to the file under the path.
+//
+static void lsh_history_follow(void) {
+    struct stat opened;
+    struct stat named;
+    if(history.fd < 0 || fstat(history.fd, &opened) != 0 ||
+       (stat(history.path, &named) == 0 && named.st_dev == opened.st_dev &&
+        named.st_ino == opened.st_ino)) {
+        return;
+    }
+
+    int const fd =
+        open(history.path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if(fd < 0) {
+        perror("history");
+        return;
+    }
+    close(history.fd);
+    history.fd = fd;
+}
+
+void lsh_history_add(char const* const line, int const size) {
+    if(history.fd < 0 || size == 0) {
+        return;
+    }
+
+    lsh_history_follow();
+    char* const entry = lsh_alloc_tagged(MEMORY_HISTORY, size + 1);
+    memcpy(entry, line, size);
+    entry[size] = '\n';
+    ssize_t result = 0;
+    do {
+        result = write(history.fd, entry, size + 1);
+    } while(result < 0 && errno == EINTR);
+    lsh_free_tagged(MEMORY_HISTORY, entry);
+}
+
+static Posting_List* lsh_find_posting_list(uint32_t const key) {
+    uint32_t const mask = history.trigrams_capacity - 1;
+    for(uint32_t i = (key * 2654435761u) & mask;; i = (i + 1) & mask) {
+        Posting_List* const list = &history.trigrams[i];
+        if(list->key == key || list->key == 0) {
+            return list;
+        }
+    }
+}
+
+static void lsh_grow_trigrams(void) {
+    Posting_List* const old = history.trigrams;
+    int const old_capacity = history.trigrams_capacity;
+    history.trigrams_capacity = (old_capacity == 0 ? 4096 : old_capacity * 2);
+    history.trigrams =
+        lsh_alloc_tagged(MEMORY_HISTORY,
+                         history.trigrams_capacity * sizeof(Posting_List));
+    for(int i = 0; i < old_capacity; ++i) {
+        if(old[i].key != 0) {
+            *lsh_find_posting_list(old[i].key) = old[i];
+        }
+    }
+    lsh_free_tagged(MEMORY_HISTORY, old);
+}
+
+static uint32_t lsh_trigram_key(char const* const trigram) {
+    return (((uint32_t)(unsigned char)trigram[0] << 16) |
+            ((uint32_t)(unsigned char)trigram[1] << 8) |
+            (uint32_t)(unsigned char)trigram[2]) +
+           1;
+}
+
+static void lsh_index_entry(int const index, char const* const entry,
+                            int const size) {
+    for(int i = 0; i + 3 <= size; ++i) {
+        if((history.trigrams_size + 1) * 2 > history.trigrams_capacity) {
+            lsh_grow_trigrams();
+        }
+
+        uint32_t const key = lsh_trigram_key(entry + i);
+        Posting_List* const list = lsh_find_posting_list(key);
+        if(list->key == 0) {
+            list->key = key;
+            history.trigrams_size += 1;
+        }
+
+        // Entries are indexed in order, therefore a repeated trigram of the
+        // same entry is always at the back.
+        if(list->size > 0 && list->entries[list->size - 1] == index) {
+            continue;
+        }
+
+        if(list->size == list->capacity) {
+            list->capacity = (list->capacity == 0 ? 4 : list->capacity * 2);
+            list->entries = lsh_realloc_tagged(MEMORY_HISTORY, list->entries,
+                                               list->capacity * sizeof(int));
+            if(!list->entries) {
+                fprintf(stderr, "history: allocation failure");
+                exit(EXIT_FAILURE);
+            }
+        }
+        list->entries[list->size] = index;
+        list->size += 1;
+    }
+}
+
+// lsh_history_reset
+// Forget the mapping and every located or indexed entry.
+//
+static void lsh_history_reset(void) {
+    if(history.mapping != NULL) {
+        munmap((void*)history.mapping, history.mapping_size);
+        lsh_memory_remove(MEMORY_HISTORY, history.mapping_size);
+    }
+    history.mapping = NULL;
+    history.mapping_size = 0;
+    history.end = 0;
+    history.recent_size = 0;
+    history.indexed_size = 0;
+    history.size = 0;
+
+    for(int i = 0; i < history.trigrams_capacity; ++i) {
+        lsh_free_tagged(MEMORY_HISTORY, history.trigrams[i].entries);
+    }
+    lsh_free_tagged(MEMORY_HISTORY, history.trigrams);
+    history.trigrams = NULL;
+    history.trigrams_size = 0;
+    history.trigrams_capacity = 0;
+    history.trigram_entries = 0;
+}
+
+void lsh_history_sync(void) {
+    lsh_history_follow();
+    struct stat info;
+    if(history.fd < 0 || fstat(history.fd, &info) != 0) {
+        return;
+    }
+
+    // A rewritten file no longer ends the known entries with a newline.
+    size_t const size = info.st_size;
+    if(info.st_dev != history.device || info.st_ino != history.inode ||
+       size < history.end ||
+       (history.end > 0 && history.mapping[history.end - 1] != '\n')) {
+        lsh_history_reset();
+        history.device = info.st_dev;
+        history.inode = info.st_ino;
+    }
+
+    if(size == history.mapping_size) {
+        return;
+    }
+
+    if(history.mapping != NULL) {
+        munmap((void*)history.mapping, history.mapping_size);
+        lsh_memory_remove(MEMORY_HISTORY, history.mapping_size);
+    }
+    history.mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, history.fd, 0);
+    if(history.mapping == MAP_FAILED) {
+        perror("history: mmap");
+        history.mapping = NULL;
+        history.mapping_size = 0;
+        lsh_history_reset();
+        return;
+    }
+    history.mapping_size = size;
+    lsh_memory_add(MEMORY_HISTORY, history.mapping_size);
+
+    // An entry that is not terminated yet is picked up next time.
+    char const* const newline =
+        memrchr(history.mapping + history.end, '\n', size - history.end);
+    if(newline != NULL) {
+        history.end = newline + 1 - history.mapping;
+        history.recent_size = 0;
+    }
+}
+
+char const* lsh_history_recent(int const back, int* const size) {
+    while(history.recent_size <= back) {
+        int const located = history.recent_size;
+        size_t const stop =
+            (located == 0 ? history.end : history.recent[located - 1]);
+        if(stop == 0) {
+            return NULL;
+        }
+
+        // The byte before stop is the newline of the entry.
+        char const* const newline = memrchr(history.mapping, '\n', stop - 1);
+        if(history.recent_size == history.recent_capacity) {
+            history.recent_capacity = (history.recent_capacity == 0
+                                           ? 64
+                                           : history.recent_capacity * 2);
+            history.recent =
+                lsh_realloc_tagged(MEMORY_HISTORY, history.recent,
+                                   history.recent_capacity * sizeof(size_t));
+            if(!history.recent) {
+                fprintf(stderr, "history: allocation failure");
+                exit(EXIT_FAILURE);
+            }
+        }
+        history.recent[history.recent_size] =
+            (newline == NULL ? 0 : newline + 1 - history.mapping);
+        history.recent_size += 1;
+    }
+
+    size_t const begin = history.recent[back];
+    size_t const end = (back == 0 ? history.end : history.recent[back - 1]);
+    // Exclude the newline.
+    *size = end - begin - 1;
+    return history.mapping + begin;
+}
+
+// lsh_history_index
+// Locate every entry from the oldest so that entries can be numbered.
+//
+static void lsh_history_index(void) {
+    lsh_history_sync();
+    char const* const end = history.mapping + history.end;
+    char const* begin = history.mapping + history.indexed_size;
+    while(begin != end) {
+        char const* const newline = memchr(begin, '\n', end - begin);
+        if(history.size == history.capacity) {
+            history.capacity =
+                (history.capacity == 0 ? 1024 : history.capacity * 2);
+            history.offsets =
+                lsh_realloc_tagged(MEMORY_HISTORY, history.offsets,
+                                   history.capacity * sizeof(size_t));
+            if(!history.offsets) {
+                fprintf(stderr, "history: allocation failure");
+                exit(EXIT_FAILURE);
+            }
+        }
+        history.offsets[history.size] = begin - history.mapping;
+        history.size += 1;
+        begin = newline + 1;
+    }
+    history.indexed_size = history.end;
+}
+
+int lsh_history_size(void) {
+    lsh_history_index();
+    return history.size;
+}
+
+char const* lsh_history_entry(int const index, int* const size) {
+    char const* const entry = history.mapping + history.offsets[index];
+    size_t const end = (index + 1 < history.size)
+                           ? history.offsets[index + 1]
+                           : history.indexed_size;
+    // Exclude the newline.
+    *size = history.mapping + end - entry - 1;
+    return entry;
+}
+
+static bool lsh_entry_matches(int const index, char const* const text,
+                              int const text_size, bool const prefix) {
+    int size = 0;
+    char const* const entry = lsh_history_entry(index, &size);
+    if(prefix) {
+        return size >= text_size && memcmp(entry, text, text_size) == 0;
+    }
+    return memmem(entry, size, text, text_size) != NULL;
+}
+
+int* lsh_history_search(char const* const text, bool const prefix,
+                        int* const count) {
+    lsh_history_index();
+    for(; history.trigram_entries < history.size;
+        ++history.trigram_entries) {
+        int size = 0;
+        char const* const entry =
+            lsh_history_entry(history.trigram_entries, &size);
+        lsh_index_entry(history.trigram_entries, entry, size);
+    }
+
+    int const text_size = strlen(text);
+    *count = 0;
+
+    // Candidates are either every entry or the entries of the rarest trigram
+    // of the text.
+    int const* candidates = NULL;
+    int candidates_size = history.size;
+    for(int i = 0; i + 3 <= text_size; ++i) {
+        Posting_List const* const list =
+            history.trigrams_capacity == 0
+                ? NULL
+                : lsh_find_posting_list(lsh_trigram_key(text + i));
+        if(list == NULL || list->key == 0) {
+            return lsh_alloc_and_zero(sizeof(int));
+        }
+
+        if(candidates == NULL || list->size < candidates_size) {
+            candidates = list->entries;
+            candidates_size = list->size;
+        }
+    }
+
+    int* const matches =
+        lsh_alloc_and_zero((candidates_size + 1) * sizeof(int));
+    for(int i = 0; i < candidates_size; ++i) {
+        int const index = (candidates != NULL ? candidates[i] : i);
+        if(lsh_entry_matches(index, text, text_size, prefix)) {
+            matches[*count] = index;
+            *count += 1;
+        }
+    }
+    return matches;
+}
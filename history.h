@@ -0,0 +1,72 @@
+#pragma once
+
+#include <common.h>
+
+// lsh_history_initialise
+// Open the history file ($HISTFILE or ~/.lsh_history). The file is only
+// opened, therefore startup does not depend on its size.
+//
+void lsh_history_initialise(void);
+
+// lsh_history_sync
+// Map the entries appended to the file since the last call, whichever
+// session appended them. Only the end of the file is examined, entries are
+// located when they are requested. If another session truncated or replaced
+// the file, it is mapped again from the start.
+//
+void lsh_history_sync(void);
+
+// lsh_history_add
+// Append a line to the history file. The entry is written with a single
+// append so that concurrent sessions never interleave their entries.
+//
+void lsh_history_add(char const* line, int size);
+
+// lsh_history_recent
+// Locate an entry by walking back from the end of the file, so that recalling
+// recent entries reads only as much of the file as was walked. Entries
+// appended by other sessions are picked up by lsh_history_sync only.
+//
+// Parameters:
+// back - index of the entry, 0 being the most recent.
+// size - receives the length of the entry.
+//
+// Returns:
+// The entry, which is not null-terminated, or NULL if there are fewer
+// entries. Valid until the next call into the history.
+//
+char const* lsh_history_recent(int back, int* size);
+
+// lsh_history_size
+// Locate every entry of the file from the oldest so that they can be numbered.
+//
+// Returns:
+// The number of entries, including those appended by other sessions.
+//
+int lsh_history_size(void);
+
+// lsh_history_entry
+// Parameters:
+// index - index of the entry, 0 being the oldest.
+// size - receives the length of the entry.
+//
+// Returns:
+// The entry, which is not null-terminated. Valid until the next call into
+// the history.
+//
+char const* lsh_history_entry(int index, int* size);
+
+// lsh_history_search
+// Find the entries containing text, or starting with it if prefix is set.
+// Text of three or more characters is looked up in a trigram index and only
+// the candidates from the shortest posting list are verified. The index is
+// built on the first search and extended by later ones.
+//
+// Parameters:
+// count - receives the number of matches.
+//
+// Returns:
+// The indices of the matching entries in ascending order. Caller must free
+// the array.
+//
+int* lsh_history_search(char const* text, bool prefix, int* count);
@@ -1,13 +1,29 @@
 #include <jobs.h>
 
+#include <batch.h>
 #include <builtin.h>
+#include <capture.h>
+#include <control.h>
+#include <events.h>
+#include <expand.h>
+#include <group.h>
+#include <vars.h>
+#include <zygote.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
 #include <signal.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -27,8 +43,39 @@ struct Job_List {
     Fake_Job_List_Entry _node;
 };
 
+// Process arrays of up to 1 << (LSH_PROCESS_POOL_COUNT - 1) stages are pooled
+// by their size rounded up to a power of two. Longer pipelines are allocated
+// directly.
+#define LSH_PROCESS_POOL_COUNT 4
+
 static Job_List job_list;
 static Job* current_job = NULL;
+static Pool job_pool;
+static Pool process_pools[LSH_PROCESS_POOL_COUNT];
+// Readable whenever SIGCHLD is pending.
+static int signal_fd = -1;
+// Armed to the earliest deadline of the jobs.
+static int timer_fd = -1;
+// Number of jobs that completed since the last cleanup.
+static int pending_notifications = 0;
+// Whether jobs get their own process groups and the terminal. Off when the
+// shell runs a script or a -c command.
+static bool job_control = false;
+// Stand for the standard descriptors of the processes while a brace group
+// with redirects runs in the shell.
+static Descriptors default_fds = {
+    .in = STDIN_FILENO,
+    .out = STDOUT_FILENO,
+    .err = STDERR_FILENO,
+};
+// Descriptors of the user that hold the ends of coprocesses. Like the
+// descriptors of the shell they are closed on exec, but redirects may
+// duplicate them.
+static bool coproc_fds[LSH_USER_FD_LIMIT];
+// Done while the shell waits for idle_job in the foreground.
+static Job* idle_job = NULL;
+static Idle_Work idle_work = NULL;
+static void* idle_context = NULL;
 
 static void lsh_job_list_initialise(Job_List* const list) {
     list->_node.prev = (Job_List_Entry*)&list->_node;
@@ -59,8 +106,45 @@ Job* lsh_job_list_value(Job_List_Entry* const entry) {
     return &entry->job;
 }
 
+// lsh_process_pool
+// Returns:
+// The pool of arrays of count processes or NULL if they are not pooled.
+//
+static Pool* lsh_process_pool(int const count) {
+    for(int i = 0; i < LSH_PROCESS_POOL_COUNT; ++i) {
+        if(count <= (1 << i)) {
+            return &process_pools[i];
+        }
+    }
+    return NULL;
+}
+
+static Process* lsh_alloc_processes(int const count) {
+    Pool* const pool = lsh_process_pool(count);
+    if(pool == NULL) {
+        return lsh_alloc_tagged(MEMORY_JOBS, count * sizeof(Process));
+    }
+    return lsh_pool_alloc(pool);
+}
+
+static void lsh_free_processes(Process* const processes, int const count) {
+    Pool* const pool = lsh_process_pool(count);
+    if(pool == NULL) {
+        lsh_free_tagged(MEMORY_JOBS, processes);
+    } else {
+        lsh_pool_free(pool, processes);
+    }
+}
+
+void lsh_print_pool_statistics(int const fd_out) {
+    lsh_pool_print_statistics(&job_pool, fd_out);
+    for(int i = 0; i < LSH_PROCESS_POOL_COUNT; ++i) {
+        lsh_pool_print_statistics(&process_pools[i], fd_out);
+    }
+}
+
 static Job* lsh_job_list_push_back(Job_List* list) {
-    Job_List_Entry* const entry = lsh_alloc_and_zero(sizeof(Job_List_Entry));
+    Job_List_Entry* const entry = lsh_pool_alloc(&job_pool);
     Job_List_Entry* const prev = (Job_List_Entry*)list->_node.prev;
     Job_List_Entry* const next = (Job_List_Entry*)prev->next;
     prev->next = entry;
@@ -75,16 +159,21 @@ void lsh_job_list_erase(Job_List_Entry* const entry) {
     entry->next->prev = entry->prev;
 
     Job* const job = &entry->job;
-    for(Process* process = job->first_process; process != NULL;) {
-        for(char** b = process->args; *b != NULL; ++b) {
-            free(*b);
+    for(int i = 0; i < job->process_count; ++i) {
+        Process* const process = &job->processes[i];
+        // The arguments were allocated by the parser.
+        lsh_free_tagged(MEMORY_PARSER, process->args);
+        lsh_free_tagged(MEMORY_PARSER, process->assignments);
+        lsh_free_tagged(MEMORY_PARSER, process->redirects);
+        lsh_arena_free(&process->arena);
+        lsh_close_substitution_fds(process->substitution_fds);
+        if(process->pidfd >= 0) {
+            close(process->pidfd);
         }
-        free(process->args);
-        Process* current = process;
-        process = process->next;
-        free(current);
     }
-    free(entry);
+    lsh_free_processes(job->processes, job->process_count);
+    lsh_free_tagged(MEMORY_JOBS, (char*)job->command);
+    lsh_pool_free(&job_pool, entry);
 }
 
 Job* lsh_find_job_with_id(Job_List* const list, int const id) {
@@ -99,30 +188,314 @@ Job* lsh_find_job_with_id(Job_List* const list, int const id) {
     return NULL;
 }
 
-void lsh_jobs_initialise(void) {
+int lsh_signal_job(Job* const job, int const signal) {
+    if(job_control) {
+        return kill(-job->pgid, signal);
+    }
+
+    int result = -1;
+    for(int i = 0; i < job->process_count; ++i) {
+        Process const* const process = &job->processes[i];
+        if(process->pid > 0 && (process->status == PROCESS_RUNNING ||
+                                process->status == PROCESS_STOPPED)) {
+            if(kill(process->pid, signal) == 0) {
+                result = 0;
+            }
+        }
+    }
+    return result;
+}
+
+static bool lsh_timespec_before(struct timespec const a,
+                                struct timespec const b) {
+    return a.tv_sec < b.tv_sec ||
+           (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+static struct timespec lsh_timespec_add(struct timespec const a,
+                                        struct timespec const b) {
+    struct timespec result = {.tv_sec = a.tv_sec + b.tv_sec,
+                              .tv_nsec = a.tv_nsec + b.tv_nsec};
+    if(result.tv_nsec >= 1000000000) {
+        result.tv_sec += 1;
+        result.tv_nsec -= 1000000000;
+    }
+    return result;
+}
+
+// lsh_is_timeout_pending
+// Check whether the job still has a signal to be sent at its deadline.
+//
+static bool lsh_is_timeout_pending(Job* const job) {
+    Job_Timeout const* const timeout = &job->timeout;
+    return timeout->enabled && timeout->next_signal < timeout->signal_count &&
+           !lsh_is_job_completed(job);
+}
+
+// lsh_arm_timer
+// Arm the timer to the earliest pending deadline or disarm it if there is
+// none.
+//
+static void lsh_arm_timer(void) {
+    struct itimerspec spec = {0};
+    bool armed = false;
+    for(Job_List_Entry *b = lsh_job_list_begin(&job_list),
+                       *e = lsh_job_list_end(&job_list);
+        b != e; b = lsh_job_list_next(b)) {
+        Job* const job = lsh_job_list_value(b);
+        if(lsh_is_timeout_pending(job) &&
+           (!armed || lsh_timespec_before(job->timeout.deadline,
+                                          spec.it_value))) {
+            spec.it_value = job->timeout.deadline;
+            armed = true;
+        }
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+// lsh_expire_timeouts
+// Send the next signal to every job whose deadline has passed. A stopped job
+// is continued so that it may act on the signal.
+//
+static void lsh_expire_timeouts(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for(Job_List_Entry *b = lsh_job_list_begin(&job_list),
+                       *e = lsh_job_list_end(&job_list);
+        b != e; b = lsh_job_list_next(b)) {
+        Job* const job = lsh_job_list_value(b);
+        Job_Timeout* const timeout = &job->timeout;
+        if(!lsh_is_timeout_pending(job) ||
+           lsh_timespec_before(now, timeout->deadline)) {
+            continue;
+        }
+
+        lsh_signal_job(job, timeout->signals[timeout->next_signal]);
+        lsh_signal_job(job, SIGCONT);
+        timeout->expired = true;
+        timeout->next_signal += 1;
+        timeout->deadline = lsh_timespec_add(now, timeout->grace);
+    }
+    lsh_arm_timer();
+}
+
+static void lsh_handle_child_events(int const fd, uint32_t const events,
+                                    void* const context) {
+    UNUSED(events);
+    UNUSED(context);
+    struct signalfd_siginfo info[8];
+    while(read(fd, info, sizeof(info)) > 0) {
+        // Signals coalesce, therefore the events are only a hint to poll all
+        // the children.
+    }
+    lsh_update_job_statuses();
+}
+
+static void lsh_handle_timer_events(int const fd, uint32_t const events,
+                                    void* const context) {
+    UNUSED(events);
+    UNUSED(context);
+    uint64_t expirations = 0;
+    if(read(fd, &expirations, sizeof(expirations)) > 0) {
+        lsh_expire_timeouts();
+    }
+}
+
+void lsh_jobs_initialise(Shell const* const shell) {
+    job_control = shell->is_interactive;
     lsh_job_list_initialise(&job_list);
+    lsh_pool_initialise(&job_pool, "jobs", MEMORY_JOBS,
+                        sizeof(Job_List_Entry));
+    static char const* const process_pool_names[LSH_PROCESS_POOL_COUNT] = {
+        "processes/1", "processes/2", "processes/4", "processes/8"};
+    for(int i = 0; i < LSH_PROCESS_POOL_COUNT; ++i) {
+        lsh_pool_initialise(&process_pools[i], process_pool_names[i],
+                            MEMORY_JOBS, (1 << i) * sizeof(Process));
+    }
+
+    // SIGCHLD stays blocked and is received through the signalfd instead, so
+    // that child events may be waited for together with the terminal.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(signal_fd < 0 || timer_fd < 0) {
+        perror("lsh_jobs_initialise: could not create the event descriptors");
+        exit(EXIT_FAILURE);
+    }
+
+    lsh_add_event_source(signal_fd, EPOLLIN, lsh_handle_child_events, NULL);
+    lsh_add_event_source(timer_fd, EPOLLIN, lsh_handle_timer_events, NULL);
+}
+
+void lsh_jobs_enter_subshell(void) {
+    job_control = false;
+    // The jobs of the parent are forgotten rather than freed, one of them
+    // owns the group that the subshell runs.
+    lsh_job_list_initialise(&job_list);
+    current_job = NULL;
+    pending_notifications = 0;
+
+    // The exec of a process unblocked SIGCHLD, the subshell receives it
+    // through the signalfd again. The timer is shared with the parent.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    close(timer_fd);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(timer_fd < 0) {
+        perror("lsh_jobs_enter_subshell: could not create the timer");
+        _exit(EXIT_FAILURE);
+    }
+
+    lsh_events_initialise();
+    lsh_add_event_source(signal_fd, EPOLLIN, lsh_handle_child_events, NULL);
+    lsh_add_event_source(timer_fd, EPOLLIN, lsh_handle_timer_events, NULL);
+}
+
+bool lsh_has_job_notifications(void) {
+    return pending_notifications > 0;
+}
+
+static bool lsh_parse_duration(char const* const string,
+                               struct timespec* const duration) {
+    char* end = NULL;
+    double seconds = strtod(string, &end);
+    if(end == string || !isfinite(seconds) || seconds < 0) {
+        return false;
+    }
+
+    if(*end == 'm') {
+        seconds *= 60;
+        end += 1;
+    } else if(*end == 'h') {
+        seconds *= 60 * 60;
+        end += 1;
+    } else if(*end == 'd') {
+        seconds *= 24 * 60 * 60;
+        end += 1;
+    } else if(*end == 's') {
+        end += 1;
+    }
+
+    // Durations are added to the monotonic clock. Below half the range of
+    // time_t, neither the cast nor the sum overflows.
+    double const limit = (double)((uintmax_t)1 << (sizeof(time_t) * 8 - 2));
+    if(*end != '\0' || seconds >= limit) {
+        return false;
+    }
+
+    duration->tv_sec = (time_t)seconds;
+    duration->tv_nsec = (long)((seconds - duration->tv_sec) * 1e9);
+    return true;
+}
+
+int lsh_parse_signal(char const* string) {
+    char* end = NULL;
+    long const number = strtol(string, &end, 10);
+    if(end != string && *end == '\0') {
+        return (number > 0 && number < NSIG ? number : 0);
+    }
+
+    if(strncasecmp(string, "SIG", 3) == 0) {
+        string += 3;
+    }
+
+    for(int i = 1; i < NSIG; ++i) {
+        char const* const name = sigabbrev_np(i);
+        if(name != NULL && strcasecmp(name, string) == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+int lsh_parse_timeout(char** const args, Job_Timeout* const timeout,
+                      int const fd_err) {
+    Job_Timeout result = {.enabled = true, .grace = {.tv_sec = 5}};
+    int i = 1;
+    for(; args[i] != NULL && args[i][0] == '-'; i += 2) {
+        if(strcmp(args[i], "-s") != 0 && strcmp(args[i], "-k") != 0) {
+            dprintf(fd_err, "timeout: unknown option %s\n", args[i]);
+            return -1;
+        }
+
+        if(args[i + 1] == NULL) {
+            dprintf(fd_err, "timeout: expected argument of %s\n", args[i]);
+            return -1;
+        }
+
+        if(args[i][1] == 'k') {
+            if(!lsh_parse_duration(args[i + 1], &result.grace)) {
+                dprintf(fd_err, "timeout: invalid duration %s\n",
+                        args[i + 1]);
+                return -1;
+            }
+            continue;
+        }
+
+        int const signal = lsh_parse_signal(args[i + 1]);
+        if(signal == 0) {
+            dprintf(fd_err, "timeout: invalid signal %s\n", args[i + 1]);
+            return -1;
+        }
+
+        if(result.signal_count == LSH_TIMEOUT_MAX_SIGNALS) {
+            dprintf(fd_err, "timeout: too many signals\n");
+            return -1;
+        }
+        result.signals[result.signal_count] = signal;
+        result.signal_count += 1;
+    }
+
+    if(args[i] == NULL) {
+        dprintf(fd_err, "timeout: expected duration\n");
+        return -1;
+    }
+
+    if(!lsh_parse_duration(args[i], &result.duration)) {
+        dprintf(fd_err, "timeout: invalid duration %s\n", args[i]);
+        return -1;
+    }
+
+    if(result.signal_count == 0) {
+        result.signals[0] = SIGTERM;
+        result.signals[1] = SIGKILL;
+        result.signal_count = 2;
+    }
+
+    *timeout = result;
+    return i + 1;
 }
 
 Job* lsh_get_current_job(void) {
     return current_job;
 }
 
-Process* lsh_find_process_with_pid(pid_t const pid) {
+static Process* lsh_find_job_and_process(pid_t const pid, Job** const out_job) {
     for(Job_List_Entry *b = lsh_job_list_begin(&job_list),
                        *e = lsh_job_list_end(&job_list);
         b != e; b = lsh_job_list_next(b)) {
         Job* job = lsh_job_list_value(b);
-        for(Process* process = job->first_process; process != NULL;
-            process = process->next) {
-            if(process->pid == pid) {
-                return process;
+        for(int i = 0; i < job->process_count; ++i) {
+            if(job->processes[i].pid == pid) {
+                *out_job = job;
+                return &job->processes[i];
             }
         }
     }
     return NULL;
 }
 
-Job* lsh_create_job(void) {
+Process* lsh_find_process_with_pid(pid_t const pid) {
+    Job* job = NULL;
+    return lsh_find_job_and_process(pid, &job);
+}
+
+Job* lsh_create_job(char* const command) {
     Job_List_Entry* const end = lsh_job_list_end(&job_list);
     Job_List_Entry* const prev = lsh_job_list_prev(end);
     int id = 1;
@@ -133,80 +506,152 @@ Job* lsh_create_job(void) {
 
     Job* const job = lsh_job_list_push_back(&job_list);
     job->id = id;
+    job->command = command;
+    lsh_memory_track(MEMORY_JOBS, command);
+    job->placement = *lsh_get_default_placement();
     return job;
 }
 
-bool lsh_is_job_stopped(Job* job) {
-    for(Process* process = job->first_process; process != NULL;
-        process = process->next) {
-        if(process->status == PROCESS_RUNNING) {
-            return false;
-        }
+void lsh_remove_job(Job* const job) {
+    if(job == current_job) {
+        current_job = NULL;
     }
-    return true;
+
+    Job_List_Entry* const entry =
+        (Job_List_Entry*)((char*)job - offsetof(Job_List_Entry, job));
+    lsh_job_list_erase(entry);
 }
 
-bool lsh_is_job_completed(Job* job) {
-    for(Process* process = job->first_process; process != NULL;
-        process = process->next) {
-        if(process->status != PROCESS_COMPLETED &&
-           process->status != PROCESS_TERMINATED) {
-            return false;
-        }
+void lsh_create_processes_from_command(Job* const job, Command command) {
+    int count = 0;
+    for(Process_Args* args = command.args; args != NULL; args = args->next) {
+        count += 1;
     }
-    return true;
+
+    job->processes = lsh_alloc_processes(count);
+    job->process_count = count;
+    job->status_counts[PROCESS_RUNNING] = count;
+    Process* current_process = job->processes;
+    for(Process_Args* current = command.args; current != NULL;
+        current = current->next, ++current_process) {
+        current_process->args = current->values;
+        current->values = NULL;
+        current_process->assignments = current->assignments;
+        current->assignments = NULL;
+        current_process->batched = current->batched;
+        current_process->batch_word = current->batch_word;
+        current_process->batch_index = current->batch_index;
+        current_process->group = current->group;
+        current_process->subshell = current->subshell;
+        current_process->substitution_fds = current->substitution_fds;
+        current->substitution_fds = NULL;
+        // The paths of the redirects are owned by the arena.
+        current_process->redirects = current->redirects;
+        current_process->redirect_count = current->redirect_count;
+        current->redirects = NULL;
+        current->redirect_count = 0;
+        current_process->arena = current->arena;
+        current_process->pidfd = -1;
+        current->arena = (Arena){0};
+        current_process->fd = (Descriptors){
+            .in = STDIN_FILENO,
+            .out = STDOUT_FILENO,
+            .err = STDERR_FILENO,
+        };
+    }
+}
+
+bool lsh_is_job_stopped(Job* job) {
+    return job->status_counts[PROCESS_RUNNING] == 0;
+}
+
+bool lsh_is_job_completed(Job* job) {
+    return job->status_counts[PROCESS_COMPLETED] +
+               job->status_counts[PROCESS_TERMINATED] ==
+           job->process_count;
 }
 
 bool lsh_is_job_terminated(Job* job) {
-    for(Process* process = job->first_process; process != NULL;
-        process = process->next) {
-        if(process->status != PROCESS_TERMINATED) {
-            return false;
-        }
-    }
-    return true;
+    return job->status_counts[PROCESS_TERMINATED] == job->process_count;
+}
+
+// lsh_set_process_status
+// Change the status of a process of the job and keep the counts of the job in
+// step.
+//
+static void lsh_set_process_status(Job* const job, Process* const process,
+                                   Process_Status const status) {
+    job->status_counts[process->status] -= 1;
+    job->status_counts[status] += 1;
+    process->status = status;
 }
 
-static void lsh_update_process_status(pid_t const pid, int const code) {
-    Process* const process = lsh_find_process_with_pid(pid);
+static void lsh_update_process_status(siginfo_t const* const info) {
+    Job* job = NULL;
+    Process* const process = lsh_find_job_and_process(info->si_pid, &job);
     if(process == NULL) {
         return;
     }
 
+    int const code = info->si_code;
+    if(code == CLD_EXITED || code == CLD_KILLED || code == CLD_DUMPED) {
+        process->exit_code = info->si_status;
+        clock_gettime(CLOCK_MONOTONIC, &process->finished);
+        if(process->pidfd >= 0) {
+            close(process->pidfd);
+            process->pidfd = -1;
+        }
+    }
+
     switch(code) {
     case CLD_EXITED:
-        process->status = PROCESS_COMPLETED;
+        lsh_set_process_status(job, process, PROCESS_COMPLETED);
         break;
     case CLD_KILLED:
     case CLD_DUMPED:
-        process->status = PROCESS_TERMINATED;
+        lsh_set_process_status(job, process, PROCESS_TERMINATED);
         break;
     case CLD_STOPPED:
-        process->status = PROCESS_STOPPED;
+        lsh_set_process_status(job, process, PROCESS_STOPPED);
         break;
     case CLD_CONTINUED:
-        process->status = PROCESS_RUNNING;
+        lsh_set_process_status(job, process, PROCESS_RUNNING);
         break;
     default:
         break;
     }
+
+    if((code == CLD_EXITED || code == CLD_KILLED || code == CLD_DUMPED) &&
+       lsh_is_job_completed(job)) {
+        pending_notifications += 1;
+    }
 }
 
-void lsh_print_job_status(Job* const job, int const fd_out) {
-    bool const stopped = lsh_is_job_stopped(job);
+Job_Status lsh_get_job_status(Job* const job) {
     bool const completed = lsh_is_job_completed(job);
-    bool const terminated = lsh_is_job_terminated(job);
-    if(terminated) {
-        dprintf(fd_out, "[%d] Terminated %s\n", job->id, job->command);
+    if(completed && job->timeout.expired) {
+        return JOB_TIMED_OUT;
+    } else if(lsh_is_job_terminated(job)) {
+        return JOB_TERMINATED;
     } else if(completed) {
-        dprintf(fd_out, "[%d] Completed %s\n", job->id, job->command);
-    } else if(stopped) {
-        dprintf(fd_out, "[%d] Stopped %s\n", job->id, job->command);
+        return JOB_COMPLETED;
+    } else if(lsh_is_job_stopped(job)) {
+        return JOB_STOPPED;
     } else {
-        dprintf(fd_out, "[%d] Running %s\n", job->id, job->command);
+        return JOB_RUNNING;
     }
 }
 
+void lsh_print_job_status(Job* const job, int const fd_out) {
+    static char const* const names[] = {
+        [JOB_RUNNING] = "Running",       [JOB_STOPPED] = "Stopped",
+        [JOB_COMPLETED] = "Completed",   [JOB_TERMINATED] = "Terminated",
+        [JOB_TIMED_OUT] = "Timed out",
+    };
+    dprintf(fd_out, "[%d] %s %s\n", job->id, names[lsh_get_job_status(job)],
+            job->command);
+}
+
 void lsh_update_job_statuses(void) {
     // We poll the statuses of all our child processes.
     int status = 0;
@@ -218,20 +663,22 @@ void lsh_update_job_statuses(void) {
             break;
         }
 
-        lsh_update_process_status(info.si_pid, info.si_code);
+        lsh_update_process_status(&info);
     }
 
     if(status != 0 && errno == ECHILD) {
         // There are no child processes, therefore all jobs have been terminated
-        // and we may mark them as such.
+        // and we may mark them as such. A brace group that runs in the shell
+        // was never spawned and is still running.
         for(Job_List_Entry *b = lsh_job_list_begin(&job_list),
                            *e = lsh_job_list_end(&job_list);
             b != e; b = lsh_job_list_next(b)) {
             Job* job = lsh_job_list_value(b);
-            for(Process* process = job->first_process; process != NULL;
-                process = process->next) {
-                if(process->status != PROCESS_TERMINATED) {
-                    process->status = PROCESS_COMPLETED;
+            for(int i = 0; i < job->process_count; ++i) {
+                Process* const process = &job->processes[i];
+                if(process->pid != 0 &&
+                   process->status != PROCESS_TERMINATED) {
+                    lsh_set_process_status(job, process, PROCESS_COMPLETED);
                 }
             }
         }
@@ -239,6 +686,7 @@ void lsh_update_job_statuses(void) {
 }
 
 void lsh_cleanup_jobs(void) {
+    pending_notifications = 0;
     Job_List_Entry* const end = lsh_job_list_end(&job_list);
     for(Job_List_Entry* b = lsh_job_list_begin(&job_list); b != end;) {
         Job_List_Entry* const next = lsh_job_list_next(b);
@@ -247,7 +695,9 @@ void lsh_cleanup_jobs(void) {
             if(job == current_job) {
                 current_job = NULL;
             }
-            lsh_print_job_status(job, STDOUT_FILENO);
+            if(job_control) {
+                lsh_print_job_status(job, STDOUT_FILENO);
+            }
             lsh_job_list_erase(b);
         }
         b = next;
@@ -258,96 +708,460 @@ void lsh_cleanup_jobs(void) {
     }
 }
 
-// lsh_run_process
-// Start a child process.
+// lsh_move_descriptor
+// Make the descriptor the standard descriptor std of the calling process or
+// close std if the descriptor is -1.
 //
-// Parameters:
-// file - the name of the file that is to be executed.
-// args - null-terminated array of arguments to the program. The first argument
-//        ought to be the name of the file being executed.
+static void lsh_move_descriptor(int const fd, int const std) {
+    if(fd < 0) {
+        close(std);
+    } else if(fd != std) {
+        dup2(fd, std);
+        close(fd);
+    }
+}
+
+// lsh_redirect_flags
+// Returns:
+// The flags with which the file of a read, write or append is opened.
+//
+static int lsh_redirect_flags(Redirect_Mode const mode) {
+    switch(mode) {
+    case REDIRECT_READ:
+        return O_RDONLY;
+    case REDIRECT_WRITE:
+        return O_WRONLY | O_CREAT | O_TRUNC;
+    case REDIRECT_APPEND:
+        return O_WRONLY | O_CREAT | O_APPEND;
+    default:
+        return 0;
+    }
+}
+
+// lsh_is_user_descriptor
+// The descriptors of the shell itself, including the placeholders of the
+// descriptors of the user, are closed on exec. A redirect may only duplicate
+// the others and the ends of coprocesses.
+//
+static bool lsh_is_user_descriptor(int const fd) {
+    int const flags = fcntl(fd, F_GETFD);
+    return flags >= 0 && ((flags & FD_CLOEXEC) == 0 ||
+                          (fd < LSH_USER_FD_LIMIT && coproc_fds[fd]));
+}
+
+bool lsh_apply_redirect(Redirect const* const redirect) {
+    if(redirect->mode == REDIRECT_CLOSE) {
+        close(redirect->fd);
+        return true;
+    }
+
+    if(redirect->mode == REDIRECT_DUPLICATE) {
+        if(!lsh_is_user_descriptor(redirect->source)) {
+            errno = EBADF;
+            return false;
+        }
+        return redirect->source == redirect->fd ||
+               dup2(redirect->source, redirect->fd) >= 0;
+    }
+
+    int const opened =
+        open(redirect->path, lsh_redirect_flags(redirect->mode), 0666);
+    if(opened < 0) {
+        return false;
+    }
+
+    if(opened != redirect->fd) {
+        bool const result = dup2(opened, redirect->fd) >= 0;
+        close(opened);
+        return result;
+    }
+    return true;
+}
+
+void lsh_print_redirect_error(Redirect const* const redirect,
+                              int const fd_err) {
+    if(redirect->mode == REDIRECT_DUPLICATE) {
+        dprintf(fd_err, "lsh: %d: %s\n", redirect->source, strerror(errno));
+    } else {
+        dprintf(fd_err, "lsh: %s: %s\n", redirect->path, strerror(errno));
+    }
+}
+
+// lsh_exec_process
+// Replace the calling process with the program of the process. Its
+// assignments are exported to the program only. A batched process runs its
+// batches instead of executing the program directly.
+//
+static _Noreturn void lsh_exec_process(Shell* const shell,
+                                       Process const* const process,
+                                       Descriptors const fd) {
+    // Shell set its signals to SIG_IGN and blocked SIGCHLD. We inherited
+    // those, therefore we have to reset them to SIG_DFL and unblock.
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+    lsh_apply_placement(&process->placement);
+
+    lsh_move_descriptor(fd.in, STDIN_FILENO);
+    lsh_move_descriptor(fd.out, STDOUT_FILENO);
+    lsh_move_descriptor(fd.err, STDERR_FILENO);
+    for(int i = 0; i < fd.redirect_count; ++i) {
+        Redirect const* const redirect = &fd.redirects[i];
+        if(redirect->fd > STDERR_FILENO && !lsh_apply_redirect(redirect)) {
+            lsh_print_redirect_error(redirect, STDERR_FILENO);
+            _exit(EXIT_FAILURE);
+        }
+    }
+
+    if(process->substitution_fds != NULL) {
+        for(int const* i = process->substitution_fds; *i >= 0; ++i) {
+            fcntl(*i, F_SETFD, 0);
+        }
+    }
+
+    if(process->assignments != NULL) {
+        for(char** i = process->assignments; *i != NULL; ++i) {
+            lsh_assign_variable(*i, true);
+        }
+    }
+
+    // execvp searches the PATH of environ, therefore we replace environ
+    // instead of using execvpe.
+    environ = lsh_get_envp();
+    // A forked child leaves with _exit, because exit would rewind the shared
+    // offset of a script that the shell is still reading.
+    if(process->batched) {
+        _exit(lsh_run_batches(shell, process));
+    }
+
+    if(process->group != NULL) {
+        lsh_jobs_enter_subshell();
+        _exit(lsh_run_group(shell, process->group, true));
+    }
+
+    execvp(process->args[0], process->args);
+    perror("execvp");
+    _exit(EXIT_FAILURE);
+}
+
+// lsh_run_process
+// Start a child process that executes the process. Without job control the
+// child stays in the process group of the shell.
 //
 // Returns:
 // The PID of the child process or -1 if an error occured.
 //
-static pid_t lsh_run_process(Shell* const shell, char* const* args,
+static pid_t lsh_run_process(Shell* const shell, Process const* const process,
                              pid_t const pgid, Descriptors const fd,
                              bool const foreground) {
     pid_t const pid = fork();
     if(pid != 0) { // Parent
-        if(pgid == 0) {
-            setpgid(pid, pid);
-        } else {
-            setpgid(pid, pgid);
+        if(job_control) {
+            setpgid(pid, (pgid == 0 ? pid : pgid));
         }
         return pid;
     } else { // Child
-        pid_t const child_pid = getpid();
-        pid_t const child_pgid = (pgid == 0 ? child_pid : pgid);
-        setpgid(child_pid, child_pgid);
+        if(job_control) {
+            pid_t const child_pid = getpid();
+            pid_t const child_pgid = (pgid == 0 ? child_pid : pgid);
+            setpgid(child_pid, child_pgid);
+            if(foreground) {
+                tcsetpgrp(shell->terminal, child_pgid);
+            }
+        }
+
+        lsh_exec_process(shell, process, fd);
+    }
+}
+
+static void lsh_close(int const fd) {
+    if(fd > STDERR_FILENO) {
+        close(fd);
+    }
+}
 
-        if(foreground) {
-            tcsetpgrp(shell->terminal, child_pgid);
+// lsh_resolve_redirects
+// Apply the redirects of the standard descriptors of the process to fd in the
+// order they were written, so that 2>&1 after >file refers to the file. The
+// redirects of other descriptors are left to the process.
+//
+// Returns:
+// false if a redirect failed, in which case the error has been printed.
+//
+static bool lsh_resolve_redirects(Process const* const process,
+                                  Descriptors* const fd) {
+    int* const slots[] = {&fd->in, &fd->out, &fd->err};
+    for(int i = 0; i < process->redirect_count; ++i) {
+        Redirect const* const redirect = &process->redirects[i];
+        if(redirect->fd > STDERR_FILENO) {
+            continue;
         }
 
-        // Shell set its signals to SIG_IGN. We inherited those, therefore we
-        // have to reset them to SIG_DFL.
-        signal(SIGINT, SIG_DFL);
-        signal(SIGQUIT, SIG_DFL);
-        signal(SIGTSTP, SIG_DFL);
-        signal(SIGTTIN, SIG_DFL);
-        signal(SIGTTOU, SIG_DFL);
-        signal(SIGCHLD, SIG_DFL);
+        int target = -1;
+        if(redirect->mode == REDIRECT_DUPLICATE) {
+            // The standard descriptors refer to those of the process.
+            int const source =
+                (redirect->source <= STDERR_FILENO ? *slots[redirect->source]
+                                                   : redirect->source);
+            bool const valid = (redirect->source <= STDERR_FILENO
+                                    ? source >= 0
+                                    : lsh_is_user_descriptor(source));
+            errno = EBADF;
+            target = (valid ? fcntl(source, F_DUPFD_CLOEXEC, 0) : -1);
+        } else if(redirect->mode != REDIRECT_CLOSE) {
+            target = open(redirect->path,
+                          lsh_redirect_flags(redirect->mode) | O_CLOEXEC,
+                          0666);
+        }
 
-        if(fd.in != STDIN_FILENO) {
-            dup2(fd.in, STDIN_FILENO);
-            close(fd.in);
+        if(target < 0 && redirect->mode != REDIRECT_CLOSE) {
+            lsh_print_redirect_error(redirect, STDERR_FILENO);
+            return false;
         }
 
-        if(fd.out != STDOUT_FILENO) {
-            dup2(fd.out, STDOUT_FILENO);
-            close(fd.out);
+        lsh_close(*slots[redirect->fd]);
+        *slots[redirect->fd] = target;
+    }
+    fd->redirects = process->redirects;
+    fd->redirect_count = process->redirect_count;
+    return true;
+}
+
+// lsh_has_other_redirects
+// Check whether the process redirects descriptors other than the standard
+// ones, which only the process itself can apply.
+//
+static bool lsh_has_other_redirects(Process const* const process) {
+    for(int i = 0; i < process->redirect_count; ++i) {
+        if(process->redirects[i].fd > STDERR_FILENO) {
+            return true;
         }
+    }
+    return false;
+}
+
+// lsh_shift_args
+// Remove the first count arguments of the process.
+//
+static void lsh_shift_args(Process* const process, int const count) {
+    char** const args = process->args;
+    int size = count;
+    while(args[size] != NULL) {
+        size += 1;
+    }
+    memmove(args, args + count, (size - count + 1) * sizeof(char*));
+    if(process->batched) {
+        process->batch_index -= count;
+    }
+}
+
+// lsh_take_prefixes
+// Remove the leading "timeout", "place", "capture" and "coproc" from the
+// arguments of the process. The deadline is given to the job and the shortest
+// timeout of a pipeline applies to the job. The placement overrides that of
+// the job for this process only. A capture of any stage captures the output
+// of the whole job. An invalid prefix or one without a command is left to the
+// builtin.
+//
+static void lsh_take_prefixes(Job* const job, Process* const process) {
+    Placement stage = {0};
+    while(true) {
+        char** const args = process->args;
+        if(strcmp(args[0], "timeout") == 0) {
+            Job_Timeout timeout;
+            int const consumed = lsh_parse_timeout(args, &timeout, -1);
+            if(consumed < 0 || args[consumed] == NULL) {
+                break;
+            }
+
+            lsh_shift_args(process, consumed);
+            if(!job->timeout.enabled ||
+               lsh_timespec_before(timeout.duration, job->timeout.duration)) {
+                job->timeout = timeout;
+            }
+        } else if(strcmp(args[0], "place") == 0) {
+            Placement placement;
+            int const consumed = lsh_parse_placement(args, &placement, -1);
+            if(consumed < 0 || args[consumed] == NULL) {
+                break;
+            }
+
+            lsh_shift_args(process, consumed);
+            lsh_merge_placement(&stage, &placement);
+        } else if(strcmp(args[0], "capture") == 0) {
+            size_t size;
+            int const consumed = lsh_parse_capture(args, &size, -1);
+            if(consumed < 0 || args[consumed] == NULL) {
+                break;
+            }
 
-        if(fd.err != STDERR_FILENO) {
-            dup2(fd.err, STDERR_FILENO);
-            close(fd.err);
+            lsh_shift_args(process, consumed);
+            if(size > job->capture_size) {
+                job->capture_size = size;
+            }
+        } else if(strcmp(args[0], "coproc") == 0) {
+            if(args[1] == NULL) {
+                break;
+            }
+
+            lsh_shift_args(process, 1);
+            job->coproc = true;
+        } else {
+            break;
         }
+    }
 
-        execvp(args[0], args);
-        perror("execvp");
-        exit(EXIT_FAILURE);
+    process->placement = job->placement;
+    lsh_merge_placement(&process->placement, &stage);
+}
+
+// lsh_find_free_user_descriptor
+// Returns:
+// A descriptor of the user above the standard ones that holds a placeholder
+// and differs from other, or -1 if there is none.
+//
+static int lsh_find_free_user_descriptor(int const other) {
+    for(int fd = STDERR_FILENO + 1; fd < LSH_USER_FD_LIMIT; ++fd) {
+        int const flags = fcntl(fd, F_GETFD);
+        if(fd != other && !coproc_fds[fd] &&
+           (flags < 0 || (flags & FD_CLOEXEC) != 0)) {
+            return fd;
+        }
     }
+    return -1;
 }
 
-static void lsh_close(int const fd) {
-    if(fd != STDIN_FILENO && fd != STDOUT_FILENO && fd != STDERR_FILENO) {
-        close(fd);
+// lsh_open_coproc
+// Create the pipes of a coprocess. The ends of the shell replace the
+// placeholders of free descriptors of the user, so that redirects of later
+// commands can refer to them by number.
+//
+// Parameters:
+// shell_fds - receive the descriptor the shell reads the output of the
+//             coprocess from and the one it writes its input to.
+// in - receives the standard input of the first process.
+// out - receives the standard output of the last process.
+//
+// Returns:
+// false if there are not enough free descriptors, in which case the error
+// has been printed.
+//
+static bool lsh_open_coproc(int* const shell_fds, int* const in,
+                            int* const out) {
+    int const read_fd = lsh_find_free_user_descriptor(-1);
+    int const write_fd = lsh_find_free_user_descriptor(read_fd);
+    if(read_fd < 0 || write_fd < 0) {
+        fprintf(stderr, "coproc: no free descriptors below %d\n",
+                LSH_USER_FD_LIMIT);
+        return false;
     }
+
+    int input[2];
+    int output[2];
+    if(pipe2(input, O_CLOEXEC) < 0 || pipe2(output, O_CLOEXEC) < 0) {
+        perror("lsh_open_coproc: pipe failed");
+        exit(EXIT_FAILURE);
+    }
+
+    dup3(output[0], read_fd, O_CLOEXEC);
+    dup3(input[1], write_fd, O_CLOEXEC);
+    close(output[0]);
+    close(input[1]);
+    coproc_fds[read_fd] = true;
+    coproc_fds[write_fd] = true;
+    shell_fds[0] = read_fd;
+    shell_fds[1] = write_fd;
+    *in = input[0];
+    *out = output[1];
+    return true;
 }
 
-void lsh_start_job(Shell* const shell, Job* const job, bool const foreground) {
-    if(foreground) {
-        current_job = job;
+// lsh_announce_coproc
+// Set COPROC_READ and COPROC_WRITE to the descriptors of the shell and
+// COPROC_PID to the first process of the coprocess.
+//
+static void lsh_announce_coproc(Job const* const job,
+                                int const* const shell_fds) {
+    char number[16];
+    snprintf(number, sizeof(number), "%d", shell_fds[0]);
+    lsh_set_variable("COPROC_READ", number);
+    snprintf(number, sizeof(number), "%d", shell_fds[1]);
+    lsh_set_variable("COPROC_WRITE", number);
+    snprintf(number, sizeof(number), "%d", (int)job->pgid);
+    lsh_set_variable("COPROC_PID", number);
+}
+
+// lsh_launch_job
+// Spawn the processes of the job without waiting for them. A captured job
+// writes the standard output of its last process and the standard error of
+// every process to the capture unless they are redirected. A brace group that
+// makes up a job in the foreground runs in the shell like a builtin, other
+// groups run in a forked subshell. A coprocess runs in the background with
+// its input and output connected to pipes.
+//
+static void lsh_launch_job(Shell* const shell, Job* const job,
+                           bool foreground) {
+    clock_gettime(CLOCK_REALTIME, &job->started_at);
+    clock_gettime(CLOCK_MONOTONIC, &job->started);
+    // A capture of any stage applies to the stages before it as well.
+    for(int i = 0; i < job->process_count; ++i) {
+        Process* const process = &job->processes[i];
+        if(process->args != NULL && process->args[0] != NULL) {
+            lsh_take_prefixes(job, process);
+        }
     }
 
-    int fd_pipe[2];
-    Descriptors fd = {
-        .in = STDIN_FILENO,
-        .out = STDOUT_FILENO,
-        .err = STDERR_FILENO,
-    };
-    for(Process* process = job->first_process; process != NULL;
-        process = process->next) {
-        // Set up pipe.
-        if(process->next) {
-            if(pipe(fd_pipe) < 0) {
+    // A coprocess runs in the background.
+    foreground = foreground && !job->coproc;
+    int coproc_in = STDIN_FILENO;
+    int coproc_out = STDOUT_FILENO;
+    int shell_fds[2] = {-1, -1};
+    if(job->coproc && !lsh_open_coproc(shell_fds, &coproc_in, &coproc_out)) {
+        for(int i = 0; i < job->process_count; ++i) {
+            job->processes[i].exit_code = EXIT_FAILURE;
+            lsh_set_process_status(job, &job->processes[i],
+                                   PROCESS_COMPLETED);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &job->spawned);
+        return;
+    }
+
+    int const capture_fd =
+        (job->capture_size > 0
+             ? lsh_capture_open(job->id, job->command, job->capture_size)
+             : -1);
+    int next_in = coproc_in;
+    for(int i = 0; i < job->process_count; ++i) {
+        Process* const process = &job->processes[i];
+        Descriptors fd = {
+            .in = next_in,
+            .out = (i + 1 == job->process_count ? coproc_out : STDOUT_FILENO),
+            .err = STDERR_FILENO,
+        };
+        next_in = STDIN_FILENO;
+
+        // Set up pipe. Its ends reach the children only through dup2, so that
+        // no other process of the job holds them open.
+        if(i + 1 < job->process_count) {
+            int fd_pipe[2];
+            if(pipe2(fd_pipe, O_CLOEXEC) < 0) {
                 perror("lsh_start_job: pipe failed");
                 exit(EXIT_FAILURE);
             }
             fd.out = fd_pipe[1];
+            next_in = fd_pipe[0];
         }
 
-        // Redirects take priority over pipes, therefore we overwrite.
+        // Descriptors given by the caller take priority over pipes, therefore
+        // we overwrite.
         if(process->fd.in != STDIN_FILENO) {
             // Close previous pipe.
             lsh_close(fd.in);
@@ -355,6 +1169,7 @@ void lsh_start_job(Shell* const shell, Job* const job, bool const foreground) {
         }
 
         if(process->fd.out != STDOUT_FILENO) {
+            lsh_close(fd.out);
             fd.out = process->fd.out;
         }
 
@@ -362,50 +1177,318 @@ void lsh_start_job(Shell* const shell, Job* const job, bool const foreground) {
             fd.err = process->fd.err;
         }
 
-        Builtin_Fn const* const builtin = lsh_find_builtin(process->args[0]);
-        if(builtin != NULL) {
-            // TODO: Ignore status.
-            builtin->fn(shell, process->args, fd);
-            process->status = PROCESS_COMPLETED;
+        if(capture_fd >= 0) {
+            if(fd.out == STDOUT_FILENO) {
+                fd.out = fcntl(capture_fd, F_DUPFD_CLOEXEC, 0);
+            }
+            if(fd.err == STDERR_FILENO) {
+                fd.err = fcntl(capture_fd, F_DUPFD_CLOEXEC, 0);
+            }
+        }
+
+        if(fd.in == STDIN_FILENO && default_fds.in != STDIN_FILENO) {
+            fd.in = fcntl(default_fds.in, F_DUPFD_CLOEXEC, 0);
+        }
+        if(fd.out == STDOUT_FILENO && default_fds.out != STDOUT_FILENO) {
+            fd.out = fcntl(default_fds.out, F_DUPFD_CLOEXEC, 0);
+        }
+        if(fd.err == STDERR_FILENO && default_fds.err != STDERR_FILENO) {
+            fd.err = fcntl(default_fds.err, F_DUPFD_CLOEXEC, 0);
+        }
+
+        if(!lsh_resolve_redirects(process, &fd)) {
+            process->exit_code = EXIT_FAILURE;
+            lsh_set_process_status(job, process, PROCESS_COMPLETED);
+        } else if(process->group != NULL && !process->subshell &&
+                  foreground && job->process_count == 1 &&
+                  !lsh_has_other_redirects(process)) {
+            // The redirects of the group are opened once and stand for the
+            // standard descriptors of its commands.
+            Descriptors const outer = default_fds;
+            default_fds = fd;
+            process->exit_code = lsh_run_group(shell, process->group, false);
+            default_fds = outer;
+            lsh_set_process_status(job, process, PROCESS_COMPLETED);
+        } else if(process->group == NULL &&
+                  (process->args == NULL || process->args[0] == NULL)) {
+            // Either a plain assignment or the words of the command expanded
+            // to nothing.
+            if(process->assignments != NULL) {
+                for(char** i = process->assignments; *i != NULL; ++i) {
+                    lsh_assign_variable(*i, false);
+                }
+            }
+            lsh_set_process_status(job, process, PROCESS_COMPLETED);
         } else {
-            pid_t const pid = lsh_run_process(shell, process->args, job->pgid,
-                                              fd, foreground);
-            process->pid = pid;
-            if(job->pgid == 0) {
-                job->pgid = pid;
+            Builtin_Fn const* const builtin =
+                (process->group == NULL ? lsh_find_builtin(process->args[0])
+                                        : NULL);
+            if(builtin != NULL) {
+                process->exit_code = builtin->fn(shell, process->args, fd);
+                lsh_set_process_status(job, process, PROCESS_COMPLETED);
+            } else {
+                // Batched processes and groups run in a copy of the shell,
+                // which only a fork provides. The zygote always creates
+                // process groups, therefore it needs job control, and it
+                // passes the standard descriptors only.
+                pid_t pid = -1;
+                if(job_control && lsh_zygote_running() && !process->batched &&
+                   process->group == NULL &&
+                   process->substitution_fds == NULL &&
+                   !lsh_has_other_redirects(process) && fd.in >= 0 &&
+                   fd.out >= 0 && fd.err >= 0) {
+                    pid = lsh_zygote_spawn(shell, process, job->pgid, fd,
+                                           foreground, &process->pidfd);
+                }
+
+                if(pid < 0) {
+                    pid = lsh_run_process(shell, process, job->pgid, fd,
+                                          foreground);
+                }
+                process->pid = pid;
+                if(job->pgid == 0) {
+                    job->pgid = pid;
+                }
             }
         }
 
+        // The children hold their own copies of the descriptors.
         lsh_close(fd.in);
-        lsh_close(fd_pipe[1]);
-        fd.in = fd_pipe[0];
-        fd.out = STDOUT_FILENO;
-        fd.err = STDERR_FILENO;
+        lsh_close(fd.out);
+        lsh_close(fd.err);
+        lsh_close_substitution_fds(process->substitution_fds);
+        process->substitution_fds = NULL;
     }
 
+    if(capture_fd >= 0) {
+        close(capture_fd);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &job->spawned);
+
+    if(job->coproc) {
+        lsh_announce_coproc(job, shell_fds);
+    }
+
+    // Jobs of builtins only are never current, so that fg and bg refer to the
+    // job before them.
+    if(foreground && job->pgid != 0) {
+        current_job = job;
+    }
+
+    if(job->timeout.enabled && job->pgid != 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        job->timeout.deadline = lsh_timespec_add(now, job->timeout.duration);
+        lsh_arm_timer();
+    }
+}
+
+void lsh_start_job(Shell* const shell, Job* const job, bool const foreground) {
+    lsh_launch_job(shell, job, foreground);
+
     if(job->pgid == 0) {
         // Job consisted only of builtin commands, which execute immediately,
         // therefore the job is complete and there is nothing else to be done.
         return;
     }
 
-    if(foreground) {
+    if(foreground && !job->coproc) {
         lsh_set_job_in_foreground(shell, job, false);
     } else {
         lsh_set_job_in_background(shell, job, false);
     }
 }
 
+void lsh_start_job_with_idle_work(Shell* const shell, Job* const job,
+                                  bool const foreground, Idle_Work const work,
+                                  void* const context) {
+    idle_job = job;
+    idle_work = work;
+    idle_context = context;
+    lsh_start_job(shell, job, foreground);
+    idle_job = NULL;
+    idle_work = NULL;
+    idle_context = NULL;
+}
+
+bool lsh_exec_job(Shell* const shell, Job* const job) {
+    // The shell must outlive jobs that are still running, deadlines and
+    // clients of the control socket, and batches run in a fork.
+    if(job_control || job->process_count != 1 ||
+       lsh_control_path() != NULL) {
+        return false;
+    }
+
+    Process* const process = &job->processes[0];
+    if(process->args == NULL || process->args[0] == NULL ||
+       process->batched || lsh_find_builtin(process->args[0]) != NULL) {
+        return false;
+    }
+
+    for(Job_List_Entry *b = lsh_job_list_begin(&job_list),
+                       *e = lsh_job_list_end(&job_list);
+        b != e; b = lsh_job_list_next(b)) {
+        Job* const other = lsh_job_list_value(b);
+        if(other != job && !lsh_is_job_completed(other)) {
+            return false;
+        }
+    }
+
+    // The shell would end with the failure of the job anyway.
+    Descriptors fd = process->fd;
+    if(!lsh_resolve_redirects(process, &fd)) {
+        exit(EXIT_FAILURE);
+    }
+
+    process->placement = job->placement;
+    fflush(NULL);
+    lsh_exec_process(shell, process, fd);
+}
+
+bool lsh_redirect_shell(Descriptors const fd) {
+    int const targets[] = {fd.in, fd.out, fd.err};
+    for(int std = STDIN_FILENO; std <= STDERR_FILENO; ++std) {
+        if(targets[std] < 0) {
+            lsh_reserve_descriptor(std);
+        } else if(targets[std] != std) {
+            dup2(targets[std], std);
+        }
+    }
+
+    bool others = false;
+    for(int i = 0; i < fd.redirect_count; ++i) {
+        Redirect const* const redirect = &fd.redirects[i];
+        if(redirect->fd <= STDERR_FILENO) {
+            continue;
+        }
+
+        others = true;
+        coproc_fds[redirect->fd] = false;
+        if(redirect->mode == REDIRECT_CLOSE) {
+            lsh_reserve_descriptor(redirect->fd);
+        } else if(!lsh_apply_redirect(redirect)) {
+            lsh_print_redirect_error(redirect, STDERR_FILENO);
+            return false;
+        }
+    }
+
+    // The children of the zygote inherit its descriptors rather than those of
+    // the shell.
+    if(others) {
+        lsh_zygote_stop();
+    }
+    return true;
+}
+
+void lsh_exec_program(char** const args) {
+    int const signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD};
+    int const count = sizeof(signals) / sizeof(signals[0]);
+    struct sigaction const reset = {.sa_handler = SIG_DFL};
+    struct sigaction saved[sizeof(signals) / sizeof(signals[0])];
+    for(int i = 0; i < count; ++i) {
+        sigaction(signals[i], &reset, &saved[i]);
+    }
+
+    sigset_t mask;
+    sigset_t saved_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &mask, &saved_mask);
+
+    environ = lsh_get_envp();
+    fflush(NULL);
+    execvp(args[0], args);
+
+    int const error = errno;
+    sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+    for(int i = 0; i < count; ++i) {
+        sigaction(signals[i], &saved[i], NULL);
+    }
+    // A SIGCHLD may have been discarded while it was unblocked, therefore the
+    // event loop checks the children again.
+    raise(SIGCHLD);
+    errno = error;
+}
+
+int lsh_get_job_exit_status(Job const* const job) {
+    if(job->process_count == 0) {
+        return 0;
+    }
+
+    Process const* const last = &job->processes[job->process_count - 1];
+    if(last->status == PROCESS_TERMINATED) {
+        return 128 + last->exit_code;
+    }
+    return last->exit_code;
+}
+
+char* lsh_run_job_captured(Shell* const shell, Job* const job,
+                           Arena* const arena, size_t* const size) {
+    int fd_pipe[2];
+    if(pipe2(fd_pipe, O_CLOEXEC) < 0) {
+        perror("lsh_run_job_captured: pipe failed");
+        return NULL;
+    }
+
+    Process* const last = (job->process_count > 0
+                               ? &job->processes[job->process_count - 1]
+                               : NULL);
+    if(last != NULL && last->fd.out == STDOUT_FILENO) {
+        last->fd.out = fd_pipe[1];
+    } else {
+        close(fd_pipe[1]);
+    }
+
+    // The launch closes the write end once the last process has been spawned,
+    // therefore we read until all writers are gone.
+    lsh_launch_job(shell, job, true);
+    char* const output = lsh_arena_read_fd(arena, fd_pipe[0], size);
+    close(fd_pipe[0]);
+
+    if(job->pgid != 0) {
+        lsh_set_job_in_foreground(shell, job, false);
+    }
+    return output;
+}
+
+// lsh_continue_job
+// Send SIGCONT to the job and mark its stopped processes as running, so that
+// a wait does not mistake the job for stopped before the children report.
+//
+static void lsh_continue_job(Job* const job, char const* const caller) {
+    if(lsh_signal_job(job, SIGCONT) < 0) {
+        fprintf(stderr, "%s: failed to send SIGCONT: %s\n", caller,
+                strerror(errno));
+        return;
+    }
+
+    for(int i = 0; i < job->process_count; ++i) {
+        Process* const process = &job->processes[i];
+        if(process->status == PROCESS_STOPPED) {
+            lsh_set_process_status(job, process, PROCESS_RUNNING);
+        }
+    }
+}
+
+// lsh_wait_for
+// Wait until the job completes or stops. Deadlines of all jobs are enforced
+// while waiting and the idle work of the job is done.
+//
 static void lsh_wait_for(Job* const job) {
+    struct pollfd fd = {.fd = lsh_get_event_fd(), .events = POLLIN};
     while(true) {
-        siginfo_t info = {0};
-        int const status = waitid(P_ALL, 0, &info, WEXITED | WSTOPPED);
-        if(status != 0 || info.si_pid == 0) {
+        lsh_dispatch_events();
+        if(lsh_is_job_completed(job) || lsh_is_job_stopped(job)) {
             break;
         }
 
-        lsh_update_process_status(info.si_pid, info.si_code);
-        if(lsh_is_job_completed(job) || lsh_is_job_stopped(job)) {
+        // The events are checked again before the next piece of work.
+        if(job == idle_job && idle_work(idle_context)) {
+            continue;
+        }
+
+        if(poll(&fd, 1, -1) < 0 && errno != EINTR) {
+            perror("lsh_wait_for: poll failed");
             break;
         }
     }
@@ -413,14 +1496,19 @@ static void lsh_wait_for(Job* const job) {
 
 void lsh_set_job_in_foreground(Shell const* const shell, Job* const job,
                                bool const send_continue) {
+    if(!job_control) {
+        if(send_continue) {
+            lsh_continue_job(job, "lsh_set_job_in_foreground");
+        }
+        lsh_wait_for(job);
+        return;
+    }
+
     tcsetpgrp(shell->terminal, job->pgid);
 
     if(send_continue) {
         tcsetattr(shell->terminal, TCSADRAIN, &job->attributes);
-        int const status = kill(job->pgid, SIGCONT);
-        if(status < 0) {
-            perror("lsh_set_job_in_foreground: failed to send SIGCONT");
-        }
+        lsh_continue_job(job, "lsh_set_job_in_foreground");
     }
 
     lsh_wait_for(job);
@@ -435,9 +1523,6 @@ void lsh_set_job_in_background(Shell const* const shell, Job* const job,
                                bool const send_continue) {
     UNUSED(shell);
     if(send_continue) {
-        int const status = kill(job->pgid, SIGCONT);
-        if(status < 0) {
-            perror("lsh_set_job_in_background: failed to send SIGCONT");
-        }
+        lsh_continue_job(job, "lsh_set_job_in_background");
     }
 }
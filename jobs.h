@@ -1,10 +1,13 @@
 #pragma once
 
 #include <common.h>
+#include <parser.h>
+#include <placement.h>
 #include <shell.h>
 
 #include <sys/types.h>
 #include <termios.h>
+#include <time.h>
 
 typedef struct Job_List Job_List;
 typedef struct Job_List_Entry Job_List_Entry;
@@ -20,36 +23,194 @@ Job* lsh_job_list_value(Job_List_Entry* entry);
 void lsh_job_list_erase(Job_List_Entry* entry);
 Job* lsh_find_job_with_id(Job_List* list, int id);
 
-void lsh_jobs_initialise(void);
+// lsh_jobs_initialise
+// Jobs are given their own process groups and the terminal only when the
+// shell is interactive.
+//
+void lsh_jobs_initialise(Shell const* shell);
+
+// lsh_jobs_enter_subshell
+// Make a forked child a shell of its own that runs the commands of a group.
+// It has no job control and none of the jobs of its parent, and it waits for
+// its children with its own event loop.
+//
+void lsh_jobs_enter_subshell(void);
+
+// lsh_print_pool_statistics
+// Print the statistics of the pools of jobs and processes.
+//
+void lsh_print_pool_statistics(int fd_out);
+
+// lsh_has_job_notifications
+// Check whether any job has completed since the last cleanup. Child events
+// and deadlines are handled by the event loop.
+//
+bool lsh_has_job_notifications(void);
 
 typedef enum Process_Status {
     PROCESS_RUNNING,
     PROCESS_STOPPED,
     PROCESS_COMPLETED,
     PROCESS_TERMINATED,
+    PROCESS_STATUS_COUNT,
 } Process_Status;
 
 typedef struct Process {
-    struct Process* next;
+    // Owns the strings of args.
+    Arena arena;
     char** args;
+    // Variable assignments exported to the program only.
+    char** assignments;
+    // See Process_Args.
+    bool batched;
+    char* batch_word;
+    int batch_index;
+    // See Process_Args. A group has no args.
+    char* group;
+    bool subshell;
+    // Applied in the child before the program is executed.
+    Placement placement;
+    // Descriptors of process substitutions terminated by -1 or NULL. They are
+    // inherited by this process only and closed once it has been spawned.
+    int* substitution_fds;
     pid_t pid;
+    // Refers to the process until it is reaped if it was spawned by the
+    // zygote, -1 otherwise.
+    int pidfd;
     Process_Status status;
+    // Exit status or the number of the terminating signal.
+    int exit_code;
+    // CLOCK_MONOTONIC time at which the process exited.
+    struct timespec finished;
+    // Standard descriptors given to the process before its redirects apply,
+    // such as the pipe of a command substitution.
     Descriptors fd;
+    // See Process_Args. Owned by the process.
+    Redirect* redirects;
+    int redirect_count;
 } Process;
 
 Process* lsh_find_process_with_pid(pid_t pid);
 
+#define LSH_TIMEOUT_MAX_SIGNALS 8
+
+typedef struct Job_Timeout {
+    bool enabled;
+    // Whether at least one signal has been sent.
+    bool expired;
+    // Time from the launch of the job to the first signal.
+    struct timespec duration;
+    // Time between consecutive signals.
+    struct timespec grace;
+    // CLOCK_MONOTONIC time at which the next signal is sent.
+    struct timespec deadline;
+    int signals[LSH_TIMEOUT_MAX_SIGNALS];
+    int signal_count;
+    int next_signal;
+} Job_Timeout;
+
 typedef struct Job {
     int id;
+    // Process group of the job or, without job control, the PID of its first
+    // process. 0 if the job consists of builtins only.
     pid_t pgid;
-    Process* first_process;
+    // The stages of the pipeline in order.
+    Process* processes;
+    int process_count;
+    // Number of processes in each status.
+    int status_counts[PROCESS_STATUS_COUNT];
     char const* command;
+    // CLOCK_REALTIME and CLOCK_MONOTONIC time of the launch.
+    struct timespec started_at;
+    struct timespec started;
+    // CLOCK_MONOTONIC time at which every process of the job had been
+    // spawned.
+    struct timespec spawned;
     struct termios attributes;
+    Job_Timeout timeout;
+    // Placement of every process of the job unless overridden by the
+    // process.
+    Placement placement;
+    // Size of the buffer that captures the output of the job or 0 if the
+    // output is not captured.
+    size_t capture_size;
+    // Whether the job is a coprocess, which runs in the background with its
+    // input and output connected to descriptors of the shell.
+    bool coproc;
 } Job;
 
 Job* lsh_get_current_job(void);
 
-Job* lsh_create_job(void);
+// lsh_create_job
+// Append a job to the job list.
+//
+// Parameters:
+// command - the command line of the job, allocated with malloc. The job takes
+//           ownership of it.
+//
+Job* lsh_create_job(char* command);
+
+// lsh_remove_job
+// Remove the job from the job list without reporting its status.
+//
+void lsh_remove_job(Job* job);
+
+// lsh_create_processes_from_command
+// Create the processes of the job from a pipeline. Takes ownership of the
+// arguments of the command and opens the redirects.
+//
+void lsh_create_processes_from_command(Job* job, Command command);
+
+// lsh_parse_timeout
+// Parse the arguments of "timeout [-s SIGNAL]... [-k GRACE] DURATION" into a
+// timeout. The signals are sent in the order given, one at the deadline and
+// each following one GRACE later. The default is TERM followed by KILL 5
+// seconds later.
+//
+// Parameters:
+// args - the arguments starting with "timeout".
+// fd_err - receives the error messages or -1 to discard them.
+//
+// Returns:
+// The number of arguments consumed or -1 if they are invalid.
+//
+int lsh_parse_timeout(char** args, Job_Timeout* timeout, int fd_err);
+
+// lsh_parse_signal
+// Parse a signal given by its number or by its name with or without the SIG
+// prefix.
+//
+// Returns:
+// The signal number or 0 if it is not valid.
+//
+int lsh_parse_signal(char const* string);
+
+typedef enum Job_Status {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_COMPLETED,
+    JOB_TERMINATED,
+    // Completed after the deadline signalled the job.
+    JOB_TIMED_OUT,
+} Job_Status;
+
+Job_Status lsh_get_job_status(Job* job);
+
+// lsh_get_job_exit_status
+// Returns:
+// The exit status of the last process of the job or 128 plus the number of
+// the signal that terminated it.
+//
+int lsh_get_job_exit_status(Job const* job);
+
+// lsh_signal_job
+// Send the signal to the process group of the job or, without job control, to
+// each of its processes that has not exited.
+//
+// Returns:
+// 0 if the signal was sent to at least one process, -1 otherwise.
+//
+int lsh_signal_job(Job* job, int signal);
 
 bool lsh_is_job_stopped(Job* job);
 bool lsh_is_job_completed(Job* job);
@@ -68,6 +229,83 @@ void lsh_cleanup_jobs(void);
 //
 void lsh_start_job(Shell* shell, Job* job, bool foreground);
 
+// Idle_Work
+// A short piece of work done while the shell waits for a job.
+//
+// Returns:
+// false if there is nothing left to do for now.
+//
+typedef bool (*Idle_Work)(void* context);
+
+// lsh_start_job_with_idle_work
+// Start the job like lsh_start_job and do the work while the shell waits for
+// the job in the foreground. The job is checked between pieces of work, so
+// that its completion is noticed once the piece at hand is done. The work is
+// not done while waiting for other jobs, such as those of a brace group that
+// the job runs in the shell.
+//
+void lsh_start_job_with_idle_work(Shell* shell, Job* job, bool foreground,
+                                  Idle_Work work, void* context);
+
+// lsh_exec_job
+// Replace the shell with the program of the job instead of forking, which
+// is possible when the shell has no job control and nothing left to do: the
+// job is a single external command and no other job, deadline or control
+// client needs the shell.
+//
+// Returns:
+// false if the job must be started normally. Does not return otherwise.
+//
+bool lsh_exec_job(Shell* shell, Job* job);
+
+// lsh_apply_redirect
+// Redirect a descriptor of the calling process. Unlike the descriptors that
+// the shell opens for itself, the result is inherited across exec.
+//
+// Returns:
+// false with errno set if the file cannot be opened or the duplicated
+// descriptor is not open.
+//
+bool lsh_apply_redirect(Redirect const* redirect);
+
+// lsh_print_redirect_error
+// Print the error of a redirect that failed with errno.
+//
+void lsh_print_redirect_error(Redirect const* redirect, int fd_err);
+
+// lsh_redirect_shell
+// Make the descriptors the standard descriptors of the shell and apply the
+// redirects of the other descriptors to the shell, so that they remain in
+// effect for the commands that follow.
+//
+// Returns:
+// false if a redirect failed, in which case the error has been printed and
+// the redirects before it remain applied.
+//
+bool lsh_redirect_shell(Descriptors fd);
+
+// lsh_exec_program
+// Replace the shell with the program. The signals that the shell ignores or
+// blocks are reset for the program.
+//
+// Returns:
+// Only if the program could not be executed, with errno set and the signals
+// of the shell restored.
+//
+void lsh_exec_program(char** args);
+
+// lsh_run_job_captured
+// Run the job in the foreground with the standard output of its last process
+// connected to a pipe and read the output into the arena as the job runs.
+//
+// Parameters:
+// size - receives the size of the output.
+//
+// Returns:
+// The null-terminated output owned by the arena or NULL on failure.
+//
+char* lsh_run_job_captured(Shell* shell, Job* job, Arena* arena, size_t* size);
+
 // lsh_set_job_in_foreground
 // Move the job to the foreground.
 //
@@ -1,85 +1,352 @@
+#include <builtin.h>
+#include <control.h>
+#include <editor.h>
+#include <events.h>
+#include <history.h>
 #include <jobs.h>
 #include <parser.h>
+#include <plans.h>
+#include <record.h>
 #include <shell.h>
+#include <vars.h>
+#include <zygote.h>
 
-#include <fcntl.h>
+#include <errno.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/stat.h>
+#include <string.h>
 #include <unistd.h>
 
-static Process* lsh_create_process_from_command(Command command) {
-    Process* process = NULL;
-    Process* current_process = NULL;
-    Process_Args* current = NULL;
-    Process_Args* next = command.args;
-    while(next != NULL) {
-        current = next;
-        next = next->next;
-        if(process == NULL) {
-            process = lsh_alloc_and_zero(sizeof(Process));
-            current_process = process;
-        } else {
-            Process* new_process = lsh_alloc_and_zero(sizeof(Process));
-            current_process->next = new_process;
-            current_process = new_process;
+static char const* const lsh_cwd_unknown = "<unknown>";
+static char const* const lsh_lsh_color = "22;198;12";
+static char const* const lsh_cwd_color = "56;114;242";
+
+// build_prompt
+// Returns:
+// The prompt. Caller must free it.
+//
+static char* build_prompt(char const* cwd) {
+    if(cwd == NULL) {
+        cwd = lsh_cwd_unknown;
+    }
+
+    char const format[] = "\033[38;2;%smlsh \033[38;2;%sm%s\033[0m$ ";
+    int const size =
+        snprintf(NULL, 0, format, lsh_lsh_color, lsh_cwd_color, cwd);
+    char* const prompt = lsh_alloc_and_zero(size + 1);
+    snprintf(prompt, size + 1, format, lsh_lsh_color, lsh_cwd_color, cwd);
+    return prompt;
+}
+
+static void lsh_dump_memory_statistics(void) {
+    lsh_print_memory_statistics(STDERR_FILENO);
+}
+
+// lsh_read_script_line
+// Read the next command of a script, skipping blank lines and comments.
+//
+// Returns:
+// The line without its newline or NULL at the end of the script. Caller must
+// free it.
+//
+static char* lsh_read_script_line(FILE* const file, int* const line_number) {
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t size = 0;
+    while((size = getline(&line, &capacity, file)) >= 0) {
+        *line_number += 1;
+        if(size > 0 && line[size - 1] == '\n') {
+            line[size - 1] = '\0';
         }
 
-        current_process->args = current->values;
-        current->values = NULL;
+        char const* first = line;
+        while(*first == ' ' || *first == '\t') {
+            first += 1;
+        }
 
-        if(current->redirect_in != NULL) {
-            current_process->fd.in =
-                open(current->redirect_in, O_RDONLY | O_CREAT);
-        } else {
-            current_process->fd.in = STDIN_FILENO;
+        if(*first != '\0' && *first != '#') {
+            return line;
         }
+    }
+    free(line);
+    return NULL;
+}
 
-        if(current->redirect_out != NULL) {
-            current_process->fd.out =
-                open(current->redirect_out, O_WRONLY | O_CREAT);
-        } else {
-            current_process->fd.out = STDOUT_FILENO;
+// Lines of a script are read and parsed at most this far ahead of the
+// command that runs.
+#define LSH_SCRIPT_READ_AHEAD 16
+
+// Script_Line
+// A line of a script read ahead of the command that runs.
+//
+typedef struct Script_Line {
+    char* line;
+    int number;
+    bool parsed;
+    Parse_Result result;
+    // Whether the command of the line leaves the shell as it is, so that the
+    // lines after it may be parsed before it runs.
+    bool pure;
+} Script_Line;
+
+typedef struct Script {
+    Shell* shell;
+    FILE* file;
+    int line_number;
+    bool end;
+    // Queue of the lines read ahead.
+    Script_Line lines[LSH_SCRIPT_READ_AHEAD];
+    int first;
+    int count;
+} Script;
+
+// lsh_script_read
+// Append the next line of the script to the queue.
+//
+// Returns:
+// false if the queue is full or the script has ended.
+//
+static bool lsh_script_read(Script* const script) {
+    if(script->end || script->count == LSH_SCRIPT_READ_AHEAD) {
+        return false;
+    }
+
+    char* const line = lsh_read_script_line(script->file, &script->line_number);
+    if(line == NULL) {
+        script->end = true;
+        return false;
+    }
+
+    script->lines[(script->first + script->count) % LSH_SCRIPT_READ_AHEAD] =
+        (Script_Line){.line = line, .number = script->line_number};
+    script->count += 1;
+    return true;
+}
+
+static Script_Line lsh_script_pop(Script* const script) {
+    Script_Line const line = script->lines[script->first];
+    script->first = (script->first + 1) % LSH_SCRIPT_READ_AHEAD;
+    script->count -= 1;
+    return line;
+}
+
+static void lsh_free_script_line(Script_Line* const line) {
+    if(line->parsed && line->result.kind == PARSE_ERROR) {
+        free(line->result.error);
+    } else if(line->parsed) {
+        lsh_free_command(line->result.value);
+    }
+    free(line->line);
+}
+
+// lsh_is_pure_command
+// Check whether the command runs external programs only. Builtins,
+// assignments and groups may change the variables, the working directory or
+// the descriptors of the shell.
+//
+static bool lsh_is_pure_command(Command const* const command) {
+    for(Process_Args const* args = command->args; args != NULL;
+        args = args->next) {
+        if(args->group != NULL || args->assignments != NULL ||
+           args->values == NULL || args->values[0] == NULL ||
+           lsh_find_builtin(args->values[0]) != NULL) {
+            return false;
         }
+    }
+    return true;
+}
 
-        if(current->redirect_err != NULL) {
-            current_process->fd.err =
-                open(current->redirect_err, O_WRONLY | O_CREAT);
-        } else {
-            current_process->fd.err = STDERR_FILENO;
+static void lsh_script_parse(Shell* const shell, Script_Line* const line) {
+    line->result = lsh_parse_cached(shell, line->line);
+    line->parsed = true;
+    line->pure = (line->result.kind != PARSE_ERROR &&
+                  lsh_is_pure_command(&line->result.value));
+}
+
+// lsh_may_parse_ahead
+// Check whether the expansion of the line is independent of the commands that
+// run before it. Substitutions run commands and patterns match files that
+// those commands may create, therefore such lines are parsed when they are
+// reached. Quotes are not taken into account.
+//
+static bool lsh_may_parse_ahead(char const* const line) {
+    return strpbrk(line, "`*?[") == NULL && strstr(line, "$(") == NULL &&
+           strstr(line, "<(") == NULL && strstr(line, ">(") == NULL;
+}
+
+// lsh_read_ahead
+// Idle work of the commands of a script. Parses the next line whose parse
+// cannot depend on the lines before it or otherwise reads another line.
+//
+static bool lsh_read_ahead(void* const context) {
+    Script* const script = context;
+    for(int i = 0; i < script->count; ++i) {
+        Script_Line* const line =
+            &script->lines[(script->first + i) % LSH_SCRIPT_READ_AHEAD];
+        if(!line->parsed) {
+            if(!lsh_may_parse_ahead(line->line)) {
+                return false;
+            }
+
+            lsh_script_parse(script->shell, line);
+            return true;
+        }
+
+        if(!line->pure) {
+            return false;
         }
     }
-    return process;
+    return lsh_script_read(script);
 }
 
-static char const* const lsh_cwd_unknown = "<unknown>";
-static char const* const lsh_lsh_color = "22;198;12";
-static char const* const lsh_cwd_color = "56;114;242";
+// lsh_run_script
+// Run the commands of a script one line at a time. While a command runs in
+// the foreground the lines after it are read and, as far as they cannot
+// depend on it, parsed, so that the next command starts as soon as it
+// completes. The script is read at least one line ahead so that the last
+// command may replace the shell instead of being forked.
+//
+// Parameters:
+// name - names the script in error messages.
+// exec_last - whether the last command may replace the shell.
+//
+// Returns:
+// The exit status of the last command or 2 if a line fails to parse.
+//
+static int lsh_run_script(Shell* const shell, FILE* const file,
+                          char const* const name, bool const exec_last) {
+    Script script = {.shell = shell, .file = file};
+    // On a single CPU the work would only take time from the command.
+    bool const read_ahead = (sysconf(_SC_NPROCESSORS_ONLN) > 1);
+    int status = EXIT_SUCCESS;
+    while(script.count > 0 || lsh_script_read(&script)) {
+        lsh_record_begin();
+        Script_Line current = lsh_script_pop(&script);
+        if(script.count == 0) {
+            lsh_script_read(&script);
+        }
 
-static void print_header(char const* const cwd) {
-    if(cwd != NULL) {
-        printf("\033[38;2;%smlsh \033[38;2;%sm%s\033[0m$ ", lsh_lsh_color,
-               lsh_cwd_color, cwd);
-    } else {
-        printf("\033[38;2;%smlsh \033[38;2;%sm%s\033[0m$ ", lsh_lsh_color,
-               lsh_cwd_color, lsh_cwd_unknown);
+        if(!current.parsed) {
+            lsh_script_parse(shell, &current);
+        }
+
+        if(current.result.kind == PARSE_ERROR) {
+            fprintf(stderr, "lsh: %s:%d: %s\n", name, current.number,
+                    current.result.error);
+            lsh_record_command(current.line, NULL);
+            lsh_free_script_line(&current);
+            while(script.count > 0) {
+                Script_Line line = lsh_script_pop(&script);
+                lsh_free_script_line(&line);
+            }
+            return 2;
+        }
+
+        Command command = current.result.value;
+        Job* const job = lsh_create_job(current.line);
+        lsh_create_processes_from_command(job, command);
+        if(exec_last && script.count == 0 && command.foreground) {
+            lsh_exec_job(shell, job);
+        }
+
+        if(read_ahead) {
+            lsh_start_job_with_idle_work(shell, job, command.foreground,
+                                         lsh_read_ahead, &script);
+        } else {
+            lsh_start_job(shell, job, command.foreground);
+        }
+        lsh_record_command(job->command, job);
+        lsh_free_command(command);
+        lsh_update_job_statuses();
+        status = (command.foreground ? lsh_get_job_exit_status(job) : 0);
+        lsh_cleanup_jobs();
     }
+    return status;
 }
 
-int main(void) {
-    Shell shell = lsh_shell_initialise();
-    lsh_jobs_initialise();
+int main(int argc, char** argv) {
+    if(argc == 3 && strcmp(argv[1], "--zygote") == 0) {
+        return lsh_zygote_main(atoi(argv[2]));
+    }
+
+    // lsh --replay LOG [SPEED]
+    if(argc >= 3 && strcmp(argv[1], "--replay") == 0) {
+        return lsh_replay_main(argv[2], (argc >= 4 ? atof(argv[3]) : 1.0));
+    }
+
+    // The script is opened above the descriptors of the user as well.
+    lsh_reserve_user_descriptors();
+
+    // lsh [-c COMMAND | FILE]
+    FILE* script = NULL;
+    char const* script_name = NULL;
+    if(argc >= 2 && strcmp(argv[1], "-c") == 0) {
+        if(argc < 3) {
+            fprintf(stderr, "lsh: -c: expected argument\n");
+            return 2;
+        }
+
+        script = fmemopen(argv[2], strlen(argv[2]), "r");
+        script_name = "-c";
+    } else if(argc >= 2) {
+        script = fopen(argv[1], "re");
+        script_name = argv[1];
+    } else if(!isatty(STDIN_FILENO)) {
+        script = stdin;
+        script_name = "stdin";
+    }
+
+    if(script_name != NULL && script == NULL) {
+        fprintf(stderr, "lsh: %s: %s\n", script_name, strerror(errno));
+        return 127;
+    }
+
+    Shell shell = lsh_shell_initialise(script == NULL);
+    lsh_events_initialise();
+    lsh_jobs_initialise(&shell);
+    lsh_variables_initialise(environ);
+    lsh_plans_initialise();
+    char const* const control_path = getenv("LSH_CONTROL_SOCKET");
+    if(control_path != NULL && control_path[0] != '\0') {
+        lsh_control_open(control_path, STDERR_FILENO);
+    }
+
+    char const* const record_path = getenv("LSH_RECORD");
+    if(record_path != NULL && record_path[0] != '\0') {
+        lsh_record_open(record_path, STDERR_FILENO);
+    }
+
+    // The statistics and records are written by the shell itself, therefore
+    // the last command of a script must not replace it.
+    char const* const memstats = getenv("LSH_MEMSTATS");
+    bool const dump_memory = (memstats != NULL && memstats[0] != '\0');
+    if(dump_memory) {
+        atexit(lsh_dump_memory_statistics);
+    }
+
+    if(script != NULL) {
+        return lsh_run_script(&shell, script, script_name,
+                              !dump_memory && !lsh_is_recording());
+    }
+
+    lsh_history_initialise();
+    char const* const zygote = getenv("LSH_ZYGOTE");
+    if(zygote != NULL && zygote[0] != '\0') {
+        lsh_zygote_start(STDERR_FILENO);
+    }
+
     while(true) {
         lsh_update_job_statuses();
         lsh_cleanup_jobs();
 
         char* const cwd = lsh_get_cwd();
-        print_header(cwd);
+        char* const prompt = build_prompt(cwd);
         free(cwd);
 
         char* line = NULL;
-        int const getline_result = lsh_getline(&line);
+        int const getline_result = lsh_read_line(&shell, prompt, &line);
+        free(prompt);
         if(getline_result == -1) {
             exit(EXIT_SUCCESS);
         }
@@ -88,19 +355,23 @@ int main(void) {
             continue;
         }
 
-        Parse_Result parse_result = lsh_parse(line);
+        lsh_history_add(line, getline_result);
+
+        lsh_record_begin();
+        Parse_Result parse_result = lsh_parse_cached(&shell, line);
         if(parse_result.kind == PARSE_ERROR) {
             fprintf(stderr, "lsh: %s\n", parse_result.error);
+            lsh_record_command(line, NULL);
             free(parse_result.error);
             free(line);
             continue;
         }
 
         Command command = parse_result.value;
-        Job* const job = lsh_create_job();
-        job->command = line;
-        job->first_process = lsh_create_process_from_command(command);
+        Job* const job = lsh_create_job(line);
+        lsh_create_processes_from_command(job, command);
         lsh_start_job(&shell, job, command.foreground);
+        lsh_record_command(job->command, job);
         lsh_free_command(command);
     }
     return 0;
@@ -1,22 +1,27 @@
 #include "common.h"
 #include <parser.h>
 
+#include <brace.h>
+#include <expand.h>
+#include <vars.h>
+
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 static void free_process_args(Process_Args* args) {
-    if(args->values != NULL) {
-        for(char** c = args->values; *c != NULL; ++c) {
-            free(*c);
-        }
-        free(args->values);
+    if(args == NULL) {
+        return;
     }
-    free(args->redirect_in);
-    free(args->redirect_out);
-    free(args->redirect_err);
-    free(args);
+
+    lsh_free_tagged(MEMORY_PARSER, args->values);
+    lsh_free_tagged(MEMORY_PARSER, args->assignments);
+    lsh_free_tagged(MEMORY_PARSER, args->redirects);
+    lsh_close_substitution_fds(args->substitution_fds);
+    lsh_arena_free(&args->arena);
+    lsh_free_tagged(MEMORY_PARSER, args);
 }
 
 void lsh_free_command(Command command) {
@@ -34,7 +39,10 @@ static bool lsh_is_whitespace(char c) {
 static bool lsh_is_string_character(char c) {
     return (c >= 48 && c <= 57) || (c >= 65 && c <= 90) ||
            (c >= 97 && c <= 122) || c == '"' || c == '\'' || c == '.' ||
-           c == '/' || c == '%' || c == '-';
+           c == '/' || c == '%' || c == '-' || c == '$' || c == '`' ||
+           c == '_' || c == '=' || c == ':' || c == '+' || c == '@' ||
+           c == '{' || c == '}' || c == ',' || c == '*' || c == '?' ||
+           c == '[' || c == ']' || c == '!';
 }
 
 typedef enum Token_Kind {
@@ -42,9 +50,10 @@ typedef enum Token_Kind {
     TOKEN_STRING,
     TOKEN_PIPE,
     TOKEN_AMP,
-    TOKEN_REDIRECT_IN,
-    TOKEN_REDIRECT_OUT,
-    TOKEN_REDIRECT_ERR,
+    TOKEN_REDIRECT,
+    TOKEN_SEMICOLON,
+    TOKEN_OPEN_PAREN,
+    TOKEN_CLOSE_PAREN,
 } Token_Kind;
 
 typedef struct Token {
@@ -62,6 +71,33 @@ static bool lsh_match(char const* begin, char const* pattern) {
     return *pattern == '\0';
 }
 
+static bool lsh_is_process_substitution(char const* begin) {
+    return (*begin == '<' || *begin == '>') && begin[1] == '(';
+}
+
+// lsh_skip_redirect_operator
+// Returns:
+// Pointer past the [N]<, [N]>, [N]>> and the & that may follow them or NULL
+// if there is no redirect operator.
+//
+static char const* lsh_skip_redirect_operator(char const* begin) {
+    char const* i = begin;
+    while(*i >= '0' && *i <= '9') {
+        ++i;
+    }
+
+    if((*i != '<' && *i != '>') ||
+       (i == begin && lsh_is_process_substitution(i))) {
+        return NULL;
+    }
+
+    i += (i[0] == '>' && i[1] == '>' ? 2 : 1);
+    if(*i == '&') {
+        ++i;
+    }
+    return i;
+}
+
 static Token lsh_tokenise(char const* begin) {
     // Ignore leading whitespace.
     while(*begin != '\0' && lsh_is_whitespace(*begin)) {
@@ -79,49 +115,100 @@ static Token lsh_tokenise(char const* begin) {
     } else if(lsh_match(begin, "&")) {
         token.kind = TOKEN_AMP;
         token.end = begin + 1;
-    } else if(lsh_match(begin, "2>")) {
-        token.kind = TOKEN_REDIRECT_ERR;
-        token.end = begin + 2;
-    } else if(lsh_match(begin, ">")) {
-        token.kind = TOKEN_REDIRECT_OUT;
+    } else if(lsh_match(begin, ";")) {
+        token.kind = TOKEN_SEMICOLON;
+        token.end = begin + 1;
+    } else if(lsh_match(begin, "(")) {
+        token.kind = TOKEN_OPEN_PAREN;
         token.end = begin + 1;
-    } else if(lsh_match(begin, "<")) {
-        token.kind = TOKEN_REDIRECT_IN;
+    } else if(lsh_match(begin, ")")) {
+        token.kind = TOKEN_CLOSE_PAREN;
         token.end = begin + 1;
-    } else if(lsh_is_string_character(*begin)) {
+    } else if(lsh_skip_redirect_operator(begin) != NULL) {
+        token.kind = TOKEN_REDIRECT;
+        token.end = lsh_skip_redirect_operator(begin);
+    } else if(lsh_is_string_character(*begin) ||
+              lsh_is_process_substitution(begin)) {
         token.kind = TOKEN_STRING;
-        bool quoted = false;
-        for(; *begin != '\0'; ++begin) {
-            if(*begin == '"' || *begin == '\'') {
-                quoted = !quoted;
+        char quote = '\0';
+        while(*begin != '\0') {
+            if(quote == '\'') {
+                if(*begin == '\'') {
+                    quote = '\0';
+                }
+                ++begin;
+                continue;
+            }
+
+            if(*begin == '$' && begin[1] == '{') {
+                char const* const next = lsh_skip_parameter(begin);
+                if(next == NULL) {
+                    begin += strlen(begin);
+                    break;
+                }
+                begin = next;
+                continue;
+            }
+
+            // A process substitution only begins a word, elsewhere < and >
+            // are redirects.
+            if((*begin == '$' && begin[1] == '(') || *begin == '`' ||
+               (begin == token.begin && lsh_is_process_substitution(begin))) {
+                char const* const next = lsh_skip_substitution(begin);
+                if(next == NULL) {
+                    // Unterminated substitution. Take the rest of the line,
+                    // expansion will report the error.
+                    begin += strlen(begin);
+                    break;
+                }
+                begin = next;
                 continue;
             }
 
-            if(quoted) {
+            if(quote == '"') {
+                if(*begin == '"') {
+                    quote = '\0';
+                }
+                ++begin;
                 continue;
             }
 
-            if(!lsh_is_string_character(*begin)) {
+            if(*begin == '"' || *begin == '\'') {
+                quote = *begin;
+            } else if(!lsh_is_string_character(*begin)) {
                 break;
             }
+            ++begin;
         }
         token.end = begin;
     }
     return token;
 }
 
-static char* lsh_normalise_token_string(Token const token) {
-    int const size = token.end - token.begin;
-    char* const buffer = lsh_alloc_and_zero(size + 1);
-    char const* b = token.begin;
-    char* i = buffer;
-    for(; b != token.end; ++b) {
-        if(*b != '"' && *b != '\'') {
-            *i = *b;
-            ++i;
-        }
+// lsh_expand_redirect_target
+// Expand the token naming the file of a redirect. The expansion must result in
+// exactly one word.
+//
+// Returns:
+// The file name allocated in the arena or NULL on error.
+//
+static char* lsh_expand_redirect_target(Shell* const shell, Token const token,
+                                        Arena* const arena) {
+    Word_List words = {0};
+    char* target = NULL;
+    if(lsh_expand_word(shell, token.begin, token.end, arena, &words) &&
+       words.size == 1) {
+        target = words.values[0];
     }
-    return buffer;
+    lsh_free_tagged(MEMORY_PARSER, words.values);
+    return target;
+}
+
+static Process_Args* lsh_create_process_args(void) {
+    Process_Args* const args =
+        lsh_alloc_tagged(MEMORY_PARSER, sizeof(Process_Args));
+    args->arena.tag = MEMORY_PARSER;
+    return args;
 }
 
 static bool lsh_parse_background_marker(char const** string) {
@@ -144,73 +231,297 @@ static bool lsh_parse_pipe(char const** string) {
     }
 }
 
-static bool lsh_parse_redirect(char const** string, Process_Args* const args) {
-    char const* const backup = *string;
+static bool lsh_token_equals(Token const token, char const* const string) {
+    int const size = token.end - token.begin;
+    return (int)strlen(string) == size &&
+           memcmp(token.begin, string, size) == 0;
+}
+
+// lsh_parse_descriptor
+// Returns:
+// The descriptor named by the digits of the token or -1 if they do not name
+// one of the descriptors left to the user (see LSH_USER_FD_LIMIT).
+//
+static int lsh_parse_descriptor(char const* begin, char const* const end) {
+    if(begin == end) {
+        return -1;
+    }
+
+    int fd = 0;
+    for(; begin != end; ++begin) {
+        if(*begin < '0' || *begin > '9') {
+            return -1;
+        }
+
+        fd = fd * 10 + (*begin - '0');
+        if(fd >= LSH_USER_FD_LIMIT) {
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static void lsh_push_redirect(Process_Args* const args,
+                              Redirect const redirect) {
+    args->redirects = lsh_realloc_tagged(
+        MEMORY_PARSER, args->redirects,
+        (args->redirect_count + 1) * sizeof(Redirect));
+    if(!args->redirects) {
+        fprintf(stderr, "push_redirect: allocation failure");
+        exit(EXIT_FAILURE);
+    }
+
+    args->redirects[args->redirect_count] = redirect;
+    args->redirect_count += 1;
+}
+
+// lsh_parse_redirects
+// Parse the redirects that follow the words of a process. Without a number
+// < redirects the standard input and > the standard output.
+//
+static bool lsh_parse_redirects(Shell* const shell, char const** string,
+                                Process_Args** const out_args) {
     while(true) {
         Token const token = lsh_tokenise(*string);
-        if(token.kind == TOKEN_REDIRECT_IN) {
-            Token const loc = lsh_tokenise(token.end);
-            if(loc.kind != TOKEN_STRING) {
-                *string = backup;
+        if(token.kind != TOKEN_REDIRECT) {
+            return true;
+        }
+
+        Token const target = lsh_tokenise(token.end);
+        if(target.kind != TOKEN_STRING) {
+            return false;
+        }
+
+        if(*out_args == NULL) {
+            *out_args = lsh_create_process_args();
+        }
+
+        Process_Args* const args = *out_args;
+        char const* operator = token.begin;
+        while(*operator >= '0' && *operator <= '9') {
+            ++operator;
+        }
+
+        Redirect redirect = {
+            .fd = (operator == token.begin
+                       ? (*operator == '<' ? STDIN_FILENO : STDOUT_FILENO)
+                       : lsh_parse_descriptor(token.begin, operator)),
+            .source = -1,
+        };
+        if(redirect.fd < 0) {
+            return false;
+        }
+
+        if(token.end[-1] == '&') {
+            // The descriptor may be named by a variable, such as that of a
+            // coprocess.
+            char const* const source =
+                lsh_expand_redirect_target(shell, target, &args->arena);
+            if(source == NULL) {
                 return false;
             }
 
-            if(args->redirect_in != NULL) {
-                free(args->redirect_in);
+            if(strcmp(source, "-") == 0) {
+                redirect.mode = REDIRECT_CLOSE;
+            } else {
+                redirect.mode = REDIRECT_DUPLICATE;
+                redirect.source =
+                    lsh_parse_descriptor(source, source + strlen(source));
+                if(redirect.source < 0) {
+                    return false;
+                }
             }
-            args->redirect_in = lsh_normalise_token_string(loc);
-        } else if(token.kind == TOKEN_REDIRECT_OUT) {
-            Token const loc = lsh_tokenise(token.end);
-            if(loc.kind != TOKEN_STRING) {
-                *string = backup;
+        } else {
+            redirect.mode = (*operator == '<'       ? REDIRECT_READ
+                             : operator[1] == '>' ? REDIRECT_APPEND
+                                                  : REDIRECT_WRITE);
+            redirect.path =
+                lsh_expand_redirect_target(shell, target, &args->arena);
+            if(redirect.path == NULL) {
                 return false;
             }
+        }
 
-            if(args->redirect_out != NULL) {
-                free(args->redirect_out);
-            }
-            args->redirect_out = lsh_normalise_token_string(loc);
-        } else if(token.kind == TOKEN_REDIRECT_ERR) {
-            Token const loc = lsh_tokenise(token.end);
-            if(loc.kind != TOKEN_STRING) {
-                *string = backup;
-                return false;
+        lsh_push_redirect(args, redirect);
+        *string = target.end;
+    }
+}
+
+// lsh_is_assignment
+// Check whether the token has the form NAME=value before expansion.
+//
+static bool lsh_is_assignment(Token const token) {
+    char const* const equals =
+        memchr(token.begin, '=', token.end - token.begin);
+    return equals != NULL && lsh_is_variable_name(token.begin, equals);
+}
+
+// lsh_is_group_opener
+// Check whether the token opens a brace group or a subshell, which it does at
+// the start of a command only.
+//
+static bool lsh_is_group_opener(Token const token) {
+    return token.kind == TOKEN_OPEN_PAREN ||
+           (token.kind == TOKEN_STRING && lsh_token_equals(token, "{"));
+}
+
+// lsh_find_list_end
+// Find the end of a list of commands. A "}" closes a brace group where a
+// command would start only, so that it may still be an argument.
+//
+// Parameters:
+// close - '}' or ')' to find the end of a group, ';' to find the end of the
+//         first command.
+//
+// Returns:
+// Pointer to the closing delimiter, NULL if a group is not terminated or, if
+// close is ';', the null terminator when the list has a single command.
+//
+static char const* lsh_find_list_end(char const* begin, char const close) {
+    bool command_start = true;
+    while(true) {
+        Token const token = lsh_tokenise(begin);
+        if(token.kind == TOKEN_NONE) {
+            if(*token.end == '\0') {
+                return (close == ';' ? token.end : NULL);
             }
+            // Not a token of the shell, the parse reports it.
+            begin = token.end + 1;
+            command_start = false;
+            continue;
+        }
 
-            if(args->redirect_err != NULL) {
-                free(args->redirect_err);
+        if((close == ';' && token.kind == TOKEN_SEMICOLON) ||
+           (close == ')' && token.kind == TOKEN_CLOSE_PAREN) ||
+           (close == '}' && command_start && token.kind == TOKEN_STRING &&
+            lsh_token_equals(token, "}"))) {
+            return token.begin;
+        }
+
+        if(command_start && lsh_is_group_opener(token)) {
+            char const* const end = lsh_find_list_end(
+                token.end, (token.kind == TOKEN_OPEN_PAREN ? ')' : '}'));
+            if(end == NULL) {
+                return (close == ';' ? token.end + strlen(token.end) : NULL);
             }
-            args->redirect_err = lsh_normalise_token_string(loc);
+            begin = end + 1;
+            command_start = false;
+            continue;
         }
 
-        return true;
+        command_start = (token.kind == TOKEN_SEMICOLON ||
+                         token.kind == TOKEN_PIPE || token.kind == TOKEN_AMP);
+        begin = token.end;
+    }
+}
+
+char const* lsh_find_command_end(char const* const begin) {
+    return lsh_find_list_end(begin, ';');
+}
+
+// lsh_parse_group
+// Parse a brace group or subshell into the arguments of the process. Only
+// redirects may follow it.
+//
+static bool lsh_parse_group(char const** string, Token const opener,
+                            Process_Args* const args) {
+    bool const subshell = (opener.kind == TOKEN_OPEN_PAREN);
+    char const* const end =
+        lsh_find_list_end(opener.end, (subshell ? ')' : '}'));
+    if(end == NULL) {
+        return false;
+    }
+
+    args->group = lsh_arena_alloc_from_slice(&args->arena, opener.end, end);
+    args->subshell = subshell;
+    *string = end + 1;
+    return true;
+}
+
+// lsh_expand_token
+// Expand the token into words. Brace expansions are generated one word at a
+// time and expanded as they are produced. The first brace expansion of a
+// batched process is deferred to the process itself.
+//
+static bool lsh_expand_token(Shell* const shell, Token const token,
+                             Process_Args* const args,
+                             Word_List* const words) {
+    Brace_Expansion* const braces = lsh_brace_parse(token.begin, token.end);
+    if(braces == NULL) {
+        return lsh_expand_word(shell, token.begin, token.end, &args->arena,
+                               words);
     }
+
+    bool result = true;
+    if(args->batched && args->batch_word == NULL && words->size > 0) {
+        args->batch_word =
+            lsh_arena_alloc_from_slice(&args->arena, token.begin, token.end);
+        args->batch_index = words->size;
+    } else {
+        char const* begin = NULL;
+        char const* end = NULL;
+        while(result && lsh_brace_next(braces, &begin, &end)) {
+            result =
+                lsh_expand_word(shell, begin, end, &args->arena, words);
+        }
+    }
+    lsh_brace_free(braces);
+    return result;
 }
 
-static bool lsh_parse_single_process(char const** string,
+static bool lsh_parse_single_process(Shell* const shell, char const** string,
                                      Process_Args** const args) {
-    int args_capacity = 0;
-    int args_size = 0;
+    Word_List words = {0};
+    Word_List assignments = {0};
     while(true) {
         Token const token = lsh_tokenise(*string);
-        if(token.kind == TOKEN_STRING) {
+        if(token.kind == TOKEN_STRING ||
+           (token.kind == TOKEN_OPEN_PAREN && words.size == 0 &&
+            assignments.size == 0)) {
             if(*args == NULL) {
-                *args = lsh_alloc_and_zero(sizeof(Process_Args));
+                *args = lsh_create_process_args();
+            }
+
+            // Assignments are only recognised before the command name.
+            if(words.size == 0 && lsh_is_assignment(token)) {
+                char* const assignment = lsh_expand_assignment(
+                    shell, token.begin, token.end, &(*args)->arena);
+                if(assignment != NULL) {
+                    lsh_word_list_push(&assignments, assignment);
+                }
+                (*args)->assignments = assignments.values;
+                if(assignment == NULL) {
+                    free_process_args(*args);
+                    return false;
+                }
+
+                *string = token.end;
+                continue;
             }
 
-            if(args_size + 2 >= args_capacity) {
-                args_capacity = (args_capacity == 0 ? 64 : args_capacity * 2);
-                (*args)->values = realloc((*args)->values, args_capacity);
-                if(!(*args)->values) {
-                    fprintf(stderr,
-                            "lsh_parse_single_process: allocation failure");
-                    exit(EXIT_FAILURE);
+            if(words.size == 0 && assignments.size == 0 &&
+               !(*args)->batched && lsh_is_group_opener(token)) {
+                if(!lsh_parse_group(string, token, *args)) {
+                    free_process_args(*args);
+                    return false;
                 }
+                break;
+            }
+
+            if(words.size == 0 && !(*args)->batched &&
+               lsh_token_equals(token, "batch")) {
+                (*args)->batched = true;
+                *string = token.end;
+                continue;
             }
 
-            (*args)->values[args_size] = lsh_normalise_token_string(token);
-            (*args)->values[args_size + 1] = NULL;
-            args_size += 1;
+            bool const expand_result =
+                lsh_expand_token(shell, token, *args, &words);
+            (*args)->values = words.values;
+            if(!expand_result) {
+                free_process_args(*args);
+                return false;
+            }
 
             *string = token.end;
         } else {
@@ -218,20 +529,38 @@ static bool lsh_parse_single_process(char const** string,
         }
     }
 
-    bool const redirect_result = lsh_parse_redirect(string, *args);
-    if(!redirect_result) {
+    if(*args != NULL && (*args)->batched) {
+        if(words.size == 0) {
+            free_process_args(*args);
+            return false;
+        }
+
+        if((*args)->batch_word == NULL) {
+            // Batch everything after the command name.
+            (*args)->batch_index = 1;
+        }
+    }
+
+    bool const redirect_result = lsh_parse_redirects(shell, string, args);
+    if(!redirect_result ||
+       (*args != NULL && (*args)->group != NULL &&
+        lsh_tokenise(*string).kind == TOKEN_STRING)) {
         free_process_args(*args);
         return false;
     }
 
+    if(*args != NULL) {
+        (*args)->substitution_fds = lsh_take_substitution_fds();
+    }
     return true;
 }
 
-static bool lsh_parse_command(char const** string, Command* const command) {
+static bool lsh_parse_command(Shell* const shell, char const** string,
+                              Command* const command) {
     Process_Args* last_args = NULL;
     while(true) {
         Process_Args* out_args = NULL;
-        bool const result = lsh_parse_single_process(string, &out_args);
+        bool const result = lsh_parse_single_process(shell, string, &out_args);
         if(!result) {
             lsh_free_command(*command);
             return false;
@@ -254,14 +583,34 @@ static bool lsh_parse_command(char const** string, Command* const command) {
     return true;
 }
 
-Parse_Result lsh_parse(char const* command_string) {
-    Command command;
-    if(lsh_parse_command(&command_string, &command)) {
-        return (Parse_Result){.kind = PARSE_VALUE, .value = command};
+// lsh_parse_end
+// Lists of commands are only parsed inside groups, so a command may be
+// followed by a terminating semicolon and a comment only.
+//
+static bool lsh_parse_end(char const* const string) {
+    Token token = lsh_tokenise(string);
+    if(token.kind == TOKEN_SEMICOLON) {
+        token = lsh_tokenise(token.end);
+    }
+    return token.kind == TOKEN_NONE &&
+           (*token.begin == '\0' || *token.begin == '#');
+}
+
+Parse_Result lsh_parse(Shell* const shell, char const* command_string) {
+    Command command = {0};
+    if(lsh_parse_command(shell, &command_string, &command)) {
+        if(lsh_parse_end(command_string)) {
+            return (Parse_Result){.kind = PARSE_VALUE, .value = command};
+        }
+        lsh_free_command(command);
     } else {
-        char const msg[] = "syntax error";
-        return (Parse_Result){
-            .kind = PARSE_ERROR,
-            .error = lsh_allocate_from_slice(msg, msg + sizeof(msg))};
+        // The process that failed to parse never took the descriptors of its
+        // process substitutions.
+        lsh_close_substitution_fds(lsh_take_substitution_fds());
     }
+
+    char const msg[] = "syntax error";
+    return (Parse_Result){
+        .kind = PARSE_ERROR,
+        .error = lsh_allocate_from_slice(msg, msg + sizeof(msg))};
 }
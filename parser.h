@@ -1,13 +1,54 @@
 #pragma once
 
 #include <common.h>
+#include <shell.h>
+
+typedef enum Redirect_Mode {
+    REDIRECT_READ,
+    REDIRECT_WRITE,
+    REDIRECT_APPEND,
+    REDIRECT_DUPLICATE,
+    REDIRECT_CLOSE,
+} Redirect_Mode;
+
+// Redirect
+// [N]<path, [N]>path, [N]>>path, [N]<&M, [N]>&M or [N]>&-.
+//
+typedef struct Redirect {
+    // The redirected descriptor.
+    int fd;
+    Redirect_Mode mode;
+    // File of reads, writes and appends.
+    char* path;
+    // Descriptor that a duplicate refers to.
+    int source;
+} Redirect;
 
 typedef struct Process_Args {
     struct Process_Args* next;
+    // Owns values and the redirect strings.
+    Arena arena;
     char** values;
-    char* redirect_in;
-    char* redirect_out;
-    char* redirect_err;
+    // NAME=value words preceding the command name.
+    char** assignments;
+    // Set by a leading "batch". The arguments are then split into several
+    // executions that each fit within ARG_MAX.
+    bool batched;
+    // The first brace expansion word of a batched process. It is expanded
+    // lazily by the process and its words are inserted at batch_index.
+    // Without it the arguments from batch_index onwards are batched.
+    char* batch_word;
+    int batch_index;
+    // Applied in order.
+    Redirect* redirects;
+    int redirect_count;
+    // Descriptors of the process substitutions of the arguments and redirects,
+    // terminated by -1, or NULL.
+    int* substitution_fds;
+    // Commands of a brace group or subshell separated by ";", which are parsed
+    // and expanded when the group runs. The process has no values then.
+    char* group;
+    bool subshell;
 } Process_Args;
 
 typedef struct Command {
@@ -28,5 +69,18 @@ typedef struct Parse_Result {
     };
 } Parse_Result;
 
-Parse_Result lsh_parse(char const* command_string);
+// lsh_parse
+// Parse and expand a command. Command substitutions are executed while
+// parsing.
+//
+Parse_Result lsh_parse(Shell* shell, char const* command_string);
 void lsh_free_command(Command command);
+
+// lsh_find_command_end
+// Find the end of the first command of a list of commands separated by ";".
+// Separators within quotes, substitutions and groups are skipped.
+//
+// Returns:
+// Pointer to the ";" that ends the command or to the null terminator.
+//
+char const* lsh_find_command_end(char const* begin);
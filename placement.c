@@ -0,0 +1,325 @@
+#include <placement.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+typedef struct Resource_Name {
+    char const* name;
+    int resource;
+} Resource_Name;
+
+static Resource_Name const resource_names[] = {
+    {"as", RLIMIT_AS},
+    {"core", RLIMIT_CORE},
+    {"cpu", RLIMIT_CPU},
+    {"data", RLIMIT_DATA},
+    {"fsize", RLIMIT_FSIZE},
+    {"locks", RLIMIT_LOCKS},
+    {"memlock", RLIMIT_MEMLOCK},
+    {"msgqueue", RLIMIT_MSGQUEUE},
+    {"nice", RLIMIT_NICE},
+    {"nofile", RLIMIT_NOFILE},
+    {"nproc", RLIMIT_NPROC},
+    {"rss", RLIMIT_RSS},
+    {"rtprio", RLIMIT_RTPRIO},
+    {"rttime", RLIMIT_RTTIME},
+    {"sigpending", RLIMIT_SIGPENDING},
+    {"stack", RLIMIT_STACK},
+};
+
+static Placement default_placement;
+
+Placement* lsh_get_default_placement(void) {
+    return &default_placement;
+}
+
+static char const* lsh_resource_name(int const resource) {
+    for(size_t i = 0; i < sizeof(resource_names) / sizeof(Resource_Name);
+        ++i) {
+        if(resource_names[i].resource == resource) {
+            return resource_names[i].name;
+        }
+    }
+    return "?";
+}
+
+static bool lsh_parse_number(char const* const begin, char const* const end,
+                             long* const value) {
+    if(begin == end) {
+        return false;
+    }
+
+    long result = 0;
+    for(char const* i = begin; i != end; ++i) {
+        if(*i < '0' || *i > '9' || result > (LONG_MAX - 9) / 10) {
+            return false;
+        }
+        result = result * 10 + (*i - '0');
+    }
+    *value = result;
+    return true;
+}
+
+bool lsh_parse_cpu_list(char const* string, cpu_set_t* const set) {
+    CPU_ZERO(set);
+    while(true) {
+        char const* const comma = strchrnul(string, ',');
+        char const* const dash = memchr(string, '-', comma - string);
+        long first = 0;
+        long last = 0;
+        if(dash == NULL) {
+            if(!lsh_parse_number(string, comma, &first)) {
+                return false;
+            }
+            last = first;
+        } else if(!lsh_parse_number(string, dash, &first) ||
+                  !lsh_parse_number(dash + 1, comma, &last) || last < first) {
+            return false;
+        }
+
+        if(last >= CPU_SETSIZE) {
+            return false;
+        }
+
+        for(long cpu = first; cpu <= last; ++cpu) {
+            CPU_SET(cpu, set);
+        }
+
+        if(*comma == '\0') {
+            return true;
+        }
+        string = comma + 1;
+    }
+}
+
+void lsh_print_cpu_list(cpu_set_t const* const set, int const fd_out) {
+    bool first = true;
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if(!CPU_ISSET(cpu, set)) {
+            continue;
+        }
+
+        int last = cpu;
+        while(last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) {
+            last += 1;
+        }
+
+        dprintf(fd_out, (first ? "%d" : ",%d"), cpu);
+        if(last != cpu) {
+            dprintf(fd_out, "-%d", last);
+        }
+        first = false;
+        cpu = last;
+    }
+}
+
+static bool lsh_parse_limit_value(char const* const begin,
+                                  char const* const end, rlim_t* const value) {
+    if(end - begin == 9 && memcmp(begin, "unlimited", 9) == 0) {
+        *value = RLIM_INFINITY;
+        return true;
+    }
+
+    long number = 0;
+    if(!lsh_parse_number(begin, end, &number)) {
+        return false;
+    }
+    *value = number;
+    return true;
+}
+
+// lsh_parse_limit
+// Parse RESOURCE=SOFT[:HARD]. Without HARD both limits are set to SOFT.
+//
+static bool lsh_parse_limit(char const* const string,
+                            Placement_Limit* const limit) {
+    char const* const equals = strchr(string, '=');
+    if(equals == NULL) {
+        return false;
+    }
+
+    limit->resource = -1;
+    for(size_t i = 0; i < sizeof(resource_names) / sizeof(Resource_Name);
+        ++i) {
+        size_t const length = strlen(resource_names[i].name);
+        if(length == (size_t)(equals - string) &&
+           strncasecmp(resource_names[i].name, string, length) == 0) {
+            limit->resource = resource_names[i].resource;
+        }
+    }
+
+    if(limit->resource < 0) {
+        return false;
+    }
+
+    char const* const end = equals + strlen(equals);
+    char const* const colon = memchr(equals + 1, ':', end - equals - 1);
+    if(colon == NULL) {
+        if(!lsh_parse_limit_value(equals + 1, end, &limit->limit.rlim_cur)) {
+            return false;
+        }
+        limit->limit.rlim_max = limit->limit.rlim_cur;
+        return true;
+    }
+
+    return lsh_parse_limit_value(equals + 1, colon, &limit->limit.rlim_cur) &&
+           lsh_parse_limit_value(colon + 1, end, &limit->limit.rlim_max) &&
+           limit->limit.rlim_cur <= limit->limit.rlim_max;
+}
+
+static void lsh_set_limit(Placement* const placement,
+                          Placement_Limit const* const limit) {
+    for(int i = 0; i < placement->limit_count; ++i) {
+        if(placement->limits[i].resource == limit->resource) {
+            placement->limits[i] = *limit;
+            return;
+        }
+    }
+
+    // The table holds every resource once, therefore there is always room.
+    placement->limits[placement->limit_count] = *limit;
+    placement->limit_count += 1;
+}
+
+int lsh_parse_placement(char** const args, Placement* const placement,
+                        int const fd_err) {
+    Placement result = {0};
+    int i = 1;
+    for(; args[i] != NULL && args[i][0] == '-'; i += 2) {
+        if(strcmp(args[i], "-c") != 0 && strcmp(args[i], "-n") != 0 &&
+           strcmp(args[i], "-r") != 0) {
+            dprintf(fd_err, "place: unknown option %s\n", args[i]);
+            return -1;
+        }
+
+        char const* const value = args[i + 1];
+        if(value == NULL) {
+            dprintf(fd_err, "place: expected argument of %s\n", args[i]);
+            return -1;
+        }
+
+        if(args[i][1] == 'c') {
+            if(!lsh_parse_cpu_list(value, &result.affinity) ||
+               CPU_COUNT(&result.affinity) == 0) {
+                dprintf(fd_err, "place: invalid cpu list %s\n", value);
+                return -1;
+            }
+            result.has_affinity = true;
+        } else if(args[i][1] == 'n') {
+            char* end = NULL;
+            long const nice = strtol(value, &end, 10);
+            if(end == value || *end != '\0' || nice < -20 || nice > 19) {
+                dprintf(fd_err, "place: invalid nice value %s\n", value);
+                return -1;
+            }
+            result.has_nice = true;
+            result.nice = nice;
+        } else {
+            Placement_Limit limit;
+            if(!lsh_parse_limit(value, &limit)) {
+                dprintf(fd_err, "place: invalid limit %s\n", value);
+                return -1;
+            }
+            lsh_set_limit(&result, &limit);
+        }
+    }
+
+    *placement = result;
+    return i;
+}
+
+void lsh_merge_placement(Placement* const placement,
+                         Placement const* const overrides) {
+    if(overrides->has_affinity) {
+        placement->has_affinity = true;
+        placement->affinity = overrides->affinity;
+    }
+
+    if(overrides->has_nice) {
+        placement->has_nice = true;
+        placement->nice = overrides->nice;
+    }
+
+    for(int i = 0; i < overrides->limit_count; ++i) {
+        lsh_set_limit(placement, &overrides->limits[i]);
+    }
+}
+
+static void lsh_print_limit_value(rlim_t const value, int const fd_out) {
+    if(value == RLIM_INFINITY) {
+        dprintf(fd_out, "unlimited");
+    } else {
+        dprintf(fd_out, "%llu", (unsigned long long)value);
+    }
+}
+
+void lsh_print_placement(Placement const* const placement, int const fd_out) {
+    dprintf(fd_out, "place");
+    if(placement->has_affinity) {
+        dprintf(fd_out, " -c ");
+        lsh_print_cpu_list(&placement->affinity, fd_out);
+    }
+
+    if(placement->has_nice) {
+        dprintf(fd_out, " -n %d", placement->nice);
+    }
+
+    for(int i = 0; i < placement->limit_count; ++i) {
+        Placement_Limit const* const limit = &placement->limits[i];
+        dprintf(fd_out, " -r %s=", lsh_resource_name(limit->resource));
+        lsh_print_limit_value(limit->limit.rlim_cur, fd_out);
+        dprintf(fd_out, ":");
+        lsh_print_limit_value(limit->limit.rlim_max, fd_out);
+    }
+    dprintf(fd_out, "\n");
+}
+
+void lsh_apply_placement(Placement const* const placement) {
+    if(placement->has_affinity &&
+       sched_setaffinity(0, sizeof(cpu_set_t), &placement->affinity) != 0) {
+        perror("lsh: sched_setaffinity");
+    }
+
+    if(placement->has_nice &&
+       setpriority(PRIO_PROCESS, 0, placement->nice) != 0) {
+        perror("lsh: setpriority");
+    }
+
+    for(int i = 0; i < placement->limit_count; ++i) {
+        Placement_Limit const* const limit = &placement->limits[i];
+        if(setrlimit(limit->resource, &limit->limit) != 0) {
+            fprintf(stderr, "lsh: setrlimit %s: %s\n",
+                    lsh_resource_name(limit->resource), strerror(errno));
+        }
+    }
+}
+
+int lsh_set_process_affinity(pid_t const pid, cpu_set_t const* const set) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+    DIR* const directory = opendir(path);
+    if(directory == NULL) {
+        // Without /proc only the main thread may be reached.
+        return sched_setaffinity(pid, sizeof(cpu_set_t), set);
+    }
+
+    int result = 0;
+    struct dirent* entry = NULL;
+    while((entry = readdir(directory)) != NULL) {
+        if(entry->d_name[0] == '.') {
+            continue;
+        }
+
+        pid_t const tid = atoi(entry->d_name);
+        if(sched_setaffinity(tid, sizeof(cpu_set_t), set) != 0) {
+            result = -1;
+        }
+    }
+    closedir(directory);
+    return result;
+}
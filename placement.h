@@ -0,0 +1,82 @@
+#pragma once
+
+#include <common.h>
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#define LSH_PLACEMENT_MAX_LIMITS 16
+
+typedef struct Placement_Limit {
+    int resource;
+    struct rlimit limit;
+} Placement_Limit;
+
+// Placement
+// CPU affinity, nice value and resource limits applied to a process before it
+// executes the program. Unset attributes are inherited from the shell.
+//
+typedef struct Placement {
+    bool has_affinity;
+    cpu_set_t affinity;
+    bool has_nice;
+    int nice;
+    Placement_Limit limits[LSH_PLACEMENT_MAX_LIMITS];
+    int limit_count;
+} Placement;
+
+// lsh_get_default_placement
+// The placement every new job starts with.
+//
+Placement* lsh_get_default_placement(void);
+
+// lsh_parse_cpu_list
+// Parse a list of CPUs such as "0-3,6".
+//
+// Returns:
+// false if the list is malformed.
+//
+bool lsh_parse_cpu_list(char const* string, cpu_set_t* set);
+
+// lsh_print_cpu_list
+// Print the set in the format accepted by lsh_parse_cpu_list.
+//
+void lsh_print_cpu_list(cpu_set_t const* set, int fd_out);
+
+// lsh_parse_placement
+// Parse the arguments of "place [-c CPUS] [-n NICE] [-r RESOURCE=SOFT[:HARD]]".
+// The limits are numbers or "unlimited".
+//
+// Parameters:
+// args - the arguments starting with "place".
+// fd_err - receives the error messages or -1 to discard them.
+//
+// Returns:
+// The number of arguments consumed or -1 if they are invalid.
+//
+int lsh_parse_placement(char** args, Placement* placement, int fd_err);
+
+// lsh_merge_placement
+// Override the attributes of the placement with those set in overrides.
+//
+void lsh_merge_placement(Placement* placement, Placement const* overrides);
+
+// lsh_print_placement
+// Print the set attributes as the arguments of place.
+//
+void lsh_print_placement(Placement const* placement, int fd_out);
+
+// lsh_apply_placement
+// Apply the placement to the calling process. Failures are reported and
+// otherwise ignored.
+//
+void lsh_apply_placement(Placement const* placement);
+
+// lsh_set_process_affinity
+// Set the affinity of every thread of a running process.
+//
+// Returns:
+// 0 on success or -1 if the affinity of any thread could not be set.
+//
+int lsh_set_process_affinity(pid_t pid, cpu_set_t const* set);
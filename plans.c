@@ -0,0 +1,250 @@
+#include <plans.h>
+
+#include <expand.h>
+#include <vars.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LSH_PLAN_CAPACITY 256
+// Power of two.
+#define LSH_PLAN_BUCKETS 512
+
+// Plan
+// The parsed and expanded command of a line. A plan is never modified, every
+// use receives a copy of the command.
+//
+typedef struct Plan {
+    // Neighbours in the order of use, the most recently used first.
+    struct Plan* prev;
+    struct Plan* next;
+    // Next plan in the same bucket.
+    struct Plan* chain;
+    uint64_t hash;
+    char* line;
+    Command command;
+    // Whether the expansion substituted variables and the generation of the
+    // variables it saw.
+    bool uses_variables;
+    uint64_t generation;
+} Plan;
+
+typedef struct Plan_Cache {
+    Plan* buckets[LSH_PLAN_BUCKETS];
+    Plan* first;
+    Plan* last;
+    Pool pool;
+    int size;
+    long hits;
+    long misses;
+    // Misses whose plan could not be cached.
+    long uncacheable;
+    // Plans discarded because a variable changed.
+    long invalidations;
+    long evictions;
+} Plan_Cache;
+
+static Plan_Cache cache;
+
+void lsh_plans_initialise(void) {
+    lsh_pool_initialise(&cache.pool, "plans", MEMORY_PARSER, sizeof(Plan));
+}
+
+static uint64_t lsh_hash_line(char const* line) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037u;
+    for(; *line != '\0'; ++line) {
+        hash ^= (unsigned char)*line;
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+static Plan** lsh_plan_bucket(uint64_t const hash) {
+    return &cache.buckets[hash & (LSH_PLAN_BUCKETS - 1)];
+}
+
+static void lsh_unlink_plan(Plan* const plan) {
+    if(plan->prev != NULL) {
+        plan->prev->next = plan->next;
+    } else {
+        cache.first = plan->next;
+    }
+
+    if(plan->next != NULL) {
+        plan->next->prev = plan->prev;
+    } else {
+        cache.last = plan->prev;
+    }
+}
+
+static void lsh_push_plan_front(Plan* const plan) {
+    plan->prev = NULL;
+    plan->next = cache.first;
+    if(cache.first != NULL) {
+        cache.first->prev = plan;
+    } else {
+        cache.last = plan;
+    }
+    cache.first = plan;
+}
+
+static void lsh_remove_plan(Plan* const plan) {
+    for(Plan** i = lsh_plan_bucket(plan->hash); *i != NULL;
+        i = &(*i)->chain) {
+        if(*i == plan) {
+            *i = plan->chain;
+            break;
+        }
+    }
+
+    lsh_unlink_plan(plan);
+    lsh_free_command(plan->command);
+    lsh_free_tagged(MEMORY_PARSER, plan->line);
+    lsh_pool_free(&cache.pool, plan);
+    cache.size -= 1;
+}
+
+static Plan* lsh_find_plan(uint64_t const hash, char const* const line) {
+    for(Plan* plan = *lsh_plan_bucket(hash); plan != NULL;
+        plan = plan->chain) {
+        if(plan->hash == hash && strcmp(plan->line, line) == 0) {
+            return plan;
+        }
+    }
+    return NULL;
+}
+
+static char* lsh_copy_string(Arena* const arena, char const* const string) {
+    if(string == NULL) {
+        return NULL;
+    }
+    return lsh_arena_alloc_from_slice(arena, string, string + strlen(string));
+}
+
+// lsh_copy_words
+// Copy a null-terminated array of words. The array is allocated with malloc
+// like those of a parsed command and the words are owned by the arena.
+//
+static char** lsh_copy_words(Arena* const arena, char** const words) {
+    if(words == NULL) {
+        return NULL;
+    }
+
+    int count = 0;
+    while(words[count] != NULL) {
+        count += 1;
+    }
+
+    char** const copy =
+        lsh_alloc_tagged(MEMORY_PARSER, (count + 1) * sizeof(char*));
+    for(int i = 0; i < count; ++i) {
+        copy[i] = lsh_copy_string(arena, words[i]);
+    }
+    return copy;
+}
+
+// lsh_instantiate_plan
+// Returns:
+// A copy of the command of the plan that owns all of its strings.
+//
+static Command lsh_instantiate_plan(Plan const* const plan) {
+    Command command = {.foreground = plan->command.foreground};
+    Process_Args** out = &command.args;
+    for(Process_Args const* args = plan->command.args; args != NULL;
+        args = args->next) {
+        Process_Args* const copy =
+            lsh_alloc_tagged(MEMORY_PARSER, sizeof(Process_Args));
+        copy->arena.tag = MEMORY_PARSER;
+        copy->values = lsh_copy_words(&copy->arena, args->values);
+        copy->assignments = lsh_copy_words(&copy->arena, args->assignments);
+        copy->batched = args->batched;
+        copy->batch_word = lsh_copy_string(&copy->arena, args->batch_word);
+        copy->batch_index = args->batch_index;
+        if(args->redirect_count > 0) {
+            size_t const size = args->redirect_count * sizeof(Redirect);
+            copy->redirects = lsh_alloc_tagged(MEMORY_PARSER, size);
+            memcpy(copy->redirects, args->redirects, size);
+            for(int i = 0; i < args->redirect_count; ++i) {
+                copy->redirects[i].path =
+                    lsh_copy_string(&copy->arena, args->redirects[i].path);
+            }
+        }
+        copy->redirect_count = args->redirect_count;
+        copy->group = lsh_copy_string(&copy->arena, args->group);
+        copy->subshell = args->subshell;
+        *out = copy;
+        out = &copy->next;
+    }
+    return command;
+}
+
+Parse_Result lsh_parse_cached(Shell* const shell, char const* const line) {
+    uint64_t const hash = lsh_hash_line(line);
+    Plan* plan = lsh_find_plan(hash, line);
+    if(plan != NULL) {
+        if(!plan->uses_variables ||
+           plan->generation == lsh_get_variables_generation()) {
+            cache.hits += 1;
+            lsh_unlink_plan(plan);
+            lsh_push_plan_front(plan);
+            return (Parse_Result){.kind = PARSE_VALUE,
+                                  .value = lsh_instantiate_plan(plan)};
+        }
+
+        cache.invalidations += 1;
+        lsh_remove_plan(plan);
+    }
+
+    cache.misses += 1;
+    uint64_t const generation = lsh_get_variables_generation();
+    lsh_take_expansion_dependencies();
+    Parse_Result const result = lsh_parse(shell, line);
+    int const dependencies = lsh_take_expansion_dependencies();
+    if(result.kind == PARSE_ERROR) {
+        return result;
+    }
+
+    if((dependencies & (EXPANSION_GLOBS | EXPANSION_SUBSTITUTIONS)) != 0) {
+        cache.uncacheable += 1;
+        return result;
+    }
+
+    if(cache.size == LSH_PLAN_CAPACITY) {
+        cache.evictions += 1;
+        lsh_remove_plan(cache.last);
+    }
+
+    plan = lsh_pool_alloc(&cache.pool);
+    plan->hash = hash;
+    plan->line = lsh_allocate_from_slice(line, line + strlen(line) + 1);
+    lsh_memory_track(MEMORY_PARSER, plan->line);
+    plan->command = result.value;
+    plan->uses_variables = (dependencies & EXPANSION_VARIABLES) != 0;
+    plan->generation = generation;
+    Plan** const bucket = lsh_plan_bucket(hash);
+    plan->chain = *bucket;
+    *bucket = plan;
+    lsh_push_plan_front(plan);
+    cache.size += 1;
+    return (Parse_Result){.kind = PARSE_VALUE,
+                          .value = lsh_instantiate_plan(plan)};
+}
+
+void lsh_clear_plans(void) {
+    while(cache.first != NULL) {
+        lsh_remove_plan(cache.first);
+    }
+}
+
+void lsh_print_plan_statistics(int const fd_out) {
+    long const lookups = cache.hits + cache.misses;
+    dprintf(fd_out,
+            "plans: %d/%d cached, %ld hits, %ld misses (%.1f%% hit rate), "
+            "%ld uncacheable, %ld invalidated, %ld evicted\n",
+            cache.size, LSH_PLAN_CAPACITY, cache.hits, cache.misses,
+            (lookups > 0 ? 100.0 * cache.hits / lookups : 0.0),
+            cache.uncacheable, cache.invalidations, cache.evictions);
+}
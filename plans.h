@@ -0,0 +1,29 @@
+#pragma once
+
+#include <common.h>
+#include <parser.h>
+#include <shell.h>
+
+void lsh_plans_initialise(void);
+
+// lsh_parse_cached
+// Parse a command line like lsh_parse, reusing the plan of an earlier parse of
+// the same line. The least recently used plans are evicted once the cache is
+// full. Lines whose expansion matched patterns or ran command substitutions
+// are never cached, and plans that substituted variables are discarded as
+// soon as any variable changes.
+//
+// Returns:
+// A command owned by the caller or the parse error.
+//
+Parse_Result lsh_parse_cached(Shell* shell, char const* line);
+
+// lsh_clear_plans
+// Discard all cached plans. The statistics are kept.
+//
+void lsh_clear_plans(void);
+
+// lsh_print_plan_statistics
+// Print the size of the cache and its hit and miss counts.
+//
+void lsh_print_plan_statistics(int fd_out);
@@ -0,0 +1,433 @@
+#include <record.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LSH_RECORD_BUFFER_SIZE (1 << 16)
+
+static int record_fd = -1;
+static struct timespec session_start;
+static struct timespec command_start;
+static struct rusage command_usage;
+
+static long long lsh_elapsed_us(struct timespec const from,
+                                struct timespec const to) {
+    return (to.tv_sec - from.tv_sec) * 1000000LL +
+           (to.tv_nsec - from.tv_nsec) / 1000;
+}
+
+static long long lsh_cpu_us(struct rusage const* const usage) {
+    return (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000LL +
+           usage->ru_utime.tv_usec + usage->ru_stime.tv_usec;
+}
+
+bool lsh_record_open(char const* const path, int const fd_err) {
+    record_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if(record_fd < 0) {
+        dprintf(fd_err, "record: %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &session_start);
+    dprintf(record_fd, "# offset\tparse\tspawn\twait\treap\tcpu\tstatus\t"
+                       "command\n");
+    return true;
+}
+
+bool lsh_is_recording(void) {
+    return record_fd >= 0;
+}
+
+void lsh_record_begin(void) {
+    if(record_fd < 0) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &command_start);
+    getrusage(RUSAGE_SELF, &command_usage);
+}
+
+void lsh_record_command(char const* const line, Job const* const job) {
+    if(record_fd < 0) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    long long parse = lsh_elapsed_us(command_start, now);
+    long long spawn = 0;
+    long long wait = 0;
+    long long reap = 0;
+    int status = 2;
+    if(job != NULL) {
+        parse = lsh_elapsed_us(command_start, job->started);
+        spawn = lsh_elapsed_us(job->started, job->spawned);
+        wait = lsh_elapsed_us(job->spawned, now);
+        // Builtins and processes that still run have not finished.
+        struct timespec last = job->spawned;
+        for(int i = 0; i < job->process_count; ++i) {
+            Process const* const process = &job->processes[i];
+            if(process->pid != 0 && process->status != PROCESS_RUNNING &&
+               lsh_elapsed_us(last, process->finished) > 0) {
+                last = process->finished;
+            }
+        }
+        reap = lsh_elapsed_us(last, now);
+        status = (lsh_is_job_completed((Job*)job)
+                      ? lsh_get_job_exit_status(job)
+                      : -1);
+    }
+
+    dprintf(record_fd, "%lld\t%lld\t%lld\t%lld\t%lld\t%lld\t%d\t%s\n",
+            lsh_elapsed_us(session_start, command_start), parse, spawn, wait,
+            reap, lsh_cpu_us(&usage) - lsh_cpu_us(&command_usage), status,
+            line);
+}
+
+typedef struct Record {
+    long long offset;
+    long long parse;
+    long long spawn;
+    long long wait;
+    long long reap;
+    long long cpu;
+    int status;
+    char* command;
+} Record;
+
+// lsh_parse_record
+// Parse a line of a recording. The command points into the line.
+//
+// Returns:
+// false if the line is a comment or malformed.
+//
+static bool lsh_parse_record(char* const line, Record* const record) {
+    int consumed = 0;
+    if(line[0] == '#' ||
+       sscanf(line, "%lld\t%lld\t%lld\t%lld\t%lld\t%lld\t%d\t%n",
+              &record->offset, &record->parse, &record->spawn, &record->wait,
+              &record->reap, &record->cpu, &record->status, &consumed) != 7 ||
+       consumed == 0) {
+        return false;
+    }
+
+    record->command = line + consumed;
+    record->command[strcspn(record->command, "\n")] = '\0';
+    return true;
+}
+
+// lsh_load_records
+// Parameters:
+// records - receives the records, NULL if there are none. Caller must free
+//           the records and their commands.
+//
+// Returns:
+// false if the file cannot be read.
+//
+static bool lsh_load_records(char const* const path, Record** const records,
+                             int* const count) {
+    FILE* const file = fopen(path, "re");
+    if(file == NULL) {
+        fprintf(stderr, "replay: %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    *records = NULL;
+    int capacity = 0;
+    *count = 0;
+    char* line = NULL;
+    size_t line_capacity = 0;
+    while(getline(&line, &line_capacity, file) >= 0) {
+        Record record;
+        if(!lsh_parse_record(line, &record)) {
+            continue;
+        }
+
+        if(*count == capacity) {
+            capacity = (capacity > 0 ? capacity * 2 : 64);
+            *records = realloc(*records, capacity * sizeof(Record));
+            if(!*records) {
+                fprintf(stderr, "load_records: allocation failure");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        record.command = strdup(record.command);
+        (*records)[(*count)++] = record;
+    }
+    free(line);
+    fclose(file);
+    return true;
+}
+
+// lsh_spawn_replay_shell
+// Start an interactive shell whose terminal is the slave of the pseudo
+// terminal and which records its commands to the path.
+//
+// Returns:
+// The PID of the shell or -1 on failure.
+//
+static pid_t lsh_spawn_replay_shell(int const master,
+                                    char const* const record_path) {
+    // The master reports a hang up while the slave is not open, therefore
+    // the slave is opened before the fork and the child holds it throughout.
+    char const* const slave_path = ptsname(master);
+    int const slave = (slave_path != NULL
+                           ? open(slave_path, O_RDWR | O_NOCTTY | O_CLOEXEC)
+                           : -1);
+    if(slave < 0) {
+        return -1;
+    }
+
+    pid_t const pid = fork();
+    if(pid != 0) {
+        close(slave);
+        return pid;
+    }
+
+    setsid();
+    ioctl(slave, TIOCSCTTY, 0);
+    dup2(slave, STDIN_FILENO);
+    dup2(slave, STDOUT_FILENO);
+    dup2(slave, STDERR_FILENO);
+    close(slave);
+
+    // The replayed commands stay out of the history of the user.
+    setenv("LSH_RECORD", record_path, 1);
+    setenv("HISTFILE", "/dev/null", 1);
+    unsetenv("LSH_MEMSTATS");
+    execl("/proc/self/exe", "lsh", (char*)NULL);
+    _exit(127);
+}
+
+typedef struct Replay_Totals {
+    int count;
+    long long parse;
+    long long spawn;
+    long long wait;
+    long long reap;
+    long long cpu;
+    struct timespec last;
+} Replay_Totals;
+
+// lsh_read_replay_records
+// Add the complete records in the buffer to the totals and keep the rest of
+// the last line in the buffer.
+//
+static void lsh_read_replay_records(char* const buffer, size_t* const size,
+                                    Replay_Totals* const totals) {
+    char* begin = buffer;
+    char* end = NULL;
+    while((end = memchr(begin, '\n', buffer + *size - begin)) != NULL) {
+        *end = '\0';
+        Record record;
+        if(lsh_parse_record(begin, &record)) {
+            totals->count += 1;
+            totals->parse += record.parse;
+            totals->spawn += record.spawn;
+            totals->wait += record.wait;
+            totals->reap += record.reap;
+            totals->cpu += record.cpu;
+            clock_gettime(CLOCK_MONOTONIC, &totals->last);
+        }
+        begin = end + 1;
+    }
+
+    *size -= begin - buffer;
+    memmove(buffer, begin, *size);
+    // A line that does not fit is dropped.
+    if(*size == LSH_RECORD_BUFFER_SIZE) {
+        *size = 0;
+    }
+}
+
+static void lsh_print_replay_totals(Replay_Totals const* const totals,
+                                    long long const wall,
+                                    long long const recorded,
+                                    double const speed) {
+    long long const shell = totals->parse + totals->spawn + totals->reap;
+    printf("replayed %d commands in %.3f s, recorded in %.3f s, speed %g\n",
+           totals->count, wall / 1e6, recorded / 1e6, speed);
+    printf("commands: %.3f s\n", (totals->wait - totals->reap) / 1e6);
+    printf("shell: %.3f s, %.1f%% of the wall time (parse %.3f s, spawn "
+           "%.3f s, reap %.3f s)\n",
+           shell / 1e6, (wall > 0 ? 100.0 * shell / wall : 0.0),
+           totals->parse / 1e6, totals->spawn / 1e6, totals->reap / 1e6);
+    printf("shell cpu: %.3f s\n", totals->cpu / 1e6);
+}
+
+// lsh_drive_replay
+// Send the lines of the records to the shell on the master of its terminal
+// as they become due and add up the records that the shell writes back.
+//
+// Returns:
+// 0 if every line was recorded by the shell, 1 otherwise.
+//
+static int lsh_drive_replay(int const master, int const record_in,
+                            pid_t const shell, Record const* const records,
+                            int const count, double const speed) {
+    char* const buffer = malloc(LSH_RECORD_BUFFER_SIZE);
+    if(!buffer) {
+        fprintf(stderr, "drive_replay: allocation failure");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t buffered = 0;
+    Replay_Totals totals = {0};
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    totals.last = start;
+    int sent = 0;
+    bool exit_sent = false;
+    while(true) {
+        // The next line is due once the command before it has been recorded.
+        int timeout = -1;
+        if(totals.count == sent && sent < count) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long long const due =
+                (speed > 0 ? (records[sent].offset - records[0].offset) / speed
+                           : 0);
+            long long const elapsed = lsh_elapsed_us(start, now);
+            if(elapsed >= due) {
+                dprintf(master, "%s\n", records[sent].command);
+                sent += 1;
+                continue;
+            }
+            timeout = (due - elapsed + 999) / 1000;
+        } else if(totals.count == sent && !exit_sent) {
+            dprintf(master, "exit\n");
+            exit_sent = true;
+        }
+
+        struct pollfd fds[] = {
+            {.fd = master, .events = POLLIN},
+            {.fd = record_in, .events = POLLIN},
+        };
+        if(poll(fds, 2, timeout) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("replay: poll");
+            break;
+        }
+
+        if(fds[1].revents & POLLIN) {
+            ssize_t const size =
+                read(record_in, buffer + buffered,
+                     LSH_RECORD_BUFFER_SIZE - buffered);
+            if(size > 0) {
+                buffered += size;
+                lsh_read_replay_records(buffer, &buffered, &totals);
+            }
+        }
+
+        // The output of the commands is discarded. The master reports an
+        // error once the shell and its children have closed the terminal.
+        if(fds[0].revents != 0) {
+            char output[4096];
+            if(read(master, output, sizeof(output)) <= 0 && errno != EINTR) {
+                break;
+            }
+        }
+    }
+
+    waitpid(shell, NULL, 0);
+    // Records that arrived along with the end of the terminal.
+    ssize_t size = 0;
+    while((size = read(record_in, buffer + buffered,
+                       LSH_RECORD_BUFFER_SIZE - buffered)) > 0) {
+        buffered += size;
+        lsh_read_replay_records(buffer, &buffered, &totals);
+    }
+    free(buffer);
+
+    lsh_print_replay_totals(
+        &totals, lsh_elapsed_us(start, totals.last),
+        (count > 0 ? records[count - 1].offset - records[0].offset : 0),
+        speed);
+    return (totals.count == count ? 0 : 1);
+}
+
+// lsh_replay_through
+// Replay the records in a shell that writes its own records to the FIFO.
+//
+static int lsh_replay_through(char const* const record_path,
+                              Record const* const records, int const count,
+                              double const speed) {
+    // The replay holds a writer of the FIFO itself, so that it never reports
+    // the end before the shell has opened it.
+    int const record_in = open(record_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    int const record_hold = open(record_path, O_WRONLY | O_CLOEXEC);
+    int const master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    pid_t shell = -1;
+    if(record_in >= 0 && record_hold >= 0 && master >= 0 &&
+       grantpt(master) == 0 && unlockpt(master) == 0) {
+        shell = lsh_spawn_replay_shell(master, record_path);
+    }
+
+    int result = 1;
+    if(shell < 0) {
+        perror("replay: could not start the shell");
+    } else {
+        result =
+            lsh_drive_replay(master, record_in, shell, records, count, speed);
+    }
+
+    int const fds[] = {record_in, record_hold, master};
+    for(int i = 0; i < 3; ++i) {
+        if(fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    return result;
+}
+
+int lsh_replay_main(char const* const path, double const speed) {
+    Record* records = NULL;
+    int count = 0;
+    if(!lsh_load_records(path, &records, &count)) {
+        return 1;
+    }
+
+    if(count == 0) {
+        fprintf(stderr, "replay: %s: no records\n", path);
+        return 0;
+    }
+
+    int result = 1;
+    char directory[] = "/tmp/lsh-replay-XXXXXX";
+    if(mkdtemp(directory) == NULL) {
+        perror("replay: mkdtemp");
+    } else {
+        char record_path[sizeof(directory) + sizeof("/record")];
+        snprintf(record_path, sizeof(record_path), "%s/record", directory);
+        if(mkfifo(record_path, 0600) != 0) {
+            perror("replay: mkfifo");
+        } else {
+            result = lsh_replay_through(record_path, records, count, speed);
+            unlink(record_path);
+        }
+        rmdir(directory);
+    }
+
+    for(int i = 0; i < count; ++i) {
+        free(records[i].command);
+    }
+    free(records);
+    return result;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <common.h>
+#include <jobs.h>
+
+// lsh_record_open
+// Record the commands of the session to the file. Every command appends a
+// line of tab-separated fields:
+//
+// offset - microseconds from the start of the session to the command.
+// parse - microseconds spent parsing the line.
+// spawn - microseconds spent spawning the processes of the job.
+// wait - microseconds spent waiting for the job in the foreground.
+// reap - microseconds of the wait after the last process had exited.
+// cpu - microseconds of CPU time the shell spent on the command.
+// status - exit status of the job, -1 if it still runs or 2 if the line
+//          failed to parse.
+// command - the command line.
+//
+// Parameters:
+// fd_err - receives the error messages.
+//
+// Returns:
+// Whether the commands are recorded.
+//
+bool lsh_record_open(char const* path, int fd_err);
+
+// lsh_is_recording
+//
+bool lsh_is_recording(void);
+
+// lsh_record_begin
+// Mark the start of a command before its line is parsed.
+//
+void lsh_record_begin(void);
+
+// lsh_record_command
+// Record the command once lsh_start_job has returned.
+//
+// Parameters:
+// line - the command line.
+// job - the job of the line or NULL if the line failed to parse.
+//
+void lsh_record_command(char const* line, Job const* job);
+
+// lsh_replay_main
+// Replay a recording in an interactive shell on a pseudo terminal and report
+// how much of the wall time the shell spends around the commands. A line is
+// sent once its recorded offset, divided by the speed, has passed and the
+// command before it has completed. The output of the commands is discarded.
+//
+// Parameters:
+// speed - factor by which the recording is accelerated or 0 to send each
+//         line as soon as the command before it has completed.
+//
+// Returns:
+// The exit status of the replay.
+//
+int lsh_replay_main(char const* path, double speed);
@@ -1,5 +1,6 @@
 #include <shell.h>
 
+#include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,14 +8,15 @@
 #include <termios.h>
 #include <unistd.h>
 
-Shell lsh_shell_initialise(void) {
+Shell lsh_shell_initialise(bool const interactive) {
     Shell info = {.terminal = STDIN_FILENO};
-    info.is_interactive = isatty(info.terminal);
+    info.is_interactive = interactive && isatty(info.terminal);
     if(!info.is_interactive) {
-        // We do not support the non-interactive mode.
-        fprintf(stderr,
-                "shell_initialise: shell not running in interactive mode");
-        exit(EXIT_FAILURE);
+        // Without job control the shell leaves the terminal and the signals
+        // to whoever started it.
+        info.pid = getpid();
+        info.pgid = getpgrp();
+        return info;
     }
 
     // Loop until in the foreground.
@@ -34,10 +36,11 @@ Shell lsh_shell_initialise(void) {
     signal(SIGTSTP, SIG_IGN);
     signal(SIGTTIN, SIG_IGN);
     signal(SIGTTOU, SIG_IGN);
-    signal(SIGCHLD, SIG_IGN);
 
+    // A session leader, such as a shell started by a terminal emulator,
+    // leads its process group already and may not change it.
     info.pid = getpid();
-    if(setpgid(info.pid, info.pid)) {
+    if(getpgrp() != info.pid && setpgid(info.pid, info.pid)) {
         perror("shell_initialise: could not create own process group");
         exit(-1);
     }
@@ -54,3 +57,24 @@ char* lsh_get_cwd(void) {
     // parameters.
     return getcwd(NULL, 0);
 }
+
+void lsh_reserve_descriptor(int const fd) {
+    int const placeholder = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if(placeholder < 0) {
+        perror("lsh_reserve_descriptor: could not open /dev/null");
+        return;
+    }
+
+    if(placeholder != fd) {
+        dup3(placeholder, fd, O_CLOEXEC);
+        close(placeholder);
+    }
+}
+
+void lsh_reserve_user_descriptors(void) {
+    for(int fd = STDERR_FILENO + 1; fd < LSH_USER_FD_LIMIT; ++fd) {
+        if(fcntl(fd, F_GETFD) < 0) {
+            lsh_reserve_descriptor(fd);
+        }
+    }
+}
@@ -5,6 +5,10 @@
 #include <sys/types.h>
 #include <termios.h>
 
+// Descriptors below the limit are left to the redirects of the user, the
+// shell opens its own descriptors above it.
+#define LSH_USER_FD_LIMIT 10
+
 typedef struct Shell {
     int terminal;
     pid_t pgid;
@@ -14,12 +18,29 @@ typedef struct Shell {
 } Shell;
 
 // shell_initialise
-// Initialise the shell.
+// Initialise the shell. An interactive shell on a terminal takes the
+// terminal and manages jobs in their own process groups.
+//
+// Parameters:
+// interactive - false to run a script or a -c command.
 //
-Shell lsh_shell_initialise(void);
+Shell lsh_shell_initialise(bool interactive);
 
 // lsh_get_cwd
 // Obtain the current working directory of the calling process as an absolute
 // path. Caller must free the buffer.
 //
 char* lsh_get_cwd(void);
+
+// lsh_reserve_descriptor
+// Hold the descriptor with a placeholder that is closed on exec, so that the
+// shell does not open one of its own descriptors in its place and children
+// see it closed.
+//
+void lsh_reserve_descriptor(int fd);
+
+// lsh_reserve_user_descriptors
+// Reserve the descriptors below LSH_USER_FD_LIMIT that are not inherited
+// open. Must be called before the shell opens any descriptor.
+//
+void lsh_reserve_user_descriptors(void);
@@ -0,0 +1,255 @@
+#include <vars.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Variable {
+    // NAME=value. The same string is shared with envp when exported.
+    char* entry;
+    int name_length;
+    // Index into envp or -1 when not exported.
+    int env_index;
+    uint32_t hash;
+} Variable;
+
+// Open addressing with linear probing. Slots with a NULL entry are empty.
+static Variable* variables = NULL;
+static int variables_capacity = 0;
+static int variables_size = 0;
+
+static char** envp = NULL;
+static int envp_size = 0;
+static int envp_capacity = 0;
+
+// Incremented whenever the value of a variable changes.
+static uint64_t generation = 0;
+
+static uint32_t lsh_hash_name(char const* begin, char const* const end) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for(; begin != end; ++begin) {
+        hash ^= (unsigned char)*begin;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static Variable* lsh_find_slot(char const* const begin, char const* const end,
+                               uint32_t const hash) {
+    int const mask = variables_capacity - 1;
+    int const length = end - begin;
+    for(int i = hash & mask;; i = (i + 1) & mask) {
+        Variable* const variable = &variables[i];
+        if(variable->entry == NULL) {
+            return variable;
+        }
+
+        if(variable->hash == hash && variable->name_length == length &&
+           memcmp(variable->entry, begin, length) == 0) {
+            return variable;
+        }
+    }
+}
+
+static void lsh_grow_variables(void) {
+    Variable* const old = variables;
+    int const old_capacity = variables_capacity;
+    variables_capacity = (old_capacity == 0 ? 256 : old_capacity * 2);
+    variables = lsh_alloc_tagged(MEMORY_OTHER,
+                                 variables_capacity * sizeof(Variable));
+    for(int i = 0; i < old_capacity; ++i) {
+        if(old[i].entry != NULL) {
+            char const* const name = old[i].entry;
+            *lsh_find_slot(name, name + old[i].name_length, old[i].hash) =
+                old[i];
+        }
+    }
+    lsh_free_tagged(MEMORY_OTHER, old);
+}
+
+static void lsh_envp_push(Variable* const variable) {
+    if(envp_size + 2 >= envp_capacity) {
+        envp_capacity = (envp_capacity == 0 ? 256 : envp_capacity * 2);
+        envp = lsh_realloc_tagged(MEMORY_OTHER, envp,
+                                  envp_capacity * sizeof(char*));
+        if(!envp) {
+            fprintf(stderr, "envp_push: allocation failure");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    variable->env_index = envp_size;
+    envp[envp_size] = variable->entry;
+    envp[envp_size + 1] = NULL;
+    envp_size += 1;
+}
+
+static void lsh_envp_remove(Variable* const variable) {
+    // Move the last entry into the hole.
+    int const index = variable->env_index;
+    envp_size -= 1;
+    if(index != envp_size) {
+        char const* const moved = envp[envp_size];
+        char const* const equals = strchr(moved, '=');
+        Variable* const moved_variable = lsh_find_slot(
+            moved, equals, lsh_hash_name(moved, equals));
+        moved_variable->env_index = index;
+        envp[index] = envp[envp_size];
+    }
+    envp[envp_size] = NULL;
+    variable->env_index = -1;
+}
+
+static char* lsh_make_entry(char const* const name, int const name_length,
+                            char const* const value) {
+    int const value_length = strlen(value);
+    char* const entry =
+        lsh_alloc_tagged(MEMORY_OTHER, name_length + value_length + 2);
+    memcpy(entry, name, name_length);
+    entry[name_length] = '=';
+    memcpy(entry + name_length + 1, value, value_length);
+    return entry;
+}
+
+// lsh_put_variable
+// Insert or update the variable. export adds it to envp, otherwise the
+// exported state is preserved.
+//
+static void lsh_put_variable(char const* const name, int const name_length,
+                             char const* const value, bool const export) {
+    if((variables_size + 1) * 2 > variables_capacity) {
+        lsh_grow_variables();
+    }
+
+    uint32_t const hash = lsh_hash_name(name, name + name_length);
+    Variable* const variable = lsh_find_slot(name, name + name_length, hash);
+    char* const entry = lsh_make_entry(name, name_length, value);
+    if(variable->entry == NULL) {
+        variable->name_length = name_length;
+        variable->hash = hash;
+        variable->env_index = -1;
+        variables_size += 1;
+        generation += 1;
+    } else {
+        if(strcmp(variable->entry + name_length + 1, value) != 0) {
+            generation += 1;
+        }
+        lsh_free_tagged(MEMORY_OTHER, variable->entry);
+    }
+
+    variable->entry = entry;
+    if(variable->env_index >= 0) {
+        envp[variable->env_index] = entry;
+    } else if(export) {
+        lsh_envp_push(variable);
+    }
+}
+
+void lsh_variables_initialise(char** const environment) {
+    for(char** i = environment; *i != NULL; ++i) {
+        char const* const equals = strchr(*i, '=');
+        if(equals != NULL) {
+            lsh_put_variable(*i, equals - *i, equals + 1, true);
+        }
+    }
+
+    if(envp == NULL) {
+        envp = lsh_alloc_tagged(MEMORY_OTHER, sizeof(char*));
+    }
+}
+
+bool lsh_is_variable_name(char const* begin, char const* const end) {
+    if(begin == end || (*begin >= '0' && *begin <= '9')) {
+        return false;
+    }
+
+    for(; begin != end; ++begin) {
+        char const c = *begin;
+        if(!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+             (c >= 'a' && c <= 'z') || c == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+char const* lsh_get_variable(char const* const begin, char const* const end) {
+    if(variables_size == 0) {
+        return NULL;
+    }
+
+    Variable const* const variable =
+        lsh_find_slot(begin, end, lsh_hash_name(begin, end));
+    if(variable->entry == NULL) {
+        return NULL;
+    }
+    return variable->entry + variable->name_length + 1;
+}
+
+void lsh_set_variable(char const* const name, char const* const value) {
+    lsh_put_variable(name, strlen(name), value, false);
+}
+
+bool lsh_assign_variable(char const* const assignment, bool const export) {
+    char const* const equals = strchr(assignment, '=');
+    if(equals == NULL || !lsh_is_variable_name(assignment, equals)) {
+        return false;
+    }
+
+    lsh_put_variable(assignment, equals - assignment, equals + 1, export);
+    return true;
+}
+
+void lsh_export_variable(char const* const name) {
+    int const name_length = strlen(name);
+    char const* const value = lsh_get_variable(name, name + name_length);
+    lsh_put_variable(name, name_length, value != NULL ? value : "", true);
+}
+
+void lsh_unset_variable(char const* const name) {
+    if(variables_size == 0) {
+        return;
+    }
+
+    int const name_length = strlen(name);
+    uint32_t const hash = lsh_hash_name(name, name + name_length);
+    Variable* variable = lsh_find_slot(name, name + name_length, hash);
+    if(variable->entry == NULL) {
+        return;
+    }
+
+    if(variable->env_index >= 0) {
+        lsh_envp_remove(variable);
+    }
+    lsh_free_tagged(MEMORY_OTHER, variable->entry);
+    variable->entry = NULL;
+    variables_size -= 1;
+    generation += 1;
+
+    // Backward shift deletion keeps probe sequences intact without
+    // tombstones.
+    int const mask = variables_capacity - 1;
+    int hole = variable - variables;
+    for(int i = (hole + 1) & mask; variables[i].entry != NULL;
+        i = (i + 1) & mask) {
+        int const home = variables[i].hash & mask;
+        // Move the entry if the hole lies cyclically within [home, i).
+        bool const movable = (hole <= i) ? (home <= hole || home > i)
+                                         : (home <= hole && home > i);
+        if(movable) {
+            variables[hole] = variables[i];
+            variables[i].entry = NULL;
+            hole = i;
+        }
+    }
+}
+
+uint64_t lsh_get_variables_generation(void) {
+    return generation;
+}
+
+char** lsh_get_envp(void) {
+    return envp;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <common.h>
+
+#include <stdint.h>
+
+// lsh_variables_initialise
+// Import the environment of the shell as exported variables.
+//
+void lsh_variables_initialise(char** environment);
+
+// lsh_is_variable_name
+// Check whether the slice is a valid variable name, i.e. a letter or
+// underscore followed by letters, digits or underscores.
+//
+bool lsh_is_variable_name(char const* begin, char const* end);
+
+// lsh_get_variable
+// Look up a variable by name given as a slice.
+//
+// Returns:
+// The value of the variable or NULL if it is not set.
+//
+char const* lsh_get_variable(char const* begin, char const* end);
+
+// lsh_set_variable
+// Set the value of a variable. An exported variable stays exported.
+//
+void lsh_set_variable(char const* name, char const* value);
+
+// lsh_assign_variable
+// Set a variable from an assignment of the form NAME=value.
+//
+// Parameters:
+// export - whether to also export the variable.
+//
+// Returns:
+// false if the assignment is malformed.
+//
+bool lsh_assign_variable(char const* assignment, bool export);
+
+// lsh_export_variable
+// Mark the variable as exported. The variable is created empty if it does not
+// exist.
+//
+void lsh_export_variable(char const* name);
+
+void lsh_unset_variable(char const* name);
+
+// lsh_get_variables_generation
+// Returns:
+// A counter that changes whenever a variable is set to a different value or
+// unset.
+//
+uint64_t lsh_get_variables_generation(void);
+
+// lsh_get_envp
+// Obtain the environment passed to executed programs. The array is maintained
+// incrementally as exported variables change, therefore this is O(1).
+//
+char** lsh_get_envp(void);
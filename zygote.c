@@ -0,0 +1,498 @@
+#include <zygote.h>
+
+#include <placement.h>
+#include <vars.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// The descriptors passed with a request: stdin, stdout, stderr and the
+// terminal.
+#define LSH_ZYGOTE_FD_COUNT 4
+
+typedef struct Zygote_Request {
+    pid_t pgid;
+    bool foreground;
+    int argc;
+    int envc;
+    // Size of the null-terminated arguments and environment that follow.
+    size_t strings_size;
+    Placement placement;
+} Zygote_Request;
+
+typedef struct Zygote_Reply {
+    pid_t pid;
+    int error;
+} Zygote_Reply;
+
+// Mirrors struct clone_args of linux/sched.h, which conflicts with sched.h.
+typedef struct Clone_Args {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+} Clone_Args;
+
+#define LSH_CLONE_PIDFD 0x00001000
+#define LSH_CLONE_PARENT 0x00008000
+
+static int zygote_fd = -1;
+
+static bool lsh_write_all(int const fd, char const* buffer, size_t size) {
+    while(size > 0) {
+        ssize_t const result = send(fd, buffer, size, MSG_NOSIGNAL);
+        if(result < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buffer += result;
+        size -= result;
+    }
+    return true;
+}
+
+static bool lsh_read_all(int const fd, char* buffer, size_t size) {
+    while(size > 0) {
+        ssize_t const result = read(fd, buffer, size);
+        if(result < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if(result <= 0) {
+            return false;
+        }
+        buffer += result;
+        size -= result;
+    }
+    return true;
+}
+
+// lsh_send_with_fds
+// Send the message in a single sendmsg with the descriptors attached.
+//
+static bool lsh_send_with_fds(int const socket, void const* const data,
+                              size_t const size, int const* const fds,
+                              int const fd_count) {
+    union {
+        char buffer[CMSG_SPACE(LSH_ZYGOTE_FD_COUNT * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {.iov_base = (void*)data, .iov_len = size};
+    struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1};
+    if(fd_count > 0) {
+        message.msg_control = control.buffer;
+        message.msg_controllen = CMSG_SPACE(fd_count * sizeof(int));
+        struct cmsghdr* const header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+        memcpy(CMSG_DATA(header), fds, fd_count * sizeof(int));
+    }
+
+    ssize_t result = 0;
+    do {
+        result = sendmsg(socket, &message, MSG_NOSIGNAL);
+    } while(result < 0 && errno == EINTR);
+
+    if(result < 0) {
+        return false;
+    }
+    // The descriptors travel with the first byte, the rest may follow.
+    return lsh_write_all(socket, (char const*)data + result, size - result);
+}
+
+// lsh_receive_with_fds
+// Receive a message of exactly size bytes and the descriptors attached to it.
+// Descriptors that are not passed are set to -1.
+//
+static bool lsh_receive_with_fds(int const socket, void* const data,
+                                 size_t const size, int* const fds,
+                                 int const fd_count) {
+    union {
+        char buffer[CMSG_SPACE(LSH_ZYGOTE_FD_COUNT * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {.iov_base = data, .iov_len = size};
+    struct msghdr message = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof(control.buffer),
+    };
+
+    ssize_t result = 0;
+    do {
+        result = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    } while(result < 0 && errno == EINTR);
+
+    for(int i = 0; i < fd_count; ++i) {
+        fds[i] = -1;
+    }
+
+    if(result <= 0) {
+        return false;
+    }
+
+    for(struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != NULL;
+        header = CMSG_NXTHDR(&message, header)) {
+        if(header->cmsg_level == SOL_SOCKET &&
+           header->cmsg_type == SCM_RIGHTS) {
+            int const count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(header),
+                   (count < fd_count ? count : fd_count) * sizeof(int));
+        }
+    }
+    return lsh_read_all(socket, (char*)data + result, size - result);
+}
+
+bool lsh_zygote_start(int const fd_err) {
+    if(zygote_fd >= 0) {
+        return true;
+    }
+
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        dprintf(fd_err, "zygote: socketpair: %s\n", strerror(errno));
+        return false;
+    }
+
+    pid_t const pid = fork();
+    if(pid < 0) {
+        dprintf(fd_err, "zygote: fork: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if(pid == 0) {
+        // Executing the shell again leaves the zygote with a minimal address
+        // space.
+        fcntl(fds[1], F_SETFD, 0);
+        char number[16];
+        snprintf(number, sizeof(number), "%d", fds[1]);
+        execl("/proc/self/exe", "lsh", "--zygote", number, (char*)NULL);
+        _exit(EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    // The zygote announces itself once it is ready.
+    char ready = 0;
+    if(!lsh_read_all(fds[0], &ready, 1)) {
+        dprintf(fd_err, "zygote: failed to start\n");
+        close(fds[0]);
+        return false;
+    }
+
+    zygote_fd = fds[0];
+    return true;
+}
+
+void lsh_zygote_stop(void) {
+    if(zygote_fd >= 0) {
+        // The zygote exits once it reads the end of the stream.
+        close(zygote_fd);
+        zygote_fd = -1;
+    }
+}
+
+bool lsh_zygote_running(void) {
+    return zygote_fd >= 0;
+}
+
+// lsh_is_same_variable
+// Check whether the two NAME=value entries name the same variable.
+//
+static bool lsh_is_same_variable(char const* a, char const* b) {
+    while(*a != '\0' && *a != '=' && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return *a == '=' && *b == '=';
+}
+
+pid_t lsh_zygote_spawn(Shell const* const shell, Process const* const process,
+                       pid_t const pgid, Descriptors const fd,
+                       bool const foreground, int* const pidfd) {
+    *pidfd = -1;
+    if(zygote_fd < 0) {
+        return -1;
+    }
+
+    // The assignments of the process override the exported variables.
+    char** const envp = lsh_get_envp();
+    int env_size = 0;
+    while(envp[env_size] != NULL) {
+        env_size += 1;
+    }
+
+    int assignment_count = 0;
+    while(process->assignments != NULL &&
+          process->assignments[assignment_count] != NULL) {
+        assignment_count += 1;
+    }
+
+    char const** const environment =
+        lsh_alloc_and_zero((env_size + assignment_count) * sizeof(char*));
+    int envc = 0;
+    for(int i = 0; i < env_size; ++i) {
+        environment[envc++] = envp[i];
+    }
+
+    for(int i = 0; i < assignment_count; ++i) {
+        char const* const assignment = process->assignments[i];
+        int j = 0;
+        while(j < envc && !lsh_is_same_variable(environment[j], assignment)) {
+            j += 1;
+        }
+
+        environment[j] = assignment;
+        if(j == envc) {
+            envc += 1;
+        }
+    }
+
+    int argc = 0;
+    size_t strings_size = 0;
+    for(; process->args[argc] != NULL; ++argc) {
+        strings_size += strlen(process->args[argc]) + 1;
+    }
+
+    for(int i = 0; i < envc; ++i) {
+        strings_size += strlen(environment[i]) + 1;
+    }
+
+    char* const strings = lsh_alloc_and_zero(strings_size);
+    char* top = strings;
+    for(int i = 0; i < argc; ++i) {
+        top = stpcpy(top, process->args[i]) + 1;
+    }
+
+    for(int i = 0; i < envc; ++i) {
+        top = stpcpy(top, environment[i]) + 1;
+    }
+    free(environment);
+
+    Zygote_Request const request = {
+        .pgid = pgid,
+        .foreground = foreground,
+        .argc = argc,
+        .envc = envc,
+        .strings_size = strings_size,
+        .placement = process->placement,
+    };
+    int const fds[LSH_ZYGOTE_FD_COUNT] = {fd.in, fd.out, fd.err,
+                                          shell->terminal};
+    Zygote_Reply reply = {0};
+    bool const sent = lsh_send_with_fds(zygote_fd, &request, sizeof(request),
+                                        fds, LSH_ZYGOTE_FD_COUNT) &&
+                      lsh_write_all(zygote_fd, strings, strings_size);
+    free(strings);
+    if(!sent || !lsh_receive_with_fds(zygote_fd, &reply, sizeof(reply), pidfd,
+                                      1)) {
+        perror("lsh_zygote_spawn: zygote lost");
+        lsh_zygote_stop();
+        return -1;
+    }
+
+    if(reply.pid < 0) {
+        errno = reply.error;
+        perror("lsh_zygote_spawn: clone3 failed");
+        return -1;
+    }
+
+    // Also set the group from the shell so that the next stage of the
+    // pipeline may join it even if the child has not done so yet.
+    setpgid(reply.pid, (pgid == 0 ? reply.pid : pgid));
+    return reply.pid;
+}
+
+// lsh_zygote_child
+// Become the program in the child spawned by the zygote.
+//
+static void lsh_zygote_child(Zygote_Request const* const request,
+                             int const* const fds, char** const argv,
+                             char** const envp) {
+    pid_t const pid = getpid();
+    pid_t const pgid = (request->pgid == 0 ? pid : request->pgid);
+    setpgid(0, pgid);
+    if(request->foreground) {
+        tcsetpgrp(fds[3], pgid);
+    }
+
+    // The zygote inherited the ignored signals of the shell.
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+
+    dup2(fds[0], STDIN_FILENO);
+    dup2(fds[1], STDOUT_FILENO);
+    dup2(fds[2], STDERR_FILENO);
+    lsh_apply_placement(&request->placement);
+
+    environ = envp;
+    execvp(argv[0], argv);
+    perror("execvp");
+    _exit(EXIT_FAILURE);
+}
+
+int lsh_zygote_main(int const fd) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    char const ready = 1;
+    if(!lsh_write_all(fd, &ready, 1)) {
+        return EXIT_FAILURE;
+    }
+
+    while(true) {
+        Zygote_Request request;
+        int fds[LSH_ZYGOTE_FD_COUNT];
+        if(!lsh_receive_with_fds(fd, &request, sizeof(request), fds,
+                                 LSH_ZYGOTE_FD_COUNT)) {
+            return EXIT_SUCCESS;
+        }
+
+        char* const strings = lsh_alloc_and_zero(request.strings_size);
+        char** const argv =
+            lsh_alloc_and_zero((request.argc + 1) * sizeof(char*));
+        char** const envp =
+            lsh_alloc_and_zero((request.envc + 1) * sizeof(char*));
+        if(!lsh_read_all(fd, strings, request.strings_size)) {
+            return EXIT_SUCCESS;
+        }
+
+        char* top = strings;
+        for(int i = 0; i < request.argc; ++i) {
+            argv[i] = top;
+            top += strlen(top) + 1;
+        }
+
+        for(int i = 0; i < request.envc; ++i) {
+            envp[i] = top;
+            top += strlen(top) + 1;
+        }
+
+        // The child is created as a sibling of the zygote, therefore the shell
+        // is its parent and receives its SIGCHLD.
+        int pidfd = -1;
+        Clone_Args args = {
+            .flags = LSH_CLONE_PARENT | LSH_CLONE_PIDFD,
+            .pidfd = (uint64_t)(uintptr_t)&pidfd,
+        };
+        Zygote_Reply reply = {0};
+        reply.pid = syscall(SYS_clone3, &args, sizeof(args));
+        if(reply.pid == 0) {
+            lsh_zygote_child(&request, fds, argv, envp);
+        }
+
+        reply.error = (reply.pid < 0 ? errno : 0);
+        bool const sent = lsh_send_with_fds(fd, &reply, sizeof(reply), &pidfd,
+                                            (pidfd >= 0 ? 1 : 0));
+        if(pidfd >= 0) {
+            close(pidfd);
+        }
+
+        for(int i = 0; i < LSH_ZYGOTE_FD_COUNT; ++i) {
+            if(fds[i] >= 0) {
+                close(fds[i]);
+            }
+        }
+        free(strings);
+        free(argv);
+        free(envp);
+        if(!sent) {
+            return EXIT_SUCCESS;
+        }
+    }
+}
+
+static double lsh_elapsed_microseconds(struct timespec const from) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - from.tv_sec) * 1e6 +
+           (now.tv_nsec - from.tv_nsec) / 1e3;
+}
+
+void lsh_zygote_benchmark(int const count, int const* const heap_sizes,
+                          int const heap_count, int const fd_out) {
+    bool const started = !lsh_zygote_running();
+    if(!lsh_zygote_start(fd_out)) {
+        return;
+    }
+
+    char* args[] = {"/bin/true", NULL};
+    Process const process = {.args = args};
+    Shell const shell = {.terminal = STDIN_FILENO};
+    Descriptors const fd = {
+        .in = STDIN_FILENO,
+        .out = STDOUT_FILENO,
+        .err = STDERR_FILENO,
+    };
+    dprintf(fd_out, "%10s %12s %12s\n", "heap MiB", "fork us", "zygote us");
+    for(int h = 0; h < heap_count; ++h) {
+        // Touch the ballast so that its pages are mapped and must be copied
+        // by fork.
+        size_t const size = (size_t)heap_sizes[h] << 20;
+        char* const ballast = malloc(size);
+        if(ballast == NULL && size > 0) {
+            dprintf(fd_out, "%10d allocation failed\n", heap_sizes[h]);
+            continue;
+        }
+        memset(ballast, 1, size);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int i = 0; i < count; ++i) {
+            pid_t const pid = fork();
+            if(pid == 0) {
+                execv(args[0], args);
+                _exit(EXIT_FAILURE);
+            }
+            waitpid(pid, NULL, 0);
+        }
+        double const fork_time = lsh_elapsed_microseconds(start) / count;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int i = 0; i < count; ++i) {
+            int pidfd = -1;
+            pid_t const pid =
+                lsh_zygote_spawn(&shell, &process, 0, fd, false, &pidfd);
+            if(pid > 0) {
+                waitpid(pid, NULL, 0);
+            }
+            if(pidfd >= 0) {
+                close(pidfd);
+            }
+        }
+        double const zygote_time = lsh_elapsed_microseconds(start) / count;
+        dprintf(fd_out, "%10d %12.1f %12.1f\n", heap_sizes[h], fork_time,
+                zygote_time);
+        free(ballast);
+    }
+
+    if(started) {
+        lsh_zygote_stop();
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <common.h>
+#include <jobs.h>
+
+#include <sys/types.h>
+
+// lsh_zygote_start
+// Start the zygote, a helper that spawns the programs of the jobs. It is the
+// shell executed afresh, therefore forking it stays cheap however large the
+// address space of the shell grows. Its children are created with
+// CLONE_PARENT and so are children of the shell, which waits for them as for
+// any other process.
+//
+// Parameters:
+// fd_err - receives the error messages.
+//
+// Returns:
+// Whether the zygote is running.
+//
+bool lsh_zygote_start(int fd_err);
+
+// lsh_zygote_stop
+//
+void lsh_zygote_stop(void);
+
+bool lsh_zygote_running(void);
+
+// lsh_zygote_spawn
+// Spawn the program of the process through the zygote. The child joins the
+// process group pgid or creates its own if pgid is 0.
+//
+// Parameters:
+// pidfd - receives a pidfd of the child.
+//
+// Returns:
+// The PID of the child or -1 if the zygote could not spawn it.
+//
+pid_t lsh_zygote_spawn(Shell const* shell, Process const* process, pid_t pgid,
+                       Descriptors fd, bool foreground, int* pidfd);
+
+// lsh_zygote_main
+// Serve the spawn requests that arrive on fd until the shell goes away.
+//
+// Returns:
+// The exit status of the zygote.
+//
+int lsh_zygote_main(int fd);
+
+// lsh_zygote_benchmark
+// Compare the latency of spawning /bin/true directly and through the zygote
+// with the heap of the shell grown by each of the given sizes.
+//
+// Parameters:
+// heap_sizes - sizes in MiB.
+//
+void lsh_zygote_benchmark(int count, int const* heap_sizes, int heap_count,
+                          int fd_out);